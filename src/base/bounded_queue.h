@@ -0,0 +1,77 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+using std::deque;
+
+namespace xtreaming {
+
+// Blocking first-in first-out queue of limited capacity, for handing work between the thread
+// pools of a pipeline. A full queue stalls its producers, so a slow stage throttles the ones before
+// it instead of piling up work.
+template <typename T>
+class BoundedQueue {
+  public:
+    int64_t capacity() const { return capacity_; }
+
+    // Set the capacity (at least one).
+    void Init(int64_t capacity) { capacity_ = capacity < 1 ? 1 : capacity; }
+
+    // Current number of items.
+    int64_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return items_.size();
+    }
+
+    // Block until there is room, then add an item. Returns false if the queue was closed.
+    bool Push(const T& item) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+            if (closed_) {
+                return false;
+            }
+            items_.push_back(item);
+        }
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Block until there is an item, then take it. Returns false once closed and drained.
+    bool Pop(T* item) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+            if (items_.empty()) {
+                return false;
+            }
+            *item = items_.front();
+            items_.pop_front();
+        }
+        not_full_.notify_one();
+        return true;
+    }
+
+    // Refuse further pushes, letting consumers drain what is left.
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+  private:
+    int64_t capacity_{1};                // Maximum number of items.
+    mutable std::mutex mutex_;           // Guards the below.
+    std::condition_variable not_full_;   // Signaled when an item is taken.
+    std::condition_variable not_empty_;  // Signaled when an item is added.
+    deque<T> items_;                     // Queued items.
+    bool closed_{false};                 // Whether pushes are refused.
+};
+
+}  // namespace xtreaming
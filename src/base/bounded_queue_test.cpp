@@ -0,0 +1,92 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <thread>
+
+#include "base/bounded_queue.h"
+
+using namespace xtreaming;
+
+namespace {
+
+void TestOrder() {
+    BoundedQueue<int64_t> queue;
+    queue.Init(0);
+    assert(queue.capacity() == 1);
+
+    queue.Init(4);
+    for (int64_t i = 0; i < 4; ++i) {
+        assert(queue.Push(i));
+    }
+    assert(queue.size() == 4);
+    for (int64_t i = 0; i < 4; ++i) {
+        int64_t item;
+        assert(queue.Pop(&item));
+        assert(item == i);
+    }
+    assert(!queue.size());
+}
+
+// A full queue stalls its producer until a consumer takes something.
+void TestFull() {
+    BoundedQueue<int64_t> queue;
+    queue.Init(2);
+    assert(queue.Push(0));
+    assert(queue.Push(1));
+
+    std::atomic<bool> is_pushed{false};
+    std::thread producer([&] {
+        assert(queue.Push(2));
+        is_pushed = true;
+    });
+    usleep(50 * 1000);
+    assert(!is_pushed);
+
+    int64_t item;
+    assert(queue.Pop(&item));
+    assert(item == 0);
+    producer.join();
+    assert(is_pushed);
+    assert(queue.size() == 2);
+}
+
+// Closing wakes a stalled producer, refuses further pushes, and lets consumers drain the rest.
+void TestClose() {
+    BoundedQueue<int64_t> queue;
+    queue.Init(1);
+    assert(queue.Push(7));
+
+    std::atomic<bool> is_refused{false};
+    std::thread producer([&] { is_refused = !queue.Push(8); });
+    usleep(50 * 1000);
+    queue.Close();
+    producer.join();
+    assert(is_refused);
+    assert(!queue.Push(9));
+
+    int64_t item;
+    assert(queue.Pop(&item));
+    assert(item == 7);
+    assert(!queue.Pop(&item));
+
+    // Likewise for a stalled consumer.
+    BoundedQueue<int64_t> empty;
+    empty.Init(1);
+    std::thread consumer([&] {
+        int64_t item;
+        assert(!empty.Pop(&item));
+    });
+    usleep(50 * 1000);
+    empty.Close();
+    consumer.join();
+}
+
+}  // namespace
+
+int main() {
+    TestOrder();
+    TestFull();
+    TestClose();
+}
@@ -1,6 +1,16 @@
 #include "file.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
 #include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "base/string.h"
+
+using std::vector;
 
 namespace xtreaming {
 
@@ -20,4 +30,54 @@ bool ReadFile(const string& filename, string* data) {
     return true;
 }
 
+bool WriteAll(int fd, const char* data, size_t size) {
+    while (size) {
+        ssize_t num_written = write(fd, data, size);
+        if (num_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += num_written;
+        size -= num_written;
+    }
+    return true;
+}
+
+bool StreamFile(const string& filename, ByteSink* sink, string* err) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        *err = StringPrintf("Unable to open file: `%s` (%s).", filename.c_str(), strerror(errno));
+        sink->Abort();
+        return false;
+    }
+
+    vector<char> buf(1 << 20);
+    while (true) {
+        ssize_t num_read = read(fd, buf.data(), buf.size());
+        if (num_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *err = StringPrintf("Unable to read file: `%s` (%s).", filename.c_str(),
+                                strerror(errno));
+            close(fd);
+            sink->Abort();
+            return false;
+        }
+        if (!num_read) {
+            break;
+        }
+        if (!sink->Write(buf.data(), num_read, err)) {
+            close(fd);
+            sink->Abort();
+            return false;
+        }
+    }
+
+    close(fd);
+    return sink->Close(err);
+}
+
 }  // namespace xtreaming
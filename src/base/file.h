@@ -1,9 +1,20 @@
+#pragma once
+
+#include <cstddef>
 #include <string>
 
+#include "base/sink.h"
+
 using std::string;
 
 namespace xtreaming {
 
 bool ReadFile(const string& filename, string* data);
 
+// Write all of a buffer to a file descriptor, retrying on short writes and interrupts.
+bool WriteAll(int fd, const char* data, size_t size);
+
+// Read a file in chunks into a sink, then close the sink (or abort it on failure).
+bool StreamFile(const string& filename, ByteSink* sink, string* err);
+
 }  // namespace xtreaming
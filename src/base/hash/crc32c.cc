@@ -0,0 +1,248 @@
+#include "crc32c.h"
+
+#include <cstring>
+
+#include "base/string.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace xtreaming {
+
+namespace {
+
+// Reflected CRC-32C polynomial.
+const uint32_t kPoly = 0x82f63b78;
+
+// Each hardware stream covers this many bytes per round, then the same again for a shorter tail.
+const size_t kLong = 8192;
+const size_t kShort = 256;
+
+// Multiply a 32x32 GF(2) matrix by a vector.
+uint32_t MatrixTimes(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+        vec >>= 1;
+        ++mat;
+    }
+    return sum;
+}
+
+// Square a 32x32 GF(2) matrix.
+void MatrixSquare(uint32_t* square, const uint32_t* mat) {
+    for (int i = 0; i < 32; ++i) {
+        square[i] = MatrixTimes(mat, mat[i]);
+    }
+}
+
+// Build the operator that feeds `size` zero bytes (a power of two) through a CRC.
+void ZerosOperator(size_t size, uint32_t* op) {
+    // Start with one zero bit, then square up to one zero byte and on from there.
+    uint32_t odd[32];
+    odd[0] = kPoly;
+    uint32_t row = 1;
+    for (int i = 1; i < 32; ++i) {
+        odd[i] = row;
+        row <<= 1;
+    }
+    MatrixSquare(op, odd);  // Two bits.
+    MatrixSquare(odd, op);  // Four bits.
+    while (true) {
+        MatrixSquare(op, odd);
+        size >>= 1;
+        if (!size) {
+            return;
+        }
+        MatrixSquare(odd, op);
+        size >>= 1;
+        if (!size) {
+            memcpy(op, odd, sizeof(odd));
+            return;
+        }
+    }
+}
+
+// Lookup tables, built once on first use.
+struct Tables {
+    uint32_t slice[8][256];        // Slicing-by-8 tables.
+    uint32_t long_shift[4][256];   // Shift a CRC past kLong zero bytes, a byte at a time.
+    uint32_t short_shift[4][256];  // Shift a CRC past kShort zero bytes, a byte at a time.
+
+    Tables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; ++j) {
+                crc = crc & 1 ? (crc >> 1) ^ kPoly : crc >> 1;
+            }
+            slice[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int j = 1; j < 8; ++j) {
+                uint32_t crc = slice[j - 1][i];
+                slice[j][i] = (crc >> 8) ^ slice[0][crc & 0xff];
+            }
+        }
+        InitShift(kLong, long_shift);
+        InitShift(kShort, short_shift);
+    }
+
+    static void InitShift(size_t size, uint32_t shift[4][256]) {
+        uint32_t op[32];
+        ZerosOperator(size, op);
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                shift[j][i] = MatrixTimes(op, i << (8 * j));
+            }
+        }
+    }
+};
+
+const Tables& GetTables() {
+    static Tables tables;
+    return tables;
+}
+
+uint32_t Shift(const uint32_t shift[4][256], uint32_t crc) {
+    return shift[0][crc & 0xff] ^ shift[1][(crc >> 8) & 0xff] ^ shift[2][(crc >> 16) & 0xff] ^
+           shift[3][crc >> 24];
+}
+
+#if defined(__x86_64__)
+
+uint64_t Load64(const char* data) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+// While at least three strides remain, run three streams a stride apart, then combine them.
+__attribute__((target("sse4.2")))
+uint64_t Crc32cInterleaved(uint64_t crc0, const char** data, size_t* size, size_t stride,
+                           const uint32_t shift[4][256]) {
+    while (stride * 3 <= *size) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        const char* end = *data + stride;
+        for (const char* p = *data; p < end; p += 8) {
+            crc0 = _mm_crc32_u64(crc0, Load64(p));
+            crc1 = _mm_crc32_u64(crc1, Load64(p + stride));
+            crc2 = _mm_crc32_u64(crc2, Load64(p + 2 * stride));
+        }
+        crc0 = Shift(shift, crc0) ^ crc1;
+        crc0 = Shift(shift, crc0) ^ crc2;
+        *data += 3 * stride;
+        *size -= 3 * stride;
+    }
+    return crc0;
+}
+
+__attribute__((target("sse4.2")))
+uint32_t Crc32cExtendHardware(uint32_t crc, const char* data, size_t size) {
+    auto& tables = GetTables();
+    uint64_t crc0 = crc ^ 0xffffffff;
+
+    // Align to eight bytes.
+    while (size && (uintptr_t)data & 7) {
+        crc0 = _mm_crc32_u8(crc0, *data);
+        ++data;
+        --size;
+    }
+
+    crc0 = Crc32cInterleaved(crc0, &data, &size, kLong, tables.long_shift);
+    crc0 = Crc32cInterleaved(crc0, &data, &size, kShort, tables.short_shift);
+
+    while (8 <= size) {
+        crc0 = _mm_crc32_u64(crc0, Load64(data));
+        data += 8;
+        size -= 8;
+    }
+    while (size) {
+        crc0 = _mm_crc32_u8(crc0, *data);
+        ++data;
+        --size;
+    }
+
+    return crc0 ^ 0xffffffff;
+}
+
+bool HasHardwareCrc32c() {
+    static bool has = __builtin_cpu_supports("sse4.2");
+    return has;
+}
+
+#endif
+
+class CRC32CHasher : public Hasher {
+  public:
+    CRC32CHasher() { Reset(); }
+    void Reset() override { crc_ = 0; }
+    void Update(const char* data, size_t size) override { crc_ = Crc32cExtend(crc_, data, size); }
+    string Digest() override {
+        char digest[4];
+        for (int i = 0; i < 4; ++i) {
+            digest[i] = (char)(crc_ >> (8 * (3 - i)));
+        }
+        return string(digest, sizeof(digest));
+    }
+
+  private:
+    uint32_t crc_;
+};
+
+}  // namespace
+
+string CRC32C(const char* buffer, size_t size) {
+    uint32_t hash = Crc32cExtend(0, buffer, size);
+    return StringPrintf("%08x", hash);
+}
+
+uint32_t Crc32cExtend(uint32_t crc, const char* data, size_t size) {
+#if defined(__x86_64__)
+    if (HasHardwareCrc32c()) {
+        return Crc32cExtendHardware(crc, data, size);
+    }
+#endif
+    return Crc32cExtendPortable(crc, data, size);
+}
+
+uint32_t Crc32cExtendPortable(uint32_t crc, const char* data, size_t size) {
+    auto& slice = GetTables().slice;
+    crc ^= 0xffffffff;
+
+    while (size && (uintptr_t)data & 7) {
+        crc = (crc >> 8) ^ slice[0][(crc ^ (uint8_t)*data) & 0xff];
+        ++data;
+        --size;
+    }
+
+    // Eight bytes at a time (assumes a little-endian host).
+    while (8 <= size) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        word ^= crc;
+        crc = slice[7][word & 0xff] ^ slice[6][(word >> 8) & 0xff] ^
+              slice[5][(word >> 16) & 0xff] ^ slice[4][(word >> 24) & 0xff] ^
+              slice[3][(word >> 32) & 0xff] ^ slice[2][(word >> 40) & 0xff] ^
+              slice[1][(word >> 48) & 0xff] ^ slice[0][word >> 56];
+        data += 8;
+        size -= 8;
+    }
+
+    while (size) {
+        crc = (crc >> 8) ^ slice[0][(crc ^ (uint8_t)*data) & 0xff];
+        ++data;
+        --size;
+    }
+
+    return crc ^ 0xffffffff;
+}
+
+Hasher* NewCRC32CHasher() {
+    return new CRC32CHasher;
+}
+
+}  // namespace xtreaming
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "base/hash/hash.h"
+
+using std::string;
+
+namespace xtreaming {
+
+// Returns hex digest.
+string CRC32C(const char* buffer, size_t size);
+
+// Extend a CRC-32C (Castagnoli) over more data, starting from zero.
+//
+// Uses the SSE4.2 crc32 instruction when the CPU has it, running three independent streams at
+// once to hide its latency and stitching them together with precomputed shift tables.
+uint32_t Crc32cExtend(uint32_t crc, const char* data, size_t size);
+
+// Same, using slicing-by-8 tables only (for CPUs without SSE4.2, and for checking against).
+uint32_t Crc32cExtendPortable(uint32_t crc, const char* data, size_t size);
+
+// Get a new streaming hasher for `crc32c`.
+Hasher* NewCRC32CHasher();
+
+}  // namespace xtreaming
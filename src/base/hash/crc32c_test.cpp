@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <memory>
+
+#include "base/hash/crc32c.h"
+
+using namespace xtreaming;
+
+namespace {
+
+void TestKnownValues() {
+    assert(CRC32C("", 0) == "00000000");
+    assert(CRC32C("123456789", 9) == "e3069283");
+
+    string zeros(32, '\0');
+    assert(CRC32C(zeros.data(), zeros.size()) == "8a9136aa");
+
+    string ones(32, '\xff');
+    assert(CRC32C(ones.data(), ones.size()) == "62a8ab43");
+}
+
+void TestAgainstPortable() {
+    // Long enough for every interleaved stride, at every alignment.
+    string data(3 * 3 * 8192 + 1000, '\0');
+    srand(1337);
+    for (auto& chr : data) {
+        chr = (char)rand();
+    }
+    for (size_t offset = 0; offset < 16; ++offset) {
+        for (size_t size : {0UL, 1UL, 7UL, 100UL, 3 * 256UL + 5, 3 * 8192UL, data.size() - 16}) {
+            const char* p = &data[offset];
+            assert(Crc32cExtend(0, p, size) == Crc32cExtendPortable(0, p, size));
+        }
+    }
+}
+
+void TestHasher() {
+    string data(100000, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (char)(i * 31);
+    }
+
+    // Fed in uneven pieces, the digest matches one pass over everything.
+    std::unique_ptr<Hasher> hasher(NewHasher("crc32c"));
+    assert(hasher);
+    for (size_t i = 0; i < data.size(); i += 777) {
+        hasher->Update(&data[i], std::min<size_t>(777, data.size() - i));
+    }
+    string bytes;
+    assert(HexToBytes(CRC32C(data.data(), data.size()), &bytes));
+    assert(hasher->Digest() == bytes);
+
+    hasher->Reset();
+    hasher->Update("123456789", 9);
+    assert(HexToBytes("e3069283", &bytes));
+    assert(hasher->Digest() == bytes);
+}
+
+}  // namespace
+
+int main() {
+    TestKnownValues();
+    TestAgainstPortable();
+    TestHasher();
+}
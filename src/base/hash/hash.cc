@@ -0,0 +1,79 @@
+#include "hash.h"
+
+#include <sys/mman.h>
+
+#include "base/hash/crc32c.h"
+#include "base/hash/xxhash.h"
+#include "base/mmap.h"
+#include "base/string.h"
+
+namespace xtreaming {
+
+Hasher::~Hasher() {
+}
+
+Hasher* NewHasher(const string& algo) {
+    if (algo == "crc32c") {
+        return NewCRC32CHasher();
+    }
+    return NewXXHasher(algo);
+}
+
+bool HashData(const char* data, int64_t size, const string& algo, string* digest, string* err) {
+    Hasher* hasher = NewHasher(algo);
+    if (!hasher) {
+        *err = StringPrintf("Unsupported hash algorithm: `%s`.", algo.c_str());
+        return false;
+    }
+    if (size) {
+        hasher->Update(data, size);
+    }
+    *digest = hasher->Digest();
+    delete hasher;
+    return true;
+}
+
+bool HashFile(const string& filename, const string& algo, string* digest, string* err) {
+    MappedFile file;
+    if (!file.Open(filename, err)) {
+        return false;
+    }
+    if (file.size()) {
+        madvise((void*)file.data(), file.size(), MADV_SEQUENTIAL);
+    }
+    return HashData(file.data(), file.size(), algo, digest, err);
+}
+
+namespace {
+
+int HexValue(char chr) {
+    if ('0' <= chr && chr <= '9') {
+        return chr - '0';
+    } else if ('a' <= chr && chr <= 'f') {
+        return chr - 'a' + 10;
+    } else if ('A' <= chr && chr <= 'F') {
+        return chr - 'A' + 10;
+    } else {
+        return -1;
+    }
+}
+
+}  // namespace
+
+bool HexToBytes(const string& hex, string* bytes) {
+    if (hex.size() % 2) {
+        return false;
+    }
+    bytes->resize(hex.size() / 2);
+    for (size_t i = 0; i < bytes->size(); ++i) {
+        int high = HexValue(hex[2 * i]);
+        int low = HexValue(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        (*bytes)[i] = (char)(high << 4 | low);
+    }
+    return true;
+}
+
+}  // namespace xtreaming
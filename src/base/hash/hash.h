@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using std::string;
+
+namespace xtreaming {
+
+// Streaming hash state for one algorithm.
+class Hasher {
+  public:
+    virtual ~Hasher();
+
+    // Start over.
+    virtual void Reset() = 0;
+
+    // Hash more data.
+    virtual void Update(const char* data, size_t size) = 0;
+
+    // Get the digest of everything since the last reset as raw bytes, in the same (big-endian)
+    // order as the hex digests found in index files.
+    virtual string Digest() = 0;
+};
+
+// Get a new hasher for the named algorithm, or null if we don't support it.
+Hasher* NewHasher(const string& algo);
+
+// Hash data in memory with the named algorithm, getting its raw digest.
+bool HashData(const char* data, int64_t size, const string& algo, string* digest, string* err);
+
+// Hash a whole file with the named algorithm, getting its raw digest.
+bool HashFile(const string& filename, const string& algo, string* digest, string* err);
+
+// Convert a hex digest (as found in index files) to raw bytes.
+bool HexToBytes(const string& hex, string* bytes);
+
+}  // namespace xtreaming
@@ -42,4 +42,87 @@ string XXH3_128(const char* buffer, size_t size) {
     return StringPrintf("%016lx%016lx", ((uint64_t*)&hash)[1], ((uint64_t*)&hash)[0]);
 }
 
+namespace {
+
+class XXH32Hasher : public Hasher {
+  public:
+    XXH32Hasher() { Reset(); }
+    void Reset() override { XXH32_reset(&state_, 0); }
+    void Update(const char* data, size_t size) override { XXH32_update(&state_, data, size); }
+    string Digest() override {
+        XXH32_canonical_t canonical;
+        XXH32_canonicalFromHash(&canonical, XXH32_digest(&state_));
+        return string((const char*)canonical.digest, sizeof(canonical.digest));
+    }
+
+  private:
+    XXH32_state_t state_;
+};
+
+class XXH64Hasher : public Hasher {
+  public:
+    XXH64Hasher() { Reset(); }
+    void Reset() override { XXH64_reset(&state_, 0); }
+    void Update(const char* data, size_t size) override { XXH64_update(&state_, data, size); }
+    string Digest() override {
+        XXH64_canonical_t canonical;
+        XXH64_canonicalFromHash(&canonical, XXH64_digest(&state_));
+        return string((const char*)canonical.digest, sizeof(canonical.digest));
+    }
+
+  private:
+    XXH64_state_t state_;
+};
+
+class XXH3_64Hasher : public Hasher {
+  public:
+    XXH3_64Hasher() { Reset(); }
+    void Reset() override { XXH3_64bits_reset(&state_); }
+    void Update(const char* data, size_t size) override {
+        XXH3_64bits_update(&state_, data, size);
+    }
+    string Digest() override {
+        XXH64_canonical_t canonical;
+        XXH64_canonicalFromHash(&canonical, XXH3_64bits_digest(&state_));
+        return string((const char*)canonical.digest, sizeof(canonical.digest));
+    }
+
+  private:
+    XXH3_state_t state_;
+};
+
+// Also serves `xxh128`, which is the same function.
+class XXH3_128Hasher : public Hasher {
+  public:
+    XXH3_128Hasher() { Reset(); }
+    void Reset() override { XXH3_128bits_reset(&state_); }
+    void Update(const char* data, size_t size) override {
+        XXH3_128bits_update(&state_, data, size);
+    }
+    string Digest() override {
+        XXH128_canonical_t canonical;
+        XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(&state_));
+        return string((const char*)canonical.digest, sizeof(canonical.digest));
+    }
+
+  private:
+    XXH3_state_t state_;
+};
+
+}  // namespace
+
+Hasher* NewXXHasher(const string& algo) {
+    if (algo == "xxh32") {
+        return new XXH32Hasher;
+    } else if (algo == "xxh64") {
+        return new XXH64Hasher;
+    } else if (algo == "xxh128" || algo == "xxh3_128") {
+        return new XXH3_128Hasher;
+    } else if (algo == "xxh3_64") {
+        return new XXH3_64Hasher;
+    } else {
+        return nullptr;
+    }
+}
+
 }  // namespace xtreaming
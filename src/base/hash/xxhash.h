@@ -2,6 +2,8 @@
 
 #include <string>
 
+#include "base/hash/hash.h"
+
 using std::string;
 
 namespace xtreaming {
@@ -13,4 +15,7 @@ string XXH128(const char* buffer, size_t size);
 string XXH3_64(const char* buffer, size_t size);
 string XXH3_128(const char* buffer, size_t size);
 
+// Get a new streaming hasher for `xxh32`, `xxh64`, `xxh128`, `xxh3_64`, or `xxh3_128`, or null.
+Hasher* NewXXHasher(const string& algo);
+
 }  // namespace xtreaming
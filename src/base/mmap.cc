@@ -0,0 +1,70 @@
+#include "mmap.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "base/string.h"
+
+namespace xtreaming {
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const string& path, string* err) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        *err = StringPrintf("Unable to open file: `%s` (%s).", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return OpenFd(fd, path, err);
+}
+
+bool MappedFile::OpenFd(int fd, const string& name, string* err) {
+    Close();
+
+    struct stat info;
+    if (fstat(fd, &info)) {
+        *err = StringPrintf("Unable to stat file: `%s` (%s).", name.c_str(), strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    // Empty files can't be mapped, so they are represented as open with no data.
+    void* data = nullptr;
+    if (info.st_size) {
+        data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            *err = StringPrintf("Unable to mmap file: `%s` (%s).", name.c_str(), strerror(errno));
+            close(fd);
+            return false;
+        }
+    }
+
+    fd_ = fd;
+    data_ = (const char*)data;
+    size_ = info.st_size;
+    return true;
+}
+
+void MappedFile::Close() {
+    if (fd_ == -1) {
+        return;
+    }
+
+    if (data_) {
+        munmap((void*)data_, size_);
+    }
+    close(fd_);
+    fd_ = -1;
+    data_ = nullptr;
+    size_ = 0;
+}
+
+}  // namespace xtreaming
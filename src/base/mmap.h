@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+using std::string;
+
+namespace xtreaming {
+
+// Read-only memory mapping of an entire file.
+class MappedFile {
+  public:
+    const char* data() const { return data_; }
+    int64_t size() const { return size_; }
+    bool is_open() const { return fd_ != -1; }
+    int fd() const { return fd_; }
+
+    // Unmaps the file if still open.
+    ~MappedFile();
+
+    // Open and map the file, setting `err` on failure.
+    bool Open(const string& path, string* err);
+
+    // Map an already open file descriptor (such as a memfd), taking ownership of it. On failure,
+    // the descriptor is closed. `name` is for errors.
+    bool OpenFd(int fd, const string& name, string* err);
+
+    // Unmap and close the file (no-op if not open).
+    void Close();
+
+  private:
+    int fd_{-1};                 // Open file descriptor, or -1 if closed.
+    const char* data_{nullptr};  // Start of the mapping (null if the file is empty).
+    int64_t size_{0};            // Size of the file in bytes.
+};
+
+}  // namespace xtreaming
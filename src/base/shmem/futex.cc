@@ -0,0 +1,36 @@
+#include "futex.h"
+
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <ctime>
+
+namespace xtreaming {
+
+void FutexWait(std::atomic<uint32_t>* word, uint32_t value) {
+    struct timespec timeout = {0, 100000000};
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, value, &timeout, nullptr, 0);
+}
+
+void FutexWakeAll(std::atomic<uint32_t>* word) {
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+bool IsAlive(pid_t pid) {
+    return !kill(pid, 0) || errno != ESRCH;
+}
+
+uint64_t GetPidNamespace() {
+    struct stat info;
+    if (stat("/proc/self/ns/pid", &info)) {
+        return 0;
+    }
+    return info.st_ino;
+}
+
+}  // namespace xtreaming
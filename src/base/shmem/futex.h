@@ -0,0 +1,24 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+
+namespace xtreaming {
+
+// Sleep until a word in shared memory changes from `value`, or a while passes (so that the caller
+// can recheck whether the word's owner is still around).
+void FutexWait(std::atomic<uint32_t>* word, uint32_t value);
+
+// Wake everyone sleeping on a word.
+void FutexWakeAll(std::atomic<uint32_t>* word);
+
+// Whether a process that owns words in shared memory still exists. Pids only mean the same process
+// within one PID namespace, so every process sharing the words must be in ours.
+bool IsAlive(pid_t pid);
+
+// Get the ID of our PID namespace (0 if unknown), to check that against.
+uint64_t GetPidNamespace();
+
+}  // namespace xtreaming
@@ -0,0 +1,96 @@
+#include "memory.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "base/string.h"
+
+namespace xtreaming {
+
+SharedMemory::~SharedMemory() {
+    if (data_) {
+        munmap(data_, size_);
+    }
+}
+
+bool SharedMemory::Init(const string& name, int64_t size, string* err) {
+    name_ = name;
+    size_ = size;
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd != -1) {
+        is_creator_ = true;
+        if (ftruncate(fd, size)) {
+            *err = StringPrintf("Unable to size shared memory: `%s` (%s).", name.c_str(),
+                                strerror(errno));
+            close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+    } else if (errno == EEXIST) {
+        fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            *err = StringPrintf("Unable to open shared memory: `%s` (%s).", name.c_str(),
+                                strerror(errno));
+            return false;
+        }
+
+        // The creator may not have sized it yet.
+        struct stat info;
+        for (int64_t i = 0; ; ++i) {
+            if (fstat(fd, &info)) {
+                *err = StringPrintf("Unable to stat shared memory: `%s` (%s).", name.c_str(),
+                                    strerror(errno));
+                close(fd);
+                return false;
+            }
+            if (info.st_size) {
+                break;
+            }
+            if (10000 <= i) {
+                *err = StringPrintf("Timed out waiting for shared memory to be sized: `%s`.",
+                                    name.c_str());
+                close(fd);
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (info.st_size != size) {
+            *err = StringPrintf("Shared memory `%s` is %ld bytes, but expected %ld (left over "
+                                "from a different configuration?).", name.c_str(),
+                                (int64_t)info.st_size, size);
+            close(fd);
+            return false;
+        }
+    } else {
+        *err = StringPrintf("Unable to create shared memory: `%s` (%s).", name.c_str(),
+                            strerror(errno));
+        return false;
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        *err = StringPrintf("Unable to mmap shared memory: `%s` (%s).", name.c_str(),
+                            strerror(errno));
+        if (is_creator_) {
+            shm_unlink(name.c_str());
+        }
+        return false;
+    }
+    data_ = (char*)data;
+    return true;
+}
+
+void SharedMemory::Unlink() {
+    shm_unlink(name_.c_str());
+}
+
+}  // namespace xtreaming
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+using std::string;
+
+namespace xtreaming {
+
+// Named POSIX shared memory segment, mapped read-write, that processes on the node can share.
+class SharedMemory {
+  public:
+    char* data() const { return data_; }
+    int64_t size() const { return size_; }
+    bool is_creator() const { return is_creator_; }
+
+    // Unmaps the segment (the name stays until Unlink()).
+    ~SharedMemory();
+
+    // Create the zero-filled segment if it doesn't exist yet, else attach to it once its creator
+    // has sized it.
+    bool Init(const string& name, int64_t size, string* err);
+
+    // Remove the name, so later Init() calls create a fresh segment. Mappings stay valid.
+    void Unlink();
+
+  private:
+    string name_;             // Name under /dev/shm.
+    char* data_{nullptr};     // Mapped segment.
+    int64_t size_{0};         // Size in bytes.
+    bool is_creator_{false};  // Whether we created it (as opposed to attaching).
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,66 @@
+#include "table.h"
+
+#include <chrono>
+#include <thread>
+
+#include "base/shmem/futex.h"
+#include "base/string.h"
+
+namespace xtreaming {
+
+SharedTable::~SharedTable() {
+    Detach();
+}
+
+bool SharedTable::Init(const string& name, uint64_t magic, int64_t size, string* err) {
+    if (!memory_.Init(name, sizeof(Header) + size, err)) {
+        return false;
+    }
+    magic_ = magic;
+    if (memory_.is_creator()) {
+        return true;
+    }
+
+    for (int64_t i = 0; __atomic_load_n(&header()->magic, __ATOMIC_ACQUIRE) != magic; ++i) {
+        if (10000 <= i) {
+            *err = StringPrintf("Timed out waiting for shared memory table `%s` to be set up.",
+                                name.c_str());
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    uint64_t pid_namespace = GetPidNamespace();
+    if (header()->pid_namespace && pid_namespace && header()->pid_namespace != pid_namespace) {
+        *err = StringPrintf("Shared memory table `%s` is in use from another PID namespace, which "
+                            "its owner pids don't carry across (share the PID namespace, or turn "
+                            "off sharing).", name.c_str());
+        return false;
+    }
+    return true;
+}
+
+void SharedTable::Attach() {
+    if (memory_.is_creator()) {
+        header()->num_attached = 1;
+        header()->pid_namespace = GetPidNamespace();
+        __atomic_store_n(&header()->magic, magic_, __ATOMIC_RELEASE);
+    } else {
+        ++header()->num_attached;
+    }
+    is_attached_ = true;
+}
+
+bool SharedTable::Detach() {
+    if (!is_attached_) {
+        return false;
+    }
+    is_attached_ = false;
+    if (--header()->num_attached) {
+        return false;
+    }
+    memory_.Unlink();
+    return true;
+}
+
+}  // namespace xtreaming
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "base/shmem/memory.h"
+
+using std::string;
+
+namespace xtreaming {
+
+// Named shared memory table that processes on the node attach to, behind a small header of its
+// own: a magic number, which the creator sets last so that attachers know the table is ready, a
+// count of processes attached, so that the last to detach removes it, and the creator's PID
+// namespace.
+//
+// Tables record owners by pid, and take back what a dead owner held, so every process attached
+// must be in the same PID namespace (containers sharing /dev/shm must also share the host's, or
+// each other's, PIDs). Attaching from another one is refused rather than risking a live owner
+// being taken for dead.
+//
+// The creator sets up its data, then calls Attach() to publish it. Others wait in Init() for that,
+// check the data is what they expect, then call Attach() to count themselves in.
+class SharedTable {
+  public:
+    char* data() const { return memory_.data() + sizeof(Header); }
+    bool is_creator() const { return memory_.is_creator(); }
+
+    // Detaches, if attached.
+    ~SharedTable();
+
+    // Create the zero-filled table with `size` bytes of data if it doesn't exist yet, else wait for
+    // its creator to publish it under `magic`, and check we share its PID namespace.
+    bool Init(const string& name, uint64_t magic, int64_t size, string* err);
+
+    // Count ourselves in, publishing the table if we created it.
+    void Attach();
+
+    // Count ourselves out, removing the name if we were the last. Returns whether we were. The
+    // mapping stays valid until destruction.
+    bool Detach();
+
+  private:
+    struct Header {
+        uint64_t magic;                     // Marks a table that is ready to use.
+        std::atomic<int64_t> num_attached;  // Processes using it.
+        uint64_t pid_namespace;             // Creator's PID namespace (0 if unknown).
+    };
+
+    Header* header() const { return (Header*)memory_.data(); }
+
+    SharedMemory memory_;      // Backing segment.
+    uint64_t magic_{0};        // What marks the table as ready.
+    bool is_attached_{false};  // Whether we are counted in.
+};
+
+}  // namespace xtreaming
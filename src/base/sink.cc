@@ -0,0 +1,8 @@
+#include "sink.h"
+
+namespace xtreaming {
+
+ByteSink::~ByteSink() {
+}
+
+}  // namespace xtreaming
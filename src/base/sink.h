@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+using std::string;
+
+namespace xtreaming {
+
+// Destination for a stream of bytes, such as a file being fetched.
+//
+// Write() is called zero or more times, then exactly one of Close() (all data delivered) or
+// Abort() (giving up).
+class ByteSink {
+  public:
+    virtual ~ByteSink();
+
+    // Consume the next chunk of data.
+    virtual bool Write(const char* data, int64_t size, string* err) = 0;
+
+    // All data has been delivered. Finish up, returning whether the result is good.
+    virtual bool Close(string* err) = 0;
+
+    // Give up, discarding any partial output.
+    virtual void Abort() = 0;
+};
+
+}  // namespace xtreaming
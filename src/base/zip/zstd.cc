@@ -0,0 +1,199 @@
+#include "zstd.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "base/file.h"
+#include "base/string.h"
+
+using std::vector;
+
+namespace xtreaming {
+
+bool IsZstd(const string& zip_algo) {
+    return zip_algo == "zstd" || !zip_algo.compare(0, 5, "zstd:");
+}
+
+ZstdDict::~ZstdDict() {
+    if (ddict_) {
+        ZSTD_freeDDict(ddict_);
+    }
+}
+
+bool ZstdDict::Init(const string& data, string* err) {
+    ddict_ = ZSTD_createDDict(data.data(), data.size());
+    if (!ddict_) {
+        *err = "Unable to load zstd dictionary.";
+        return false;
+    }
+    id_ = ZSTD_getDictID_fromDDict(ddict_);
+    return true;
+}
+
+bool ZstdListFrames(const char* data, int64_t size, vector<ZstdFrame>* frames) {
+    frames->clear();
+    int64_t zip_offset = 0;
+    int64_t raw_offset = 0;
+    while (zip_offset < size) {
+        const char* src = &data[zip_offset];
+        size_t src_size = size - zip_offset;
+        size_t zip_size = ZSTD_findFrameCompressedSize(src, src_size);
+        if (ZSTD_isError(zip_size)) {
+            return false;
+        }
+
+        // Skippable frames report a content size of zero.
+        unsigned long long raw_size = ZSTD_getFrameContentSize(src, src_size);
+        if (raw_size == ZSTD_CONTENTSIZE_UNKNOWN || raw_size == ZSTD_CONTENTSIZE_ERROR ||
+                (unsigned long long)(INT64_MAX - raw_offset) < raw_size) {
+            return false;
+        }
+
+        frames->push_back({zip_offset, (int64_t)zip_size, raw_offset, (int64_t)raw_size});
+        zip_offset += zip_size;
+        raw_offset += raw_size;
+    }
+    return true;
+}
+
+bool ZstdDecompressFrame(ZSTD_DCtx* ctx, const ZSTD_DDict* ddict, const char* zip_data,
+                         const ZstdFrame& frame, char* raw_data, string* err) {
+    if (!frame.raw_size) {
+        return true;
+    }
+
+    size_t ret = ZSTD_decompress_usingDDict(ctx, &raw_data[frame.raw_offset], frame.raw_size,
+                                            &zip_data[frame.zip_offset], frame.zip_size, ddict);
+    if (ZSTD_isError(ret)) {
+        *err = StringPrintf("Unable to decompress frame at offset %ld: %s.", frame.zip_offset,
+                            ZSTD_getErrorName(ret));
+        return false;
+    }
+    if ((int64_t)ret != frame.raw_size) {
+        *err = StringPrintf("Zstd frame at offset %ld decompressed to %zu bytes, but its header "
+                            "says %ld.", frame.zip_offset, ret, frame.raw_size);
+        return false;
+    }
+    return true;
+}
+
+bool ZstdDecompressToFd(ZSTD_DCtx* ctx, const ZSTD_DDict* ddict, const string& zip_path,
+                        int out_fd, const string& out_name, string* err) {
+    int in_fd = open(zip_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in_fd == -1) {
+        *err = StringPrintf("Unable to open file: `%s` (%s).", zip_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    ZSTD_DCtx_reset(ctx, ZSTD_reset_session_only);
+    ZSTD_DCtx_refDDict(ctx, ddict);
+    vector<char> in_buf(ZSTD_DStreamInSize());
+    vector<char> out_buf(ZSTD_DStreamOutSize());
+    size_t ret = 0;
+    bool ok = true;
+    while (ok) {
+        ssize_t num_read = read(in_fd, in_buf.data(), in_buf.size());
+        if (num_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *err = StringPrintf("Unable to read file: `%s` (%s).", zip_path.c_str(),
+                                strerror(errno));
+            ok = false;
+            break;
+        }
+        if (!num_read) {
+            break;
+        }
+        ZSTD_inBuffer input = {in_buf.data(), (size_t)num_read, 0};
+        while (input.pos < input.size) {
+            ZSTD_outBuffer output = {out_buf.data(), out_buf.size(), 0};
+            ret = ZSTD_decompressStream(ctx, &output, &input);
+            if (ZSTD_isError(ret)) {
+                *err = StringPrintf("Unable to decompress `%s`: %s.", zip_path.c_str(),
+                                    ZSTD_getErrorName(ret));
+                ok = false;
+                break;
+            }
+            if (!WriteAll(out_fd, out_buf.data(), output.pos)) {
+                *err = StringPrintf("Unable to write file: `%s` (%s).", out_name.c_str(),
+                                    strerror(errno));
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    // A nonzero final return means the last frame was cut off.
+    if (ok && ret) {
+        *err = StringPrintf("Truncated zstd file: `%s`.", zip_path.c_str());
+        ok = false;
+    }
+
+    close(in_fd);
+    return ok;
+}
+
+bool ZstdDecompressFile(ZSTD_DCtx* ctx, const ZSTD_DDict* ddict, const string& zip_path,
+                        const string& raw_path, string* err) {
+    string tmp_path = raw_path + ".tmp";
+    int out_fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out_fd == -1) {
+        *err = StringPrintf("Unable to open file: `%s` (%s).", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool ok = ZstdDecompressToFd(ctx, ddict, zip_path, out_fd, tmp_path, err);
+
+    if (close(out_fd) && ok) {
+        *err = StringPrintf("Unable to write file: `%s` (%s).", tmp_path.c_str(), strerror(errno));
+        ok = false;
+    }
+
+    if (ok && rename(tmp_path.c_str(), raw_path.c_str())) {
+        *err = StringPrintf("Unable to rename `%s` to `%s` (%s).", tmp_path.c_str(),
+                            raw_path.c_str(), strerror(errno));
+        ok = false;
+    }
+
+    if (!ok) {
+        unlink(tmp_path.c_str());
+    }
+    return ok;
+}
+
+bool ZstdDecompressToMemory(ZSTD_DCtx* ctx, const ZSTD_DDict* ddict, const string& zip_path,
+                            MappedFile* file, string* err) {
+    string name = "xtreaming:" + zip_path;
+    int fd = memfd_create(name.c_str(), MFD_CLOEXEC);
+    if (fd == -1) {
+        *err = StringPrintf("Unable to create memfd for `%s` (%s).", zip_path.c_str(),
+                            strerror(errno));
+        return false;
+    }
+
+    if (!ZstdDecompressToFd(ctx, ddict, zip_path, fd, name, err)) {
+        close(fd);
+        return false;
+    }
+
+    return file->OpenFd(fd, name, err);
+}
+
+ZSTD_DCtx* GetThreadZstdDCtx() {
+    struct Holder {
+        ZSTD_DCtx* ctx{ZSTD_createDCtx()};
+        ~Holder() { ZSTD_freeDCtx(ctx); }
+    };
+    thread_local Holder holder;
+    return holder.ctx;
+}
+
+}  // namespace xtreaming
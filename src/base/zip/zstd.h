@@ -1,3 +1,73 @@
 #pragma once
 
-#include "third_party/zstd/zstd.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "base/mmap.h"
+#include "third_party/zstd/lib/zstd.h"
+
+using std::string;
+using std::vector;
+
+namespace xtreaming {
+
+// Whether a shard compression algorithm (e.g. `zstd`, `zstd:7`) is zstd.
+bool IsZstd(const string& zip_algo);
+
+// A zstd dictionary, digested once and then shared read-only by every decompression thread.
+class ZstdDict {
+  public:
+    const ZSTD_DDict* ddict() const { return ddict_; }
+    uint32_t id() const { return id_; }
+
+    ~ZstdDict();
+
+    // Digest the dictionary (either trained, or raw content used as a prefix).
+    bool Init(const string& data, string* err);
+
+  private:
+    ZSTD_DDict* ddict_{nullptr};  // Digested dictionary.
+    uint32_t id_{0};              // Dictionary ID (0 for raw content dictionaries).
+};
+
+// One frame of a zstd file made of several independently compressed frames.
+struct ZstdFrame {
+    int64_t zip_offset;  // Where the frame starts in the compressed data.
+    int64_t zip_size;    // Compressed size of the frame.
+    int64_t raw_offset;  // Where its content starts in the decompressed data.
+    int64_t raw_size;    // Decompressed size of the frame.
+};
+
+// Split zstd data into its frames.
+//
+// Returns false if the data is malformed or any frame header omits its decompressed size, in which
+// case output offsets are not known up front and the data must be stream-decompressed instead.
+bool ZstdListFrames(const char* data, int64_t size, vector<ZstdFrame>* frames);
+
+// Decompress one frame of `zip_data` into its place in `raw_data`, which is sized for the whole
+// decompressed output.
+bool ZstdDecompressFrame(ZSTD_DCtx* ctx, const ZSTD_DDict* ddict, const char* zip_data,
+                         const ZstdFrame& frame, char* raw_data, string* err);
+
+// Stream-decompress a zstd file into an open file descriptor (named `out_name` in errors), such as
+// a shared memory segment.
+bool ZstdDecompressToFd(ZSTD_DCtx* ctx, const ZSTD_DDict* ddict, const string& zip_path,
+                        int out_fd, const string& out_name, string* err);
+
+// Stream-decompress a zstd file to a new file, reusing the given context and optional shared
+// dictionary.
+//
+// Writes to a temp file next to `raw_path` and renames it into place on success, so the raw file
+// is either absent or complete.
+bool ZstdDecompressFile(ZSTD_DCtx* ctx, const ZSTD_DDict* ddict, const string& zip_path,
+                        const string& raw_path, string* err);
+
+// Stream-decompress a zstd file into anonymous memory (a memfd), which `file` then maps.
+bool ZstdDecompressToMemory(ZSTD_DCtx* ctx, const ZSTD_DDict* ddict, const string& zip_path,
+                            MappedFile* file, string* err);
+
+// Get the calling thread's own decompression context, for callers outside the Decompressor pool.
+ZSTD_DCtx* GetThreadZstdDCtx();
+
+}  // namespace xtreaming
@@ -0,0 +1,80 @@
+#include "concurrency.h"
+
+#include <cmath>
+
+#include "base/time.h"
+
+namespace xtreaming {
+namespace {
+
+const double kTolerance = 1.5;    // Latency over the baseline that is not yet taken as queueing.
+const double kDrift = 0.002;      // How fast the baseline rises per window, to relearn it.
+const double kSmoothing = 0.5;    // How far the limit moves toward its target per window.
+const double kMinGradient = 0.5;  // Most the limit can shrink per window, as a fraction.
+
+}  // namespace
+
+void ConcurrencyLimit::Init(int64_t limit, int64_t min_limit, int64_t max_limit, double interval) {
+    limit_ = limit;
+    min_limit_ = min_limit;
+    max_limit_ = max_limit;
+    interval_ns_ = (int64_t)(interval * 1e9);
+}
+
+bool ConcurrencyLimit::Record(int64_t num_bytes, int64_t latency_ns) {
+    int64_t now = NanoTime();
+    if (!window_start_) {
+        window_start_ = now - latency_ns;
+    }
+    window_bytes_ += num_bytes;
+    window_latency_ns_ += latency_ns;
+    ++window_count_;
+
+    // Wait for a full window, with enough fetches in it to say anything about this limit.
+    int64_t elapsed = now - window_start_;
+    if (elapsed < interval_ns_ || window_count_ < (limit_ < 4 ? limit_ : 4)) {
+        return false;
+    }
+
+    double prev_throughput = throughput_;
+    throughput_ = window_bytes_ * 1e9 / elapsed;
+    latency_ = window_latency_ns_ / 1e9 / window_count_;
+    window_start_ = now;
+    window_bytes_ = 0;
+    window_latency_ns_ = 0;
+    window_count_ = 0;
+
+    if (!base_latency_ || latency_ < base_latency_) {
+        base_latency_ = latency_;
+    } else {
+        base_latency_ *= 1 + kDrift;
+    }
+
+    double gradient = latency_ ? kTolerance * base_latency_ / latency_ : 1;
+    if (gradient < kMinGradient) {
+        gradient = kMinGradient;
+    } else if (1 < gradient) {
+        gradient = 1;
+    }
+    bool is_falling = throughput_ < prev_throughput * 0.9;
+    double growth = is_falling ? 0 : sqrt((double)limit_);
+    double target = limit_ * gradient + growth;
+    double smoothed = limit_ * (1 - kSmoothing) + target * kSmoothing;
+
+    int64_t limit = (int64_t)round(smoothed);
+    if (limit == limit_ && !is_falling && gradient == 1) {
+        ++limit;
+    }
+    if (limit < min_limit_) {
+        limit = min_limit_;
+    } else if (max_limit_ < limit) {
+        limit = max_limit_;
+    }
+    if (limit == limit_) {
+        return false;
+    }
+    limit_ = limit;
+    return true;
+}
+
+}  // namespace xtreaming
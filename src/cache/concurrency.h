@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+namespace xtreaming {
+
+// Adapts how many fetches may be in flight at once to what the remote can currently serve.
+//
+// Fetches are measured in windows of at least `interval` seconds. The baseline is the lowest
+// window latency seen, which stands in for latency without queueing and creeps up slowly so that
+// it can be relearned. At the end of each window, the limit moves toward
+// `limit * gradient + sqrt(limit)`, where the gradient is 1.5 times the baseline over this window's
+// latency (clamped to [0.5, 1]):
+// * While latency stays near the baseline, the limit grows by about its square root per window
+//   (additive increase), as long as throughput isn't falling.
+// * Once extra fetches only queue up behind each other (at the remote, or on a link that other jobs
+//   now share), latency rises past the baseline and the limit shrinks in proportion (down to half
+//   per window).
+// Failed fetches count toward latency, so timeouts push the limit down too. When bandwidth frees
+// up, latency drops back to the baseline and growth resumes.
+//
+// Not thread-safe; callers serialize.
+class ConcurrencyLimit {
+  public:
+    int64_t limit() const { return limit_; }
+    int64_t min_limit() const { return min_limit_; }
+    int64_t max_limit() const { return max_limit_; }
+    double throughput() const { return throughput_; }
+    double latency() const { return latency_; }
+
+    // Start at `limit`, staying within [min_limit, max_limit].
+    void Init(int64_t limit, int64_t min_limit, int64_t max_limit, double interval);
+
+    // Record a finished fetch attempt. Returns whether the limit changed.
+    bool Record(int64_t num_bytes, int64_t latency_ns);
+
+  private:
+    int64_t limit_{1};        // Fetches allowed in flight.
+    int64_t min_limit_{1};    // Floor.
+    int64_t max_limit_{1};    // Ceiling.
+    int64_t interval_ns_{0};  // Minimum window length.
+
+    int64_t window_start_{0};       // When the window began (0 if not yet).
+    int64_t window_bytes_{0};       // Bytes fetched this window.
+    int64_t window_latency_ns_{0};  // Total fetch latency this window.
+    int64_t window_count_{0};       // Fetches finished this window.
+
+    double base_latency_{0};  // Fetch latency in seconds taken as unqueued (0 if none yet).
+    double throughput_{0};    // Bytes per second in the last window.
+    double latency_{0};       // Average fetch latency in seconds in the last window.
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,68 @@
+#include <cassert>
+#include <cstdint>
+
+#include "cache/concurrency.h"
+
+using namespace xtreaming;
+
+namespace {
+
+const int64_t kMs = 1000 * 1000;  // Nanoseconds per millisecond.
+
+// Record a window's worth of fetches at the given latency. Returns whether the limit changed.
+//
+// Byte counts are left at zero, so throughput never reads as falling and only latency steers.
+bool RecordWindow(ConcurrencyLimit* limit, int64_t latency_ns) {
+    bool is_changed = false;
+    int64_t num_fetches = limit->limit() < 4 ? limit->limit() : 4;
+    for (int64_t i = 0; i < num_fetches; ++i) {
+        is_changed |= limit->Record(0, latency_ns);
+    }
+    return is_changed;
+}
+
+// At steady latency the limit grows to its ceiling; once latency rises well past the baseline, it
+// shrinks until halving it per window only offsets its additive growth.
+void TestGrowAndShrink() {
+    ConcurrencyLimit limit;
+    limit.Init(4, 2, 64, 0);
+
+    int64_t last = limit.limit();
+    for (int64_t i = 0; i < 100; ++i) {
+        RecordWindow(&limit, 10 * kMs);
+        assert(last <= limit.limit() && limit.limit() <= 64);
+        last = limit.limit();
+    }
+    assert(limit.limit() == 64);
+    assert(0.009 < limit.latency() && limit.latency() < 0.011);
+
+    for (int64_t i = 0; i < 100; ++i) {
+        RecordWindow(&limit, 100 * kMs);
+        assert(limit.limit() <= last && 2 <= limit.limit());
+        last = limit.limit();
+    }
+    assert(limit.limit() <= 8);
+
+    // Once latency recovers, so does the limit.
+    for (int64_t i = 0; i < 100; ++i) {
+        RecordWindow(&limit, 10 * kMs);
+    }
+    assert(limit.limit() == 64);
+}
+
+// Nothing moves a limit whose floor is its ceiling.
+void TestFixed() {
+    ConcurrencyLimit limit;
+    limit.Init(8, 8, 8, 0);
+    for (int64_t i = 0; i < 100; ++i) {
+        assert(!RecordWindow(&limit, (i < 50 ? 10 : 100) * kMs));
+    }
+    assert(limit.limit() == 8);
+}
+
+}  // namespace
+
+int main() {
+    TestGrowAndShrink();
+    TestFixed();
+}
@@ -0,0 +1,218 @@
+#include "decompressor.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "base/mmap.h"
+#include "base/string.h"
+
+namespace xtreaming {
+
+Decompressor::~Decompressor() {
+    Stop();
+}
+
+bool Decompressor::Init(int64_t num_threads, int64_t max_queued, string* err) {
+    if (num_threads < 1) {
+        *err = StringPrintf("Decompression thread count must be positive (got: %ld).",
+                            num_threads);
+        return false;
+    }
+
+    num_threads_ = num_threads;
+    max_queued_ = max_queued;
+    threads_.resize(num_threads);
+    for (auto& thread : threads_) {
+        thread = std::thread(&Decompressor::Work, this);
+    }
+    return true;
+}
+
+void Decompressor::Submit(DecompressTask task) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        room_.wait(lock, [this] { return num_queued_ < max_queued_; });
+        queue_.push_back({task, nullptr});
+        ++num_queued_;
+    }
+    cond_.notify_one();
+}
+
+int64_t Decompressor::num_queued() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_queued_;
+}
+
+void Decompressor::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+    for (auto& thread : threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    threads_.clear();
+}
+
+void Decompressor::Work() {
+    ZSTD_DCtx* ctx = ZSTD_createDCtx();
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                break;
+            }
+            task = queue_.front();
+            queue_.pop_front();
+            if (!task.job) {
+                --num_queued_;
+            }
+        }
+
+        if (task.job) {
+            RunFrames(ctx, task.job.get());
+        } else {
+            room_.notify_one();
+            task.run(ctx);
+        }
+    }
+    ZSTD_freeDCtx(ctx);
+}
+
+bool Decompressor::DecompressFile(ZSTD_DCtx* ctx, const ZSTD_DDict* ddict,
+                                  const string& zip_path, const string& raw_path,
+                                  int64_t raw_size, string* err) {
+    // Anything that can't be split by frame (one frame, sizes not recorded, no other threads to
+    // help, or even malformed, which streaming reports best) is streamed.
+    if (threads_.size() < 2) {
+        return ZstdDecompressFile(ctx, ddict, zip_path, raw_path, err);
+    }
+    MappedFile zip;
+    if (!zip.Open(zip_path, err)) {
+        return false;
+    }
+    auto job = std::make_shared<FrameJob>();
+    if (!ZstdListFrames(zip.data(), zip.size(), &job->frames) || job->frames.size() < 2) {
+        return ZstdDecompressFile(ctx, ddict, zip_path, raw_path, err);
+    }
+    if (!raw_size) {
+        return ZstdDecompressFile(ctx, ddict, zip_path, raw_path, err);
+    }
+
+    // The frame headers come from the file, so check they add up before sizing anything by them.
+    auto& last = job->frames.back();
+    if (last.raw_offset + last.raw_size != raw_size) {
+        *err = StringPrintf("Zip file `%s` says it decompresses to %ld bytes, but expected %ld.",
+                            zip_path.c_str(), last.raw_offset + last.raw_size, raw_size);
+        return false;
+    }
+
+    // Size the output up front and map it, so that frames land directly in place.
+    string tmp_path = raw_path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        *err = StringPrintf("Unable to open file: `%s` (%s).", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, raw_size)) {
+        *err = StringPrintf("Unable to size file: `%s` (%s).", tmp_path.c_str(), strerror(errno));
+        close(fd);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    void* raw_data = mmap(nullptr, raw_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (raw_data == MAP_FAILED) {
+        *err = StringPrintf("Unable to mmap file: `%s` (%s).", tmp_path.c_str(), strerror(errno));
+        close(fd);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    job->zip_data = zip.data();
+    job->raw_data = (char*)raw_data;
+    job->ddict = ddict;
+
+    // Enlist the other threads ahead of queued shards, as this shard is already underway.
+    int64_t num_helpers = job->frames.size() - 1;
+    if (threads_.size() - 1 < num_helpers) {
+        num_helpers = threads_.size() - 1;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int64_t i = 0; i < num_helpers; ++i) {
+            queue_.push_front({nullptr, job});
+        }
+    }
+    cond_.notify_all();
+
+    // Work alongside them, then wait on frames still in flight elsewhere. Every claimed frame is
+    // being run by some thread, so this can't wait on queued work.
+    RunFrames(ctx, job.get());
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->cond.wait(lock, [&job] { return job->num_done == (int64_t)job->frames.size(); });
+    }
+
+    bool ok = job->err.empty();
+    if (!ok) {
+        *err = StringPrintf("Unable to decompress `%s`: %s", zip_path.c_str(), job->err.c_str());
+    }
+
+    munmap(raw_data, raw_size);
+    if (close(fd) && ok) {
+        *err = StringPrintf("Unable to write file: `%s` (%s).", tmp_path.c_str(), strerror(errno));
+        ok = false;
+    }
+
+    if (ok && rename(tmp_path.c_str(), raw_path.c_str())) {
+        *err = StringPrintf("Unable to rename `%s` to `%s` (%s).", tmp_path.c_str(),
+                            raw_path.c_str(), strerror(errno));
+        ok = false;
+    }
+
+    if (!ok) {
+        unlink(tmp_path.c_str());
+    }
+    return ok;
+}
+
+void Decompressor::RunFrames(ZSTD_DCtx* ctx, FrameJob* job) {
+    int64_t num_frames = job->frames.size();
+    while (true) {
+        int64_t index = job->next++;
+        if (num_frames <= index) {
+            break;
+        }
+
+        // Once a frame has failed, the rest are just counted off.
+        string err;
+        bool failed;
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            failed = !job->err.empty();
+        }
+        bool ok = failed || ZstdDecompressFrame(ctx, job->ddict, job->zip_data,
+                                                job->frames[index], job->raw_data, &err);
+
+        std::lock_guard<std::mutex> lock(job->mutex);
+        if (!ok && job->err.empty()) {
+            job->err = err;
+        }
+        ++job->num_done;
+        if (job->num_done == num_frames) {
+            job->cond.notify_all();
+        }
+    }
+}
+
+}  // namespace xtreaming
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/zip/zstd.h"
+
+using std::deque;
+using std::function;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace xtreaming {
+
+// Work run on a pool thread, given that thread's zstd context.
+typedef function<void(ZSTD_DCtx* ctx)> DecompressTask;
+
+// Fixed pool of threads that runs the downloader's decompress stage.
+//
+// Each thread reuses its own zstd context across tasks. At most `max_queued` tasks wait at once, so
+// that a slow stage pushes back on the one feeding it.
+//
+// A zip file made of several frames that each record their decompressed size is split by frame:
+// the thread decompressing it queues helper tasks at the front of the queue, then every
+// participating thread claims frames one at a time and decompresses them straight into their
+// offsets in a mapped output file. This keeps one large shard from serializing behind one core.
+class Decompressor {
+  public:
+    int64_t num_threads() const { return num_threads_; }
+
+    // Stops and joins the threads.
+    ~Decompressor();
+
+    // Start the threads.
+    bool Init(int64_t num_threads, int64_t max_queued, string* err);
+
+    // Queue a task, waiting while the queue is full.
+    void Submit(DecompressTask task);
+
+    // Number of tasks queued but not yet started.
+    int64_t num_queued() const;
+
+    // Finish queued work, then stop and join the threads.
+    void Stop();
+
+    // Decompress one zip file to a raw file of `raw_size` bytes, renamed into place on success.
+    // Called from a task, with its context, enlisting idle threads for multi-frame files.
+    bool DecompressFile(ZSTD_DCtx* ctx, const ZSTD_DDict* ddict, const string& zip_path,
+                        const string& raw_path, int64_t raw_size, string* err);
+
+  private:
+    // The frames of one zip file, being decompressed by several threads at once.
+    struct FrameJob {
+        const char* zip_data;          // Mapped zip file.
+        vector<ZstdFrame> frames;      // Its frames.
+        char* raw_data;                // Mapped output file, sized for every frame's content.
+        const ZSTD_DDict* ddict;       // Shared dictionary, if any.
+        std::atomic<int64_t> next{0};  // Index of the next unclaimed frame.
+        std::mutex mutex;              // Guards the below.
+        std::condition_variable cond;  // Signaled when the last frame is done.
+        int64_t num_done{0};           // Number of frames finished (or failed).
+        string err;                    // First error, if any.
+    };
+
+    struct Task {
+        DecompressTask run;
+        shared_ptr<FrameJob> job;  // If set, this is a helper task for a multi-frame file.
+    };
+
+    // Worker thread body.
+    void Work();
+
+    // Claim and decompress frames of the job until none are left.
+    static void RunFrames(ZSTD_DCtx* ctx, FrameJob* job);
+
+    vector<std::thread> threads_;   // Worker threads.
+    int64_t num_threads_{0};        // How many were started.
+    mutable std::mutex mutex_;      // Guards the below.
+    std::condition_variable cond_;  // Signaled on new work or stop.
+    std::condition_variable room_;  // Signaled when a task is taken off the queue.
+    deque<Task> queue_;             // Pending tasks, first in first out.
+    int64_t max_queued_{1};         // Most tasks (not counting helpers) that may wait.
+    int64_t num_queued_{0};         // Tasks (not counting helpers) waiting.
+    bool stopping_{false};          // Whether to exit once the queue is drained.
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,310 @@
+#include "disk_cache.h"
+
+#include <algorithm>
+#include <climits>
+#include <unordered_set>
+#include <utility>
+
+#include "base/string.h"
+#include "cache/partial.h"
+
+using std::pair;
+using std::unordered_set;
+
+namespace xtreaming {
+
+void DiskCache::Init(int64_t max_bytes, EvictionPolicy policy, const vector<Shard*>* shards,
+                     const vector<Stream>* streams, const vector<bool>& is_present,
+                     ShardStates* states, FileCache* file_cache, Logger* logger) {
+    max_bytes_ = max_bytes;
+    policy_ = policy;
+    shards_ = shards;
+    streams_ = streams;
+    states_ = states;
+    file_cache_ = file_cache;
+    logger_ = logger;
+
+    lru_its_.resize(shards->size());
+    is_present_.resize(shards->size());
+    is_partial_.resize(shards->size());
+    sizes_.resize(shards->size());
+    for (int64_t i = 0; i < shards->size(); ++i) {
+        int64_t size = is_present[i] ? GetSize(i) : GetPartialSize(i);
+        if (size) {
+            lru_its_[i] = lru_.insert(lru_.end(), i);
+            is_present_[i] = true;
+            is_partial_[i] = !is_present[i];
+            sizes_[i] = size;
+            num_bytes_ += size;
+        }
+    }
+}
+
+void DiskCache::Reserve(int64_t shard_id, const function<bool(int64_t)>& is_pinned,
+                        vector<int64_t>* evicted) {
+    int64_t size = GetSize(shard_id);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (reserved_.count(shard_id) || (is_present_[shard_id] && !is_partial_[shard_id])) {
+        return;
+    }
+    reserved_[shard_id] = size;
+    num_reserved_ += size;
+    MakeRoom(is_pinned, evicted);
+}
+
+void DiskCache::ReservePartial(int64_t shard_id, int64_t num_bytes,
+                               const function<bool(int64_t)>& is_pinned,
+                               vector<int64_t>* evicted) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (reserved_.count(shard_id) || (is_present_[shard_id] && !is_partial_[shard_id])) {
+        return;
+    }
+    reserved_[shard_id] = num_bytes;
+    num_reserved_ += num_bytes;
+    MakeRoom(is_pinned, evicted);
+}
+
+void DiskCache::MakeRoom(const function<bool(int64_t)>& is_pinned, vector<int64_t>* evicted) {
+    if (max_bytes_ < 0) {
+        return;
+    }
+
+    unordered_set<int64_t> busy;  // Shards someone else is on.
+    auto is_skipped = [&](int64_t id) { return busy.count(id) || is_pinned(id); };
+    while (max_bytes_ < num_bytes_ + num_reserved_) {
+        int64_t victim = PickVictim(is_skipped);
+        if (victim < 0) {
+            break;
+        }
+        if (Evict(victim)) {
+            evicted->emplace_back(victim);
+        } else {
+            busy.insert(victim);
+        }
+    }
+
+    // Only warn on going over, not on every shard while over.
+    bool is_over = max_bytes_ < num_bytes_ + num_reserved_;
+    if (is_over && !is_over_) {
+        logger_->Log(LogLevel::WARN, StringPrintf("Disk cache is over its budget of %ld bytes "
+                                                  "(%ld present, %ld reserved), with every "
+                                                  "cached shard pinned.", max_bytes_,
+                                                  num_bytes_, num_reserved_));
+    }
+    is_over_ = is_over;
+}
+
+void DiskCache::Plan(const int64_t* sample_ids, int64_t num_workers, int64_t num_samples,
+                     int64_t batch_size, const Spanner& shard_index) {
+    if (policy_ != EvictionPolicy::BELADY) {
+        return;
+    }
+
+    // Collect (shard, position) uses, once per shard per batch of each worker.
+    int64_t num_shards = lru_its_.size();
+    vector<pair<int64_t, int64_t>> pairs;
+    vector<int64_t> last_uses(num_shards, -1L);
+    for (int64_t worker = 0; worker < num_workers; ++worker) {
+        const int64_t* ids = &sample_ids[worker * num_samples];
+        for (int64_t i = 0; i < num_samples; ++i) {
+            if (ids[i] == -1L) {
+                continue;
+            }
+            int64_t shard_id;
+            int64_t shard_sample_id;
+            shard_index.Find(ids[i], &shard_id, &shard_sample_id);
+            int64_t position = i / batch_size * batch_size;
+            if (last_uses[shard_id] == position) {
+                continue;
+            }
+            last_uses[shard_id] = position;
+            pairs.emplace_back(shard_id, position);
+        }
+        std::fill(last_uses.begin(), last_uses.end(), -1L);
+    }
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    vector<int64_t> use_offsets(num_shards + 1);
+    vector<int64_t> uses;
+    uses.reserve(pairs.size());
+    for (auto& pair : pairs) {
+        ++use_offsets[pair.first + 1];
+        uses.emplace_back(pair.second);
+    }
+    for (int64_t i = 0; i < num_shards; ++i) {
+        use_offsets[i + 1] += use_offsets[i];
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    use_offsets_.swap(use_offsets);
+    uses_.swap(uses);
+    batch_size_ = batch_size;
+    position_ = 0;
+}
+
+void DiskCache::Advance(int64_t position) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    position_ = position;
+}
+
+void DiskCache::Commit(int64_t shard_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Unreserve(shard_id);
+    if (is_present_[shard_id] && !is_partial_[shard_id]) {
+        lru_.splice(lru_.begin(), lru_, lru_its_[shard_id]);
+        return;
+    }
+    Add(shard_id, GetSize(shard_id), false);
+}
+
+void DiskCache::CommitPartial(int64_t shard_id) {
+    int64_t size = GetPartialSize(shard_id);
+    std::lock_guard<std::mutex> lock(mutex_);
+    Unreserve(shard_id);
+    if (!size || (is_present_[shard_id] && !is_partial_[shard_id])) {
+        return;
+    }
+    Add(shard_id, size, true);
+}
+
+void DiskCache::Abort(int64_t shard_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Unreserve(shard_id);
+}
+
+void DiskCache::Touch(int64_t shard_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (is_present_[shard_id]) {
+        lru_.splice(lru_.begin(), lru_, lru_its_[shard_id]);
+    }
+}
+
+int64_t DiskCache::num_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_bytes_;
+}
+
+int64_t DiskCache::num_reserved() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_reserved_;
+}
+
+int64_t DiskCache::num_shards() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lru_.size();
+}
+
+int64_t DiskCache::num_evicted() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_evicted_;
+}
+
+int64_t DiskCache::GetSize(int64_t shard_id) const {
+    auto shard = (*shards_)[shard_id];
+    auto& stream = (*streams_)[shard->stream_id()];
+    return shard->GetPersistentSize(stream.safe_keep_zip(), stream.unzip_to_memory());
+}
+
+int64_t DiskCache::GetPartialSize(int64_t shard_id) const {
+    auto shard = (*shards_)[shard_id];
+    auto& stream = (*streams_)[shard->stream_id()];
+    string dir = stream.local() + "/" + stream.split() + "/";
+    int64_t size = 0;
+    for (auto& pair : shard->file_pairs()) {
+        size += PartialFile::GetNumBytes(dir + pair.first->path, pair.first->num_bytes);
+    }
+    return size;
+}
+
+void DiskCache::Unreserve(int64_t shard_id) {
+    auto it = reserved_.find(shard_id);
+    if (it != reserved_.end()) {
+        num_reserved_ -= it->second;
+        reserved_.erase(it);
+    }
+}
+
+void DiskCache::Add(int64_t shard_id, int64_t num_bytes, bool is_partial) {
+    if (is_present_[shard_id]) {
+        num_bytes_ -= sizes_[shard_id];
+        lru_.splice(lru_.begin(), lru_, lru_its_[shard_id]);
+    } else {
+        lru_its_[shard_id] = lru_.insert(lru_.begin(), shard_id);
+        is_present_[shard_id] = true;
+    }
+    is_partial_[shard_id] = is_partial;
+    sizes_[shard_id] = num_bytes;
+    num_bytes_ += num_bytes;
+}
+
+int64_t DiskCache::GetNextUse(int64_t shard_id) const {
+    if (use_offsets_.empty()) {
+        return INT64_MAX;
+    }
+    auto begin = uses_.begin() + use_offsets_[shard_id];
+    auto end = uses_.begin() + use_offsets_[shard_id + 1];
+    auto it = std::lower_bound(begin, end, position_ / batch_size_ * batch_size_);
+    return it == end ? INT64_MAX : *it;
+}
+
+int64_t DiskCache::PickVictim(const function<bool(int64_t)>& is_skipped) const {
+    // Without a plan, every shard looks never used again, leaving it to LRU.
+    bool is_lru = policy_ == EvictionPolicy::LRU || use_offsets_.empty();
+    int64_t best = -1;
+    int64_t best_next_use = -1;
+    for (auto it = lru_.rbegin(); it != lru_.rend(); ++it) {
+        if (is_skipped(*it)) {
+            continue;
+        }
+        if (is_lru) {
+            return *it;
+        }
+        int64_t next_use = GetNextUse(*it);
+        if (best_next_use < next_use) {
+            best = *it;
+            best_next_use = next_use;
+            if (next_use == INT64_MAX) {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+bool DiskCache::Evict(int64_t shard_id) {
+    // A partial copy is ours alone, and never mapped.
+    auto shard = (*shards_)[shard_id];
+    auto& stream = (*streams_)[shard->stream_id()];
+    if (is_partial_[shard_id]) {
+        for (auto& pair : shard->file_pairs()) {
+            PartialFile::Remove(stream.local() + "/" + stream.split() + "/" + pair.first->path);
+        }
+        Remove(shard_id);
+        return true;
+    }
+
+    // Leave it to whoever else is downloading or evicting it. If someone already evicted it, just
+    // stop counting it.
+    bool is_ours = !states_ || states_->TryEvict(shard_id);
+    if (!is_ours && states_->Get(shard_id) != ShardState::ABSENT) {
+        return false;
+    }
+    if (is_ours) {
+        file_cache_->Evict(shard_id, shard, stream);
+        if (states_) {
+            states_->EndEvict(shard_id);
+        }
+    }
+    Remove(shard_id);
+    return true;
+}
+
+void DiskCache::Remove(int64_t shard_id) {
+    lru_.erase(lru_its_[shard_id]);
+    is_present_[shard_id] = false;
+    num_bytes_ -= sizes_[shard_id];
+    ++num_evicted_;
+}
+
+}  // namespace xtreaming
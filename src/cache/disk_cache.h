@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "base/logger.h"
+#include "base/spanner.h"
+#include "cache/file_cache.h"
+#include "cache/shard_states.h"
+#include "serial/base/shard.h"
+#include "stream.h"
+
+using std::function;
+using std::list;
+using std::unordered_map;
+using std::vector;
+
+namespace xtreaming {
+
+// How the disk cache picks shards to evict.
+enum class EvictionPolicy {
+    LRU,    // Least recently used first.
+    BELADY  // Next used furthest in the plan first (never again this epoch before all else).
+};
+
+// Keeps the shards cached on local disk within a byte budget, evicting by the given policy.
+//
+// Each shard counts as its persistent size (see Shard::GetPersistentSize()), or, if only
+// partially fetched, as the bytes its partial copies have (see PartialFile). A shard about to be
+// downloaded reserves its size (or an estimate of its ranges) up front. If that takes usage over
+// the budget, present shards are evicted until it doesn't. Shards the caller says are pinned are
+// skipped.
+//
+// The sample order of an epoch is known in advance, so with the Belady policy we evict the shard
+// whose next use is furthest away, which is optimal for a known future. Next uses come from the
+// node's plan: every worker's sample IDs, mapped to shards, where a worker's `i`th sample counts as
+// used at position `i` (as workers proceed in step), rounded down to its batch. The current
+// position is the consumer's, as given to Dataset::Advance(). Ties, and the time before any plan
+// is given, fall back to LRU.
+//
+// If everything left is pinned, usage goes over the budget rather than failing the download, and
+// that is warned about. The reservation becomes the shard's usage once it lands, or is released if
+// it doesn't.
+//
+// Eviction goes through the node's shard state table, if shared, so that only one process evicts a
+// shard and the others see it go absent. Each process enforces the budget over the shards it knows
+// to be present.
+//
+// Thread-safe.
+class DiskCache {
+  public:
+    int64_t max_bytes() const { return max_bytes_; }
+
+    // Take the shards already present, and the partial copies of the rest, in shard order as to
+    // recency. A budget of -1 means unlimited, which still tracks usage. The shard state table is
+    // optional.
+    void Init(int64_t max_bytes, EvictionPolicy policy, const vector<Shard*>* shards,
+              const vector<Stream>* streams, const vector<bool>& is_present, ShardStates* states,
+              FileCache* file_cache, Logger* logger);
+
+    // Take the node's plan for an epoch: `num_workers` runs of `num_samples` sample IDs each (-1
+    // for padding), in batches of `batch_size`. Resets the position to its start.
+    void Plan(const int64_t* sample_ids, int64_t num_workers, int64_t num_samples,
+              int64_t batch_size, const Spanner& shard_index);
+
+    // Note that the consumer has reached this position in the plan (forwarded by the prefetcher).
+    void Advance(int64_t position);
+
+    // Reserve room for a shard about to be downloaded, evicting unpinned shards to fit. Gets the
+    // shards evicted, which are now absent.
+    void Reserve(int64_t shard_id, const function<bool(int64_t)>& is_pinned,
+                 vector<int64_t>* evicted);
+
+    // Likewise for fetching `num_bytes` of a shard partially. Does nothing if it's present whole.
+    void ReservePartial(int64_t shard_id, int64_t num_bytes,
+                        const function<bool(int64_t)>& is_pinned, vector<int64_t>* evicted);
+
+    // Note that a shard is now present, as most recently used, taking its reservation if any.
+    void Commit(int64_t shard_id);
+
+    // Likewise for a shard now partially present, counting whatever its partial copies have
+    // (after a failed fetch too). Evicting it removes them.
+    void CommitPartial(int64_t shard_id);
+
+    // Release a shard's reservation, if any, as its download failed or was cancelled.
+    void Abort(int64_t shard_id);
+
+    // Note that a present shard was used. The prefetcher calls this as the consumer reaches each
+    // shard of its plan, and as it waits on one (see Dataset::Advance() and AcquireShard()).
+    void Touch(int64_t shard_id);
+
+    // Current usage: bytes of present shards, bytes reserved for shards being downloaded, number
+    // of present shards, and number of shards evicted so far.
+    int64_t num_bytes() const;
+    int64_t num_reserved() const;
+    int64_t num_shards() const;
+    int64_t num_evicted() const;
+
+  private:
+    // Get a shard's size on disk once present.
+    int64_t GetSize(int64_t shard_id) const;
+
+    // Get the bytes a shard's partial copies have.
+    int64_t GetPartialSize(int64_t shard_id) const;
+
+    // Evict unpinned shards until reservations fit. Requires the lock.
+    void MakeRoom(const function<bool(int64_t)>& is_pinned, vector<int64_t>* evicted);
+
+    // Release a shard's reservation, if any. Requires the lock.
+    void Unreserve(int64_t shard_id);
+
+    // Count a shard as present at the given size, as most recently used. Requires the lock.
+    void Add(int64_t shard_id, int64_t num_bytes, bool is_partial);
+
+    // Stop counting an evicted shard. Requires the lock.
+    void Remove(int64_t shard_id);
+
+    // Get the next position at which the plan uses a shard, or INT64_MAX if none. Requires the
+    // lock.
+    int64_t GetNextUse(int64_t shard_id) const;
+
+    // Pick the present shard to evict next, or -1 if all are skipped. Requires the lock.
+    int64_t PickVictim(const function<bool(int64_t)>& is_skipped) const;
+
+    // Evict a present shard. Returns whether it was removed (by us or someone else). Requires the
+    // lock.
+    bool Evict(int64_t shard_id);
+
+    int64_t max_bytes_{-1L};                  // Budget.
+    EvictionPolicy policy_;                   // How to pick what to evict.
+    const vector<Shard*>* shards_{nullptr};   // All shards.
+    const vector<Stream>* streams_{nullptr};  // Streams, which shards refer to by ID.
+    ShardStates* states_{nullptr};            // Node's shard state table, if shared.
+    FileCache* file_cache_{nullptr};          // Dropped along with evicted files.
+    Logger* logger_{nullptr};                 // Takes warnings.
+
+    mutable std::mutex mutex_;                  // Guards the below.
+    list<int64_t> lru_;                         // Present shard IDs, most recently used first.
+    vector<list<int64_t>::iterator> lru_its_;   // Position of each present shard in the LRU list.
+    vector<bool> is_present_;                   // Whether each shard is in the LRU list.
+    vector<bool> is_partial_;                   // Whether each of those is only partial.
+    vector<int64_t> sizes_;                     // Bytes each of those counts as.
+    unordered_map<int64_t, int64_t> reserved_;  // Bytes reserved by shard ID.
+    int64_t num_bytes_{0};                      // Bytes of present shards.
+    int64_t num_reserved_{0};                   // Bytes reserved.
+    int64_t num_evicted_{0};                    // Shards evicted.
+    bool is_over_{false};                       // Whether we are over budget with all pinned.
+    vector<int64_t> use_offsets_;               // Where each shard's uses start in the below.
+    vector<int64_t> uses_;                      // Positions at which each shard is used, sorted.
+    int64_t batch_size_{1};                     // Samples per batch, which uses are rounded to.
+    int64_t position_{0};                       // Consumer's position in the plan.
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,215 @@
+#include <sys/stat.h>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "base/spanner.h"
+#include "base/string.h"
+#include "cache/disk_cache.h"
+
+using std::string;
+using std::vector;
+using namespace xtreaming;
+
+namespace {
+
+const int64_t kNumShards = 4;     // Shards in the dataset.
+const int64_t kShardSize = 100;  // Bytes per shard.
+
+// A shard of one raw file, with no index to read it from.
+class TestShard : public Shard {
+  public:
+    void Init(int64_t shard_id) {
+        Shard::Init(0, {}, 1, 0, "");
+        auto raw = new FileInfo;
+        raw->path = StringPrintf("%ld.bin", shard_id);
+        raw->num_bytes = kShardSize;
+        file_pairs_.emplace_back(raw, nullptr);
+    }
+};
+
+// A dataset of kNumShards shards, of which the first few are present on disk.
+class Fixture {
+  public:
+    vector<Shard*> shards;
+    vector<Stream> streams;
+    vector<bool> is_present;
+    FileCache file_cache;
+    Logger logger;
+
+    explicit Fixture(int64_t num_present = kNumShards - 1) {
+        char tmpl[] = "/tmp/disk_cache_test.XXXXXX";
+        dir_ = mkdtemp(tmpl);
+        mkdir((dir_ + "/train").c_str(), 0755);
+
+        string err;
+        streams.resize(1);
+        json obj = {{"local", dir_}, {"split", "train"}};
+        assert(streams[0].Init("stream", obj, json::object(), &err));
+        file_cache.Init(-1, -1, nullptr);
+        assert(logger.Init("/dev/null", "fatal", &err));
+
+        for (int64_t i = 0; i < kNumShards; ++i) {
+            auto shard = new TestShard;
+            shard->Init(i);
+            shards.emplace_back(shard);
+            is_present.emplace_back(i < num_present);
+            if (is_present[i]) {
+                std::ofstream(GetPath(i), std::ios::binary) << string(kShardSize, 'x');
+            }
+        }
+    }
+
+    ~Fixture() {
+        for (auto& shard : shards) {
+            delete shard;
+        }
+        string cmd = "rm -rf " + dir_;
+        assert(!system(cmd.c_str()));
+    }
+
+    // Get where a shard's file lives.
+    string GetPath(int64_t shard_id) const {
+        return StringPrintf("%s/train/%ld.bin", dir_.c_str(), shard_id);
+    }
+
+    // List the ranges present in a shard's partial copy.
+    void SetPartial(int64_t shard_id, const string& ranges) const {
+        std::ofstream(GetPath(shard_id) + ".partial", std::ios::binary) << string(kShardSize, 'x');
+        std::ofstream(GetPath(shard_id) + ".partial.ranges") << ranges;
+    }
+
+    // Whether a shard's file is on disk.
+    bool IsOnDisk(int64_t shard_id) const {
+        struct stat info;
+        return !stat(GetPath(shard_id).c_str(), &info);
+    }
+
+  private:
+    string dir_;  // Scratch dir.
+};
+
+bool IsNotPinned(int64_t) {
+    return false;
+}
+
+// Shards are evicted least recently used first, skipping pinned ones.
+void TestLRU() {
+    Fixture fixture;
+    DiskCache cache;
+    cache.Init(3 * kShardSize, EvictionPolicy::LRU, &fixture.shards, &fixture.streams,
+               fixture.is_present, nullptr, &fixture.file_cache, &fixture.logger);
+    assert(cache.num_bytes() == 3 * kShardSize);
+    assert(cache.num_shards() == 3);
+
+    // Present shards start in shard order, so touching the last makes the middle one the oldest.
+    cache.Touch(2);
+    vector<int64_t> evicted;
+    cache.Reserve(3, IsNotPinned, &evicted);
+    assert((evicted == vector<int64_t>{1}));
+    assert(!fixture.IsOnDisk(1));
+    assert(fixture.IsOnDisk(0));
+    assert(cache.num_bytes() == 2 * kShardSize);
+    assert(cache.num_reserved() == kShardSize);
+    cache.Commit(3);
+    assert(cache.num_bytes() == 3 * kShardSize);
+    assert(!cache.num_reserved());
+
+    // Now shard 0 is the oldest, but pinned.
+    evicted.clear();
+    cache.Reserve(1, [](int64_t id) { return id == 0; }, &evicted);
+    assert((evicted == vector<int64_t>{2}));
+    cache.Commit(1);
+    assert(cache.num_evicted() == 2);
+}
+
+// Shards are evicted next used furthest in the plan first.
+void TestBelady() {
+    Fixture fixture;
+    DiskCache cache;
+    cache.Init(3 * kShardSize, EvictionPolicy::BELADY, &fixture.shards, &fixture.streams,
+               fixture.is_present, nullptr, &fixture.file_cache, &fixture.logger);
+
+    // One sample per shard, so sample IDs are shard IDs. Shard 2 is never used, though it is the
+    // most recently used.
+    Spanner shard_index;
+    shard_index.Init(vector<int64_t>(kNumShards, 1), 2);
+    int64_t sample_ids[] = {3, 0, 1, 0, 1};
+    cache.Plan(sample_ids, 1, 5, 1, shard_index);
+    cache.Touch(2);
+    vector<int64_t> evicted;
+    cache.Reserve(3, IsNotPinned, &evicted);
+    assert((evicted == vector<int64_t>{2}));
+    cache.Commit(3);
+
+    // Past its one use, shard 3 goes next, though it is the most recently used.
+    cache.Advance(2);
+    evicted.clear();
+    cache.Reserve(2, IsNotPinned, &evicted);
+    assert((evicted == vector<int64_t>{3}));
+    assert(fixture.IsOnDisk(0));
+    assert(fixture.IsOnDisk(1));
+}
+
+// With everything pinned, the reservation goes over budget rather than evicting, and is released
+// if the download fails.
+void TestAllPinned() {
+    Fixture fixture;
+    DiskCache cache;
+    cache.Init(3 * kShardSize, EvictionPolicy::LRU, &fixture.shards, &fixture.streams,
+               fixture.is_present, nullptr, &fixture.file_cache, &fixture.logger);
+    vector<int64_t> evicted;
+    cache.Reserve(3, [](int64_t) { return true; }, &evicted);
+    assert(evicted.empty());
+    assert(cache.num_bytes() + cache.num_reserved() == 4 * kShardSize);
+    cache.Abort(3);
+    assert(!cache.num_reserved());
+    assert(!cache.num_evicted());
+    for (int64_t i = 0; i < 3; ++i) {
+        assert(fixture.IsOnDisk(i));
+    }
+}
+
+// Partial copies count as the bytes of their ranges, and are evicted like any other shard.
+void TestPartial() {
+    Fixture fixture(2);
+    fixture.SetPartial(2, "0 40\n");
+    DiskCache cache;
+    cache.Init(3 * kShardSize, EvictionPolicy::LRU, &fixture.shards, &fixture.streams,
+               fixture.is_present, nullptr, &fixture.file_cache, &fixture.logger);
+    assert(cache.num_bytes() == 2 * kShardSize + 40);
+    assert(cache.num_shards() == 3);
+
+    // Fetching more ranges counts them once they land.
+    vector<int64_t> evicted;
+    cache.ReservePartial(2, 20, IsNotPinned, &evicted);
+    assert(evicted.empty());
+    assert(cache.num_reserved() == 20);
+    fixture.SetPartial(2, "0 40\n50 70\n");
+    cache.CommitPartial(2);
+    assert(cache.num_bytes() == 2 * kShardSize + 60);
+    assert(!cache.num_reserved());
+
+    // Once it is the oldest, making room removes it.
+    cache.Touch(0);
+    cache.Touch(1);
+    cache.Reserve(3, IsNotPinned, &evicted);
+    assert((evicted == vector<int64_t>{2}));
+    assert(cache.num_bytes() == 2 * kShardSize);
+    struct stat info;
+    assert(stat((fixture.GetPath(2) + ".partial").c_str(), &info));
+    assert(stat((fixture.GetPath(2) + ".partial.ranges").c_str(), &info));
+}
+
+}  // namespace
+
+int main() {
+    TestLRU();
+    TestBelady();
+    TestAllPinned();
+    TestPartial();
+}
@@ -0,0 +1,1063 @@
+#include "downloader.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "base/hash/hash.h"
+#include "base/string.h"
+#include "base/time.h"
+#include "cache/fused.h"
+#include "cache/partial.h"
+#include "cache/resume.h"
+#include "remote/all.h"
+
+namespace fs = std::filesystem;
+
+namespace xtreaming {
+namespace {
+
+// Where a fetched file waits to be verified and published.
+string FetchedPath(const string& path) {
+    return path + ".fetched";
+}
+
+// Where a decompressed file waits to be published.
+string UnzippedPath(const string& path) {
+    return path + ".unzipped";
+}
+
+string GetDir(const Stream& stream) {
+    return stream.local() + "/" + stream.split() + "/";
+}
+
+// Check a file against the index's digest for it.
+bool CheckDigest(const string& path, const FileInfo* info, const string& algo, string* err) {
+    string expected;
+    if (!HexToBytes(info->hashes.at(algo), &expected)) {
+        *err = StringPrintf("Malformed `%s` digest of `%s` in index.", algo.c_str(),
+                            info->path.c_str());
+        return false;
+    }
+    string digest;
+    if (!HashFile(path, algo, &digest, err)) {
+        return false;
+    }
+    if (digest != expected) {
+        *err = StringPrintf("Hash mismatch on `%s`.", info->path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Bytes of a shard as fetched: its zips if zipped, else its raw files.
+int64_t GetStoredSize(const Shard* shard) {
+    int64_t size = 0;
+    for (auto& pair : shard->file_pairs()) {
+        size += (pair.second ? pair.second : pair.first)->num_bytes;
+    }
+    return size;
+}
+
+// Rough bytes of fetching the given samples of a shard (or all of it, if none given).
+int64_t GetFetchSize(const Shard* shard, const vector<int64_t>& samples) {
+    int64_t size = GetStoredSize(shard);
+    if (samples.empty() || shard->num_samples() <= 0) {
+        return size;
+    }
+    return size * (int64_t)samples.size() / shard->num_samples();
+}
+
+bool Rename(const string& from, const string& to, string* err) {
+    if (rename(from.c_str(), to.c_str())) {
+        *err = StringPrintf("Unable to rename `%s` to `%s` (%s).", from.c_str(), to.c_str(),
+                            strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool GetThreadCount(const json& obj, const string& key, int64_t def, int64_t* ret,
+                    string* err) {
+    if (!GetInt64(obj, key, def, ret, err)) {
+        return false;
+    }
+    if (*ret < 1) {
+        *err = StringPrintf("`downloader.%s` must be positive (got: %ld).", key.c_str(), *ret);
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+Downloader::~Downloader() {
+    Stop();
+    for (auto& hedger : hedgers_) {
+        delete hedger;
+    }
+    for (auto& remote : remotes_) {
+        delete remote;
+    }
+}
+
+bool Downloader::Init(const json& obj, const vector<Stream>* streams, ShardStates* states,
+                      Logger* logger, string* err) {
+    // How many fetches may be in flight adapts to the remote's observed throughput and latency,
+    // from `concurrency` to between `min_concurrency` and `max_concurrency` (see ConcurrencyLimit).
+    // Set all three the same to fix it. Fetch threads are started as the limit first needs them.
+    int64_t concurrency;
+    if (!GetThreadCount(obj, "concurrency", 64, &concurrency, err)) {
+        return false;
+    }
+
+    // By default, range from a few fetches to a few hundred, or to wherever we started.
+    int64_t min_concurrency;
+    if (!GetThreadCount(obj, "min_concurrency", std::min(concurrency, 4L), &min_concurrency,
+                        err)) {
+        return false;
+    }
+
+    int64_t max_concurrency;
+    if (!GetThreadCount(obj, "max_concurrency", std::max(concurrency, 256L), &max_concurrency,
+                        err)) {
+        return false;
+    }
+
+    if (concurrency < min_concurrency || max_concurrency < concurrency) {
+        *err = StringPrintf("`downloader.concurrency` must be between `min_concurrency` and "
+                            "`max_concurrency` (got: %ld, %ld, and %ld).", concurrency,
+                            min_concurrency, max_concurrency);
+        return false;
+    }
+
+    double concurrency_interval;
+    if (!GetTime(obj, "concurrency_interval", 1.0, &concurrency_interval, err)) {
+        return false;
+    }
+    if (concurrency_interval <= 0) {
+        *err = StringPrintf("`downloader.concurrency_interval` must be positive (got: %.3lf).",
+                            concurrency_interval);
+        return false;
+    }
+
+    int64_t num_verify_threads;
+    if (!GetThreadCount(obj, "verify_threads", 4, &num_verify_threads, err)) {
+        return false;
+    }
+
+    int64_t num_decompress_threads;
+    int64_t default_decompress_threads = std::max(std::thread::hardware_concurrency(), 1U);
+    if (!GetThreadCount(obj, "decompress_threads", default_decompress_threads,
+                        &num_decompress_threads, err)) {
+        return false;
+    }
+
+    int64_t num_publish_threads;
+    if (!GetThreadCount(obj, "publish_threads", 1, &num_publish_threads, err)) {
+        return false;
+    }
+
+    int64_t queue_depth;
+    if (!GetInt64(obj, "queue_depth", 16, &queue_depth, err)) {
+        return false;
+    }
+    if (queue_depth < 1) {
+        *err = StringPrintf("`downloader.queue_depth` must be positive (got: %ld).", queue_depth);
+        return false;
+    }
+
+    // Stream each fetched file through a fused sink that hashes, decompresses and lands it in one
+    // pass, so the shard skips straight to publish.
+    if (!GetBool(obj, "fused", false, &fused_, err)) {
+        return false;
+    }
+
+    // Partial fetches get a shard's header and its samples' byte ranges, merged when at most this
+    // far apart.
+    if (!GetBytes(obj, "partial_merge_gap", 64L << 10, &partial_merge_gap_, err)) {
+        return false;
+    }
+
+    // Stored files at least this big are fetched resumably (see FetchResumable), so a retry after a
+    // failure partway through only fetches the rest.
+    if (!GetBytes(obj, "resume_size", 64L << 20, &resume_size_, err)) {
+        return false;
+    }
+
+    // Small whole shards (stored size at most `coalesce_size`) are fetched in batches of up to
+    // `coalesce_count`: a fetch thread taking one also takes the next few queued from the same
+    // stream, and gets all their files in one batched transfer. Each then goes through the later
+    // stages, and is published, on its own. Only for remotes that can really batch (see
+    // Remote::CanBatch()), as otherwise the batch would just fetch in series what could go in
+    // parallel.
+    if (!GetBytes(obj, "coalesce_size", 0, &coalesce_size_, err)) {
+        return false;
+    }
+
+    if (!GetThreadCount(obj, "coalesce_count", 32, &coalesce_count_, err)) {
+        return false;
+    }
+
+    // Share fetching between streams by weighted fair queuing (start-time fair queuing over bytes).
+    // A stream's weight is its proportion of the plan times its bytes per sample, as measured over
+    // the shards submitted so far, which is the byte rate the plan consumes it at. Each fetch
+    // advances its stream's virtual time by bytes over weight, and the next fetch comes from the
+    // waiting stream furthest behind, so a stream of huge shards can't crowd out the others.
+    // Shards the consumer has already reached (see Advance()) skip ahead of that. Otherwise, the
+    // most urgent shard of any stream goes first.
+    if (!GetBool(obj, "fair", true, &fair_, err)) {
+        return false;
+    }
+
+    // Downloads that run slower than this percentile of the stream's recent ones get a second copy
+    // racing them, within `hedge_budget` hedges per download (see Hedger).
+    double hedge_percentile;
+    if (!GetDouble(obj, "hedge_percentile", 0.0, &hedge_percentile, err)) {
+        return false;
+    }
+    if (hedge_percentile < 0 || 1 <= hedge_percentile) {
+        *err = StringPrintf("`downloader.hedge_percentile` must be in [0, 1), where 0 is off (got: "
+                            "%.3lf).", hedge_percentile);
+        return false;
+    }
+
+    double hedge_budget;
+    if (!GetDouble(obj, "hedge_budget", 0.05, &hedge_budget, err)) {
+        return false;
+    }
+    if (hedge_budget < 0 || 1 < hedge_budget) {
+        *err = StringPrintf("`downloader.hedge_budget` must be in [0, 1] (got: %.3lf).",
+                            hedge_budget);
+        return false;
+    }
+
+    if (!GetTime(obj, "stats_interval", 60.0, &stats_interval_, err)) {
+        return false;
+    }
+    if (stats_interval_ < 0) {
+        *err = StringPrintf("`downloader.stats_interval` must be non-negative (got: %.3lf).",
+                            stats_interval_);
+        return false;
+    }
+
+    streams_ = streams;
+    states_ = states;
+    logger_ = logger;
+    remotes_.resize(streams->size());
+    hedgers_.resize(streams->size());
+    queues_.resize(streams->size());
+    for (int64_t i = 0; i < streams->size(); ++i) {
+        auto& stream = (*streams)[i];
+
+        // Nothing to fetch if local is the only copy, or is the remote itself.
+        if (stream.remote().empty() || stream.remote() == stream.local()) {
+            continue;
+        }
+
+        string remote_err;
+        remotes_[i] = GetRemote(stream.remote(), &remote_err);
+        if (!remotes_[i]) {
+            logger->Log(LogLevel::WARN, StringPrintf("Stream `%s` can only use shards already "
+                                                     "cached: %s", stream.name().c_str(),
+                                                     remote_err.c_str()));
+        } else if (hedge_percentile) {
+            hedgers_[i] = new Hedger;
+            hedgers_[i]->Init(hedge_percentile, hedge_budget);
+        }
+    }
+
+    verify_queue_.Init(queue_depth);
+    publish_queue_.Init(queue_depth);
+
+    fetch_.name = "fetch";
+    verify_.name = "verify";
+    decompress_.name = "decompress";
+    publish_.name = "publish";
+    limit_.Init(concurrency, min_concurrency, max_concurrency, concurrency_interval);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        AddFetchThreads();
+    }
+    verify_.threads.resize(num_verify_threads);
+    for (auto& thread : verify_.threads) {
+        thread = std::thread(&Downloader::VerifyThread, this);
+    }
+    if (!decompressor_.Init(num_decompress_threads, queue_depth, err)) {
+        return false;
+    }
+    publish_.threads.resize(num_publish_threads);
+    for (auto& thread : publish_.threads) {
+        thread = std::thread(&Downloader::PublishThread, this);
+    }
+    if (stats_interval_ > 0) {
+        stats_thread_ = std::thread(&Downloader::StatsThread, this);
+    }
+    return true;
+}
+
+void Downloader::Submit(int64_t shard_id, const Shard* shard, int64_t priority,
+                        DownloadDone done) {
+    SubmitPartial(shard_id, shard, {}, priority, done);
+}
+
+void Downloader::SubmitPartial(int64_t shard_id, const Shard* shard,
+                               const vector<int64_t>& samples, int64_t priority,
+                               DownloadDone done) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Job job;
+        job.shard_id = shard_id;
+        job.shard = shard;
+        job.priority = priority;
+        job.done = done;
+        if (CanFetchPartial(shard)) {
+            job.samples = samples;
+        }
+        Enqueue(job);
+    }
+    cond_.notify_one();
+}
+
+void Downloader::Advance(int64_t position) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    position_ = position;
+}
+
+bool Downloader::Reprioritize(int64_t shard_id, int64_t priority) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(shard_id);
+    if (it == jobs_.end()) {
+        return false;
+    }
+    auto& job = it->second;
+    auto& shards = queues_[job.shard->stream_id()].shards;
+    shards.erase({job.priority, shard_id});
+    job.priority = priority;
+    shards.insert({priority, shard_id});
+    return true;
+}
+
+bool Downloader::Cancel(int64_t shard_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(shard_id);
+    if (it == jobs_.end()) {
+        return false;
+    }
+    auto& job = it->second;
+
+    // A shard sent back for another try still holds its claim.
+    if (job.is_claimed) {
+        RemoveStaged(job.shard);
+        states_->EndDownload(shard_id, false);
+    }
+
+    queues_[job.shard->stream_id()].shards.erase({job.priority, shard_id});
+    --num_queued_;
+    jobs_.erase(it);
+    return true;
+}
+
+int64_t Downloader::num_queued() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_queued_;
+}
+
+bool Downloader::is_stopping() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stopping_;
+}
+
+void Downloader::Stop() {
+    // Shards not yet started are dropped rather than fetched first, which could take a whole
+    // prefetch window.
+    vector<Job> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        for (auto& pair : jobs_) {
+            cancelled.emplace_back(pair.second);
+        }
+        jobs_.clear();
+        for (auto& queue : queues_) {
+            queue.shards.clear();
+        }
+        num_queued_ = 0;
+    }
+    cond_.notify_all();
+    stats_cond_.notify_all();
+    for (auto& job : cancelled) {
+        Finish(job, false, "Cancelled, as the downloader is stopping.");
+    }
+
+    // Drain the stages in order, each once nothing more can reach it.
+    for (auto& thread : fetch_.threads) {
+        thread.join();
+    }
+    for (auto& hedger : hedgers_) {
+        if (hedger) {
+            hedger->Wait();
+        }
+    }
+    verify_queue_.Close();
+    for (auto& thread : verify_.threads) {
+        thread.join();
+    }
+    decompressor_.Stop();
+    publish_queue_.Close();
+    for (auto& thread : publish_.threads) {
+        thread.join();
+    }
+    if (stats_thread_.joinable()) {
+        stats_thread_.join();
+    }
+
+    if (fetch_.threads.empty()) {
+        return;
+    }
+    LogStats();
+    for (auto stage : {&fetch_, &verify_, &decompress_, &publish_}) {
+        stage->threads.clear();
+    }
+}
+
+void Downloader::LogStats() const {
+    int64_t num_fetch_threads;
+    int64_t num_fetch_queued;
+    int64_t num_fetching;
+    ConcurrencyLimit limit;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        num_fetch_threads = fetch_.threads.size();
+        num_fetch_queued = num_queued_;
+        num_fetching = num_fetching_;
+        limit = limit_;
+    }
+    logger_->Log(LogLevel::INFO, StringPrintf("[Download] Concurrency: %ld in flight, limit %ld "
+                                              "(range %ld-%ld), %.1f MiB/s, %.3fs latency.",
+                                              num_fetching, limit.limit(), limit.min_limit(),
+                                              limit.max_limit(), limit.throughput() / (1 << 20),
+                                              limit.latency()));
+
+    for (int64_t i = 0; i < hedgers_.size(); ++i) {
+        auto hedger = hedgers_[i];
+        if (!hedger) {
+            continue;
+        }
+        logger_->Log(LogLevel::INFO, StringPrintf("[Download] Stream `%s` hedging: %ld of %ld "
+                                                  "downloads hedged, %ld won by the hedge, "
+                                                  "%.3fs threshold.",
+                                                  (*streams_)[i].name().c_str(),
+                                                  hedger->num_hedged(), hedger->num_downloads(),
+                                                  hedger->num_won(), hedger->GetThreshold()));
+    }
+
+    const Stage* stages[] = {&fetch_, &verify_, &decompress_, &publish_};
+    int64_t num_threads[] = {num_fetch_threads, (int64_t)verify_.threads.size(),
+                             decompressor_.num_threads(), (int64_t)publish_.threads.size()};
+    int64_t depths[] = {num_fetch_queued, verify_queue_.size(), decompressor_.num_queued(),
+                        publish_queue_.size()};
+    for (int64_t i = 0; i < 4; ++i) {
+        auto& stage = *stages[i];
+        logger_->Log(LogLevel::INFO, StringPrintf("[Download] Stage `%s`: %ld/%ld threads busy, "
+                                                  "%ld queued, %.3fs busy, %ld shards.",
+                                                  stage.name.c_str(), stage.num_busy.load(),
+                                                  num_threads[i], depths[i],
+                                                  stage.busy_ns.load() / 1e9,
+                                                  stage.num_jobs.load()));
+    }
+}
+
+void Downloader::AddFetchThreads() {
+    while (!stopping_ && fetch_.threads.size() < limit_.limit()) {
+        fetch_.threads.emplace_back(&Downloader::FetchThread, this);
+    }
+}
+
+void Downloader::FetchThread() {
+    ZSTD_DCtx* ctx = ZSTD_createDCtx();
+    while (true) {
+        vector<Job> batch;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] {
+                return (stopping_ && !num_queued_) ||
+                       (num_queued_ && num_fetching_ < limit_.limit());
+            });
+            if (!num_queued_) {
+                break;
+            }
+            ++num_fetching_;
+            int64_t stream_id = PickStream();
+            auto& shards = queues_[stream_id].shards;
+            int64_t shard_id = shards.begin()->second;
+            shards.erase(shards.begin());
+            auto it = jobs_.find(shard_id);
+            batch.emplace_back(it->second);
+            jobs_.erase(it);
+
+            // Take the next few small shards of the stream along with it, looking only a little
+            // way down its queue so as not to jump far ahead of more urgent work.
+            if (IsCoalescible(batch[0])) {
+                int64_t num_scanned = 0;
+                for (auto it = shards.begin(); it != shards.end() &&
+                        batch.size() < coalesce_count_ && num_scanned < 4 * coalesce_count_;
+                        ++num_scanned) {
+                    auto& job = jobs_[it->second];
+                    if (!IsCoalescible(job)) {
+                        ++it;
+                        continue;
+                    }
+                    batch.emplace_back(job);
+                    jobs_.erase(it->second);
+                    it = shards.erase(it);
+                }
+            }
+
+            num_queued_ -= batch.size();
+            int64_t num_bytes = 0;
+            for (auto& job : batch) {
+                num_bytes += GetFetchSize(job.shard, job.samples);
+            }
+            Charge(stream_id, num_bytes);
+        }
+
+        ++fetch_.num_busy;
+        int64_t start = NanoTime();
+        if (batch.size() == 1) {
+            string err;
+            bool ok = Fetch(ctx, &batch[0], &err);
+            Forward(batch[0], ok, err);
+        } else {
+            FetchBatch(ctx, &batch);
+        }
+        fetch_.busy_ns += NanoTime() - start;
+        fetch_.num_jobs += batch.size();
+        --fetch_.num_busy;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --num_fetching_;
+        }
+        cond_.notify_one();
+    }
+    ZSTD_freeDCtx(ctx);
+}
+
+void Downloader::VerifyThread() {
+    Job job;
+    while (verify_queue_.Pop(&job)) {
+        ++verify_.num_busy;
+        int64_t start = NanoTime();
+        string err;
+        bool ok = Verify(job, &err);
+        verify_.busy_ns += NanoTime() - start;
+        ++verify_.num_jobs;
+        --verify_.num_busy;
+
+        if (ok) {
+            decompressor_.Submit([this, job](ZSTD_DCtx* ctx) { RunDecompress(ctx, job); });
+        } else {
+            Retry(job, err);
+        }
+    }
+}
+
+void Downloader::RunDecompress(ZSTD_DCtx* ctx, const Job& job) {
+    ++decompress_.num_busy;
+    int64_t start = NanoTime();
+    string err;
+    bool ok = Decompress(ctx, job, &err);
+    decompress_.busy_ns += NanoTime() - start;
+    ++decompress_.num_jobs;
+    --decompress_.num_busy;
+
+    if (ok) {
+        publish_queue_.Push(job);
+    } else {
+        Retry(job, err);
+    }
+}
+
+void Downloader::PublishThread() {
+    Job job;
+    while (publish_queue_.Pop(&job)) {
+        ++publish_.num_busy;
+        int64_t start = NanoTime();
+        string err;
+        bool ok = job.is_landed || Publish(job, &err);
+        publish_.busy_ns += NanoTime() - start;
+        ++publish_.num_jobs;
+        --publish_.num_busy;
+
+        Finish(job, ok, err);
+    }
+}
+
+void Downloader::StatsThread() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto interval = std::chrono::duration<double>(stats_interval_);
+    while (!stats_cond_.wait_for(lock, interval, [this] { return stopping_; })) {
+        lock.unlock();
+        LogStats();
+        lock.lock();
+    }
+}
+
+int64_t Downloader::PickStream() const {
+    // Shards the consumer has already reached go first, whatever their stream's share, so fairness
+    // only orders the lookahead.
+    int64_t urgent = -1;
+    for (int64_t i = 0; i < queues_.size(); ++i) {
+        auto& shards = queues_[i].shards;
+        if (!shards.empty() && shards.begin()->first <= position_ &&
+                (urgent < 0 || shards.begin()->first < queues_[urgent].shards.begin()->first)) {
+            urgent = i;
+        }
+    }
+    if (0 <= urgent) {
+        return urgent;
+    }
+
+    int64_t best = -1;
+    for (int64_t i = 0; i < queues_.size(); ++i) {
+        auto& queue = queues_[i];
+        if (queue.shards.empty()) {
+            continue;
+        }
+        if (best < 0) {
+            best = i;
+            continue;
+        }
+
+        // Ties (and unfair mode) go to the most urgent shard.
+        auto& other = queues_[best];
+        bool is_behind = queue.finish < other.finish;
+        bool is_tied = queue.finish == other.finish;
+        bool is_urgent = queue.shards.begin()->first < other.shards.begin()->first;
+        if (fair_ ? is_behind || (is_tied && is_urgent) : is_urgent) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+void Downloader::Charge(int64_t stream_id, int64_t num_bytes) {
+    auto& queue = queues_[stream_id];
+    double proportion = (*streams_)[stream_id].proportion();
+    if (proportion <= 0) {
+        proportion = 1e-6;
+    }
+    double bytes_per_sample = queue.num_samples ?
+        (double)queue.num_bytes / (double)queue.num_samples : 1;
+    if (bytes_per_sample <= 0) {
+        bytes_per_sample = 1;
+    }
+
+    // Virtual time is in plan positions: how far into the plan the stream's fetches reach.
+    virtual_time_ = queue.finish;
+    queue.finish += (double)num_bytes / (proportion * bytes_per_sample);
+}
+
+bool Downloader::IsCoalescible(const Job& job) const {
+    auto shard = job.shard;
+    auto remote = remotes_[shard->stream_id()];
+    return coalesce_size_ && !fused_ && job.samples.empty() && remote && remote->CanBatch() &&
+           (shard->zip_algo().empty() || IsZstd(shard->zip_algo())) &&
+           GetStoredSize(shard) <= coalesce_size_;
+}
+
+void Downloader::FetchBatch(ZSTD_DCtx* ctx, vector<Job>* batch) {
+    auto& stream = (*streams_)[(*batch)[0].shard->stream_id()];
+    auto remote = remotes_[(*batch)[0].shard->stream_id()];
+
+    // Claim what we can right away. Shards someone else is on are left to the usual path.
+    vector<Job*> claimed;
+    for (auto& job : *batch) {
+        ShardState state;
+        if (states_ && !job.is_claimed && !states_->TryDownload(job.shard_id, &state)) {
+            string err;
+            bool ok = Fetch(ctx, &job, &err);
+            Forward(job, ok, err);
+            continue;
+        }
+        job.is_claimed = states_ != nullptr;
+        claimed.emplace_back(&job);
+    }
+    if (claimed.empty()) {
+        return;
+    }
+
+    string dir = GetDir(stream);
+    vector<string> remote_paths;
+    vector<string> local_paths;
+    vector<int64_t> owners;
+    for (int64_t i = 0; i < claimed.size(); ++i) {
+        ++claimed[i]->num_tries;
+        for (auto& pair : claimed[i]->shard->file_pairs()) {
+            const FileInfo* info = pair.second ? pair.second : pair.first;
+            string local_path = dir + info->path;
+            std::error_code code;
+            fs::create_directories(fs::path(local_path).parent_path(), code);
+            remote_paths.emplace_back(stream.split() + "/" + info->path);
+            local_paths.emplace_back(FetchedPath(local_path));
+            owners.emplace_back(i);
+        }
+    }
+
+    int64_t timeout = (int64_t)(stream.download_timeout() * 1e9);
+    int64_t start = NanoTime();
+    vector<string> errs;
+    remote->DownloadBatch(remote_paths, local_paths, start + timeout, &errs);
+
+    vector<string> job_errs(claimed.size());
+    for (int64_t i = 0; i < errs.size(); ++i) {
+        if (!errs[i].empty() && job_errs[owners[i]].empty()) {
+            job_errs[owners[i]] = errs[i];
+        }
+    }
+    int64_t num_bytes = 0;
+    for (int64_t i = 0; i < claimed.size(); ++i) {
+        if (job_errs[i].empty()) {
+            num_bytes += GetStoredSize(claimed[i]->shard);
+        }
+    }
+    RecordFetch(num_bytes, NanoTime() - start);
+
+    // Failures go back in the queue, to be batched again if tries remain.
+    for (int64_t i = 0; i < claimed.size(); ++i) {
+        if (job_errs[i].empty()) {
+            verify_queue_.Push(*claimed[i]);
+        } else {
+            Retry(*claimed[i], job_errs[i]);
+        }
+    }
+}
+
+void Downloader::Forward(const Job& job, bool ok, const string& err) {
+    if (!ok) {
+        Finish(job, false, err);
+    } else if (job.is_landed) {
+        publish_queue_.Push(job);
+    } else {
+        verify_queue_.Push(job);
+    }
+}
+
+void Downloader::RecordFetch(int64_t num_bytes, int64_t latency_ns) {
+    bool is_changed;
+    int64_t limit;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int64_t old_limit = limit_.limit();
+        is_changed = limit_.Record(num_bytes, latency_ns);
+        limit = limit_.limit();
+        if (is_changed && old_limit < limit) {
+            AddFetchThreads();
+            cond_.notify_all();
+        }
+    }
+    if (is_changed) {
+        logger_->Log(LogLevel::DEBUG, StringPrintf("[Download] Concurrency limit is now %ld.",
+                                                   limit));
+    }
+}
+
+bool Downloader::Fetch(ZSTD_DCtx* ctx, Job* job, string* err) {
+    auto& stream = (*streams_)[job->shard->stream_id()];
+    if (!remotes_[job->shard->stream_id()]) {
+        *err = StringPrintf("Stream `%s` has no usable remote to download from.",
+                            stream.name().c_str());
+        return false;
+    }
+
+    // Claim it, unless someone else has it, is fetching it, or is evicting it.
+    if (states_ && !job->is_claimed) {
+        ShardState state;
+        while (!states_->TryDownload(job->shard_id, &state)) {
+            if (state == ShardState::PRESENT ||
+                    states_->Wait(job->shard_id) == ShardState::PRESENT) {
+                job->is_landed = true;
+                return true;
+            }
+        }
+        job->is_claimed = true;
+    }
+
+    // Ranged fetches are left out of the concurrency limit's measurements, being much smaller.
+    int64_t timeout = (int64_t)(stream.download_timeout() * 1e9);
+    if (!job->samples.empty()) {
+        while (job->num_tries <= stream.download_retry()) {
+            ++job->num_tries;
+            if (FetchPartial(*job, NanoTime() + timeout, err)) {
+                job->is_landed = true;
+                return true;
+            }
+        }
+        *err = StringPrintf("Giving up after %ld tries: %s", job->num_tries, err->c_str());
+        return false;
+    }
+
+    int64_t num_bytes = GetStoredSize(job->shard);
+
+    // Back off exponentially between tries, up to a few seconds.
+    while (job->num_tries <= stream.download_retry()) {
+        if (job->num_tries) {
+            int64_t backoff_ms = 100L << (job->num_tries < 6 ? job->num_tries - 1 : 5);
+            std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+        }
+        ++job->num_tries;
+        int64_t start = NanoTime();
+        bool ok = FetchOnce(ctx, *job, start + timeout, err);
+        RecordFetch(ok ? num_bytes : 0, NanoTime() - start);
+        if (ok) {
+            job->is_landed = fused_;
+            return true;
+        }
+    }
+
+    *err = StringPrintf("Giving up after %ld tries: %s", job->num_tries, err->c_str());
+    return false;
+}
+
+bool Downloader::FetchOnce(ZSTD_DCtx* ctx, const Job& job, int64_t deadline, string* err) const {
+    auto shard = job.shard;
+    if (!shard->zip_algo().empty() && !IsZstd(shard->zip_algo())) {
+        *err = StringPrintf("Unsupported compression algorithm: `%s`.",
+                            shard->zip_algo().c_str());
+        return false;
+    }
+
+    auto& stream = (*streams_)[shard->stream_id()];
+    auto remote = remotes_[shard->stream_id()];
+    string dir = GetDir(stream);
+    for (auto& pair : shard->file_pairs()) {
+        const FileInfo* info = pair.second ? pair.second : pair.first;
+        string remote_path = stream.split() + "/" + info->path;
+        string local_path = dir + info->path;
+
+        std::error_code code;
+        fs::create_directories(fs::path(local_path).parent_path(), code);
+
+        bool ok;
+        if (fused_) {
+            FusedSink sink;
+            ok = sink.Init(stream, pair.first, pair.second, ctx, err) &&
+                 remote->Fetch(remote_path, &sink, deadline, err);
+        } else if (!pair.second && PartialFile::Exists(local_path)) {
+            // Only fetch what an earlier partial fetch didn't.
+            PartialFile partial;
+            ok = partial.Init(local_path, info->num_bytes, err) &&
+                 partial.Complete(remote, remote_path, FetchedPath(local_path), deadline, err);
+        } else if (resume_size_ && resume_size_ <= info->num_bytes) {
+            ok = FetchResumable(remote, remote_path, local_path, info->num_bytes,
+                                FetchedPath(local_path), deadline, err);
+        } else if (hedgers_[shard->stream_id()]) {
+            ok = hedgers_[shard->stream_id()]->Download(remote, remote_path,
+                                                        FetchedPath(local_path), deadline, err);
+        } else {
+            ok = remote->Download(remote_path, FetchedPath(local_path), deadline, err);
+        }
+
+        if (!ok) {
+            if (fused_) {
+                shard->Evict(stream.local(), stream.split());
+            } else {
+                RemoveStaged(shard);
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Downloader::FetchPartial(const Job& job, int64_t deadline, string* err) const {
+    auto shard = dynamic_cast<const MDSShard*>(job.shard);
+    auto& stream = (*streams_)[shard->stream_id()];
+    string remote_path = stream.split() + "/" + shard->raw_data()->path;
+    string local_path = GetDir(stream) + shard->raw_data()->path;
+
+    std::error_code code;
+    fs::create_directories(fs::path(local_path).parent_path(), code);
+
+    return FetchMDSPartial(remotes_[shard->stream_id()], remote_path, local_path, shard,
+                           job.samples, partial_merge_gap_, deadline, err);
+}
+
+bool Downloader::Verify(const Job& job, string* err) const {
+    auto& stream = (*streams_)[job.shard->stream_id()];
+    string dir = GetDir(stream);
+    for (auto& pair : job.shard->file_pairs()) {
+        const FileInfo* info = pair.second ? pair.second : pair.first;
+        string algo;
+        bool is_checked = false;
+        if (stream.ChooseHashAlgo(info, &algo)) {
+            if (!CheckDigest(FetchedPath(dir + info->path), info, algo, err)) {
+                return false;
+            }
+            is_checked = true;
+        }
+
+        // A zip can also be vouched for by its raw digest, which is checked after decompressing.
+        if (!is_checked && pair.second && !stream.unzip_to_memory() &&
+                stream.ChooseHashAlgo(pair.first, &algo)) {
+            is_checked = true;
+        }
+
+        if (!is_checked && !stream.non_hashed_ok()) {
+            *err = StringPrintf("File `%s` can't be hash validated with any of the stream's hash "
+                                "algorithms.", info->path.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Downloader::Decompress(ZSTD_DCtx* ctx, const Job& job, string* err) {
+    auto& stream = (*streams_)[job.shard->stream_id()];
+    if (stream.unzip_to_memory()) {
+        return true;
+    }
+
+    string dir = GetDir(stream);
+    for (auto& pair : job.shard->file_pairs()) {
+        if (!pair.second) {
+            continue;
+        }
+        string raw_path = UnzippedPath(dir + pair.first->path);
+        string zip_path = FetchedPath(dir + pair.second->path);
+        if (!decompressor_.DecompressFile(ctx, stream.zstd_dict(), zip_path, raw_path,
+                                          pair.first->num_bytes, err)) {
+            return false;
+        }
+        string algo;
+        if (stream.ChooseHashAlgo(pair.first, &algo) &&
+                !CheckDigest(raw_path, pair.first, algo, err)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Downloader::Publish(const Job& job, string* err) const {
+    auto shard = job.shard;
+    auto& stream = (*streams_)[shard->stream_id()];
+    string dir = GetDir(stream);
+    for (auto& pair : shard->file_pairs()) {
+        string raw_path = dir + pair.first->path;
+        bool ok;
+        if (!pair.second) {
+            ok = Rename(FetchedPath(raw_path), raw_path, err);
+        } else {
+            string zip_path = dir + pair.second->path;
+            ok = stream.unzip_to_memory() || Rename(UnzippedPath(raw_path), raw_path, err);
+            if (ok && stream.safe_keep_zip()) {
+                ok = Rename(FetchedPath(zip_path), zip_path, err);
+            } else {
+                unlink(FetchedPath(zip_path).c_str());
+            }
+        }
+        if (!ok) {
+            shard->Evict(stream.local(), stream.split());
+            return false;
+        }
+    }
+    return true;
+}
+
+void Downloader::Enqueue(const Job& job) {
+    auto& queue = queues_[job.shard->stream_id()];
+    auto it = jobs_.find(job.shard_id);
+    if (it == jobs_.end()) {
+        // A stream that went idle rejoins at the current virtual time, neither owed nor owing
+        // for the time it had nothing to fetch.
+        if (queue.shards.empty() && queue.finish < virtual_time_) {
+            queue.finish = virtual_time_;
+        }
+        if (!job.num_tries && 0 < job.shard->num_samples()) {
+            queue.num_bytes += GetStoredSize(job.shard);
+            queue.num_samples += job.shard->num_samples();
+        }
+        jobs_[job.shard_id] = job;
+        queue.shards.insert({job.priority, job.shard_id});
+        ++num_queued_;
+        return;
+    }
+
+    auto& queued = it->second;
+    auto first = queued.done;
+    auto second = job.done;
+    queued.done = [first, second](int64_t shard_id, bool ok, const string& err) {
+        first(shard_id, ok, err);
+        second(shard_id, ok, err);
+    };
+    if (queued.samples.empty() || job.samples.empty()) {
+        queued.samples.clear();
+    } else {
+        queued.samples.insert(queued.samples.end(), job.samples.begin(), job.samples.end());
+        std::sort(queued.samples.begin(), queued.samples.end());
+        queued.samples.erase(std::unique(queued.samples.begin(), queued.samples.end()),
+                             queued.samples.end());
+    }
+    queued.is_claimed = queued.is_claimed || job.is_claimed;
+    if (queued.num_tries < job.num_tries) {
+        queued.num_tries = job.num_tries;
+    }
+    if (job.priority < queued.priority) {
+        queue.shards.erase({queued.priority, job.shard_id});
+        queued.priority = job.priority;
+        queue.shards.insert({job.priority, job.shard_id});
+    }
+}
+
+void Downloader::Retry(Job job, const string& err) {
+    RemoveStaged(job.shard);
+    auto& stream = (*streams_)[job.shard->stream_id()];
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (job.num_tries <= stream.download_retry() && !stopping_) {
+            Enqueue(job);
+            cond_.notify_one();
+            return;
+        }
+    }
+    Finish(job, false, StringPrintf("Giving up after %ld tries: %s", job.num_tries,
+                                    err.c_str()));
+}
+
+void Downloader::Finish(const Job& job, bool ok, const string& err) {
+    bool is_whole = job.samples.empty();
+    if (!ok) {
+        RemoveStaged(job.shard);
+    } else if (is_whole) {
+        string dir = GetDir((*streams_)[job.shard->stream_id()]);
+        for (auto& pair : job.shard->file_pairs()) {
+            PartialFile::Remove(dir + pair.first->path);
+            RemovePart(dir + (pair.second ? pair.second : pair.first)->path);
+        }
+    }
+
+    // A partial shard stays absent as far as other processes are concerned.
+    if (job.is_claimed) {
+        states_->EndDownload(job.shard_id, ok && is_whole);
+    }
+    job.done(job.shard_id, ok, err);
+}
+
+void Downloader::RemoveStaged(const Shard* shard) const {
+    string dir = GetDir((*streams_)[shard->stream_id()]);
+    for (auto& pair : shard->file_pairs()) {
+        unlink(FetchedPath(dir + pair.first->path).c_str());
+        unlink(UnzippedPath(dir + pair.first->path).c_str());
+        if (pair.second) {
+            unlink(FetchedPath(dir + pair.second->path).c_str());
+        }
+    }
+}
+
+}  // namespace xtreaming
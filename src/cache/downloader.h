@@ -0,0 +1,226 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base/bounded_queue.h"
+#include "base/json.h"
+#include "base/logger.h"
+#include "base/zip/zstd.h"
+#include "cache/concurrency.h"
+#include "cache/decompressor.h"
+#include "cache/hedge.h"
+#include "cache/shard_states.h"
+#include "remote/remote.h"
+#include "serial/base/shard.h"
+#include "stream.h"
+
+using std::function;
+using std::pair;
+using std::set;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace xtreaming {
+
+// Called from a worker thread when a shard has been downloaded (or failed to be), or from Stop()
+// when it is cancelled.
+typedef function<void(int64_t shard_id, bool ok, const string& err)> DownloadDone;
+
+// Pipeline of thread pools that fetch shards from their streams' remotes into the local cache.
+//
+// Each shard passes through four stages. Every stage has its own threads and a bounded queue to
+// the next, so network transfer, hashing and zstd work on different shards overlap:
+// * Fetch: claim the shard in the node's shard state table (if shared), then copy its stored
+//   files (the zips, if zipped) next to where they go, each try bounded by `download_timeout`.
+// * Verify: hash the fetched files with the stream's chosen algorithm.
+// * Decompress: unzip to raw files (unless unzipping to memory) on a Decompressor, checking any
+//   raw digests.
+// * Publish: rename everything into place, drop zips we don't keep, and report.
+// Fetching is retried in place. A shard that fails a later stage goes back to be fetched again.
+// Either way, a shard gets at most `download_retry` + 1 tries. A fused download does the middle
+// stages in the fetch stage's one pass, and a partial one (see PartialFile) reports right after
+// fetching.
+//
+// Shards wait to be fetched in a queue per stream, in order of priority, which is the earliest plan
+// position (in samples) that needs them, lowest first. Until a shard is started, its priority can
+// be changed or it can be cancelled outright, so that shards needed soon never wait behind shards
+// needed much later. How the streams share fetching, how many fetches run at once, and how they
+// are resumed, hedged and batched is configured in Init().
+class Downloader {
+  public:
+    // Stops and joins the threads, frees the remotes and hedgers.
+    ~Downloader();
+
+    // Configure the stages from the `downloader` section, set up a backend per stream, and start
+    // the threads. A stream whose remote we can't use is warned about, and its shards can then only
+    // be read if already cached. The node's shard state table is optional.
+    bool Init(const json& obj, const vector<Stream>* streams, ShardStates* states, Logger* logger,
+              string* err);
+
+    // Queue a shard for download at the given priority (lower goes first). If the shard is already
+    // queued, it keeps the more urgent priority and both callbacks are called.
+    void Submit(int64_t shard_id, const Shard* shard, int64_t priority, DownloadDone done);
+
+    // Likewise, but only the given samples (indices within the shard) are needed. The shard is
+    // fetched whole if it can't be fetched partially, or if it is or gets queued whole as well.
+    void SubmitPartial(int64_t shard_id, const Shard* shard, const vector<int64_t>& samples,
+                       int64_t priority, DownloadDone done);
+
+    // Note the consumer's position in its plan, in the units of priorities. Queued shards at or
+    // before it are fetched ahead of all others, as the consumer is waiting on them.
+    void Advance(int64_t position);
+
+    // Change the priority of a queued shard. Returns whether it was still queued.
+    bool Reprioritize(int64_t shard_id, int64_t priority);
+
+    // Drop a queued shard without calling its callback. Returns whether it was still queued (as
+    // opposed to started or never submitted).
+    bool Cancel(int64_t shard_id);
+
+    // Number of shards waiting to be fetched.
+    int64_t num_queued() const;
+
+    // Whether Stop() has been called, after which failures are mostly cancellations.
+    bool is_stopping() const;
+
+    // Cancel shards not yet started, failing their callbacks, then let those under way finish
+    // their stages and join the threads.
+    void Stop();
+
+    // Log each stage's threads in use, queue depth and time spent busy.
+    void LogStats() const;
+
+  private:
+    // A shard making its way through the stages.
+    struct Job {
+        int64_t shard_id;
+        const Shard* shard;
+        int64_t priority;
+        DownloadDone done;
+        vector<int64_t> samples;  // Samples to fetch partially, or empty for the whole shard.
+        int64_t num_tries{0};     // Fetches so far.
+        bool is_claimed{false};   // Whether we hold its claim in the shard state table.
+        bool is_landed{false};    // Whether it was fused (or partially fetched) into place, leaving
+                                  // just publishing.
+    };
+
+    // Threads and activity of one stage.
+    struct Stage {
+        string name;                       // Used in stats.
+        vector<std::thread> threads;       // Its threads.
+        std::atomic<int64_t> num_busy{0};  // Threads working on a shard right now.
+        std::atomic<int64_t> busy_ns{0};   // Total time threads spent working.
+        std::atomic<int64_t> num_jobs{0};  // Shards handled.
+    };
+
+    // Fetch queue of one stream, and its standing in fair queuing.
+    struct StreamQueue {
+        set<pair<int64_t, int64_t>> shards;  // Shards to fetch as (priority, shard ID), most urgent
+                                             // first.
+        int64_t num_bytes{0};                // Stored bytes of the shards submitted so far.
+        int64_t num_samples{0};              // Samples in them.
+        double finish{0};                    // Virtual time its fetches so far take it to.
+    };
+
+    // Start fetch threads until there is one per fetch the limit allows in flight. Requires the
+    // lock.
+    void AddFetchThreads();
+
+    // Stage thread bodies.
+    void FetchThread();
+    void VerifyThread();
+    void PublishThread();
+    void StatsThread();
+
+    // Pick the stream to fetch from next, or -1 if none are waiting. Requires the lock.
+    int64_t PickStream() const;
+
+    // Advance a stream's virtual time for fetching `num_bytes` of it. Requires the lock.
+    void Charge(int64_t stream_id, int64_t num_bytes);
+
+    // Whether a shard can be fetched in a batch with others.
+    bool IsCoalescible(const Job& job) const;
+
+    // Fetch a batch of small shards from one stream, passing each on to the next stage.
+    void FetchBatch(ZSTD_DCtx* ctx, vector<Job>* batch);
+
+    // Decompress stage for one shard, run on the decompressor's threads.
+    void RunDecompress(ZSTD_DCtx* ctx, const Job& job);
+
+    // Pass a fetched (or failed) shard on.
+    void Forward(const Job& job, bool ok, const string& err);
+
+    // Record a fetch attempt with the concurrency limit, waking fetchers if it rose.
+    void RecordFetch(int64_t num_bytes, int64_t latency_ns);
+
+    // Stage work for one shard. On failure, the shard's files are left absent.
+    bool Fetch(ZSTD_DCtx* ctx, Job* job, string* err);
+    bool FetchOnce(ZSTD_DCtx* ctx, const Job& job, int64_t deadline, string* err) const;
+    bool FetchPartial(const Job& job, int64_t deadline, string* err) const;
+    bool Verify(const Job& job, string* err) const;
+    bool Decompress(ZSTD_DCtx* ctx, const Job& job, string* err);
+    bool Publish(const Job& job, string* err) const;
+
+    // Add a job to the fetch queue, merging it with the shard's queued job if any. Requires the
+    // lock.
+    void Enqueue(const Job& job);
+
+    // Send a shard that failed after fetching back to be fetched again, or give up on it.
+    void Retry(Job job, const string& err);
+
+    // Report a shard's outcome, releasing its claim and cleaning up on failure.
+    void Finish(const Job& job, bool ok, const string& err);
+
+    // Remove a shard's intermediate files.
+    void RemoveStaged(const Shard* shard) const;
+
+    const vector<Stream>* streams_{nullptr};  // Streams, which shards refer to by ID.
+    vector<Remote*> remotes_;                 // Backend per stream, or null if unusable.
+    vector<Hedger*> hedgers_;                 // Hedging per stream, or null if off.
+    ShardStates* states_{nullptr};            // Node's shard state table, if shared.
+    Logger* logger_{nullptr};                 // Takes stats.
+    bool fused_{false};                       // Whether to fetch in one fused pass.
+    int64_t partial_merge_gap_{0};            // Max bytes between sample ranges fetched together.
+    int64_t resume_size_{0};                  // Min bytes of files to fetch resumably (0 for off).
+    int64_t coalesce_size_{0};                // Max stored bytes of shards to batch (0 for off).
+    int64_t coalesce_count_{0};               // Max shards per batch.
+    bool fair_{false};                        // Whether to share fetching fairly across streams.
+    double stats_interval_{0};                // Seconds between stats logs (0 for never).
+
+    // Stages, in order. Fetch threads are added as the limit rises, under the lock.
+    Stage fetch_;
+    Stage verify_;
+    Stage decompress_;
+    Stage publish_;
+
+    BoundedQueue<Job> verify_queue_;   // Fetched, to verify.
+    Decompressor decompressor_;        // Verified, to decompress, and the threads that do.
+    BoundedQueue<Job> publish_queue_;  // Ready (or fused into place), to publish.
+
+    mutable std::mutex mutex_;           // Guards the below.
+    std::condition_variable cond_;       // Signaled on new work or stop.
+    vector<StreamQueue> queues_;         // Fetch queue per stream.
+    int64_t num_queued_{0};              // Shards in them.
+    double virtual_time_{0};             // Virtual time of the latest fetch started.
+    int64_t position_{0};                // Consumer's position, up to which shards are urgent.
+    unordered_map<int64_t, Job> jobs_;   // Shards to fetch by shard ID.
+    int64_t num_fetching_{0};            // Fetch threads working on a shard.
+    ConcurrencyLimit limit_;             // How many of them may be.
+    bool stopping_{false};               // Whether to cancel queued shards and exit.
+
+    std::condition_variable stats_cond_;  // Signaled on stop, to wake the stats thread.
+    std::thread stats_thread_;            // Logs stats now and then.
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,205 @@
+#include "file_cache.h"
+
+#include <cassert>
+
+#include "base/string.h"
+#include "base/zip/zstd.h"
+#include "cache/verifier.h"
+
+namespace xtreaming {
+
+FileCache::~FileCache() {
+    for (auto& it : entries_) {
+        Close(it.second);
+    }
+}
+
+void FileCache::Init(int64_t max_files, int64_t max_bytes, MemoryCache* memory_cache) {
+    max_files_ = max_files;
+    max_bytes_ = max_bytes;
+    memory_cache_ = memory_cache;
+}
+
+void FileCache::Close(FileCacheEntry* entry) {
+    for (auto& file : entry->files) {
+        delete file;
+    }
+    if (entry->is_shared) {
+        memory_cache_->Release(entry->shard_id);
+    }
+    delete entry;
+}
+
+bool FileCache::Acquire(int64_t shard_id, const Shard* shard, const Stream& stream,
+                        const FileCacheEntry** entry, string* err) {
+    int64_t num_evictions;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(shard_id);
+        if (it != entries_.end()) {
+            auto got = it->second;
+            ++got->num_pins;
+            lru_.splice(lru_.begin(), lru_, got->lru_it);
+            *entry = got;
+            return true;
+        }
+        num_evictions = GetNumEvictions(shard_id);
+        if (num_evictions % 2) {
+            *err = StringPrintf("Shard %ld is being evicted.", shard_id);
+            return false;
+        }
+    }
+
+    // Miss: open and map outside the lock, from the node's memory cache if it takes the shard.
+    auto got = new FileCacheEntry;
+    got->shard_id = shard_id;
+    if (memory_cache_) {
+        if (!memory_cache_->Acquire(shard_id, &got->files, err)) {
+            delete got;
+            return false;
+        }
+        got->is_shared = !got->files.empty();
+    }
+
+    // Otherwise map our own. When unzipping to memory, the raw files only exist as the anonymous
+    // memory we decompress the zips into here.
+    bool to_memory = stream.unzip_to_memory() && !shard->zip_algo().empty();
+    string dir = stream.local() + "/" + stream.split() + "/";
+    for (int64_t i = got->files.size(); i < shard->file_pairs().size(); ++i) {
+        auto& pair = shard->file_pairs()[i];
+        auto file = new MappedFile;
+        bool ok;
+        if (to_memory) {
+            ok = ZstdDecompressToMemory(GetThreadZstdDCtx(), stream.zstd_dict(),
+                                        dir + pair.second->path, file, err) &&
+                VerifyInMemory(stream, pair.first, *file, err);
+        } else {
+            ok = file->Open(dir + pair.first->path, err);
+        }
+        if (!ok) {
+            delete file;
+            Close(got);
+            return false;
+        }
+        got->files.emplace_back(file);
+    }
+    for (auto& file : got->files) {
+        got->num_bytes += file->size();
+    }
+    got->num_pins = 1;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // If the shard was evicted while we opened it, even partly, what we mapped may be its deleted
+    // files.
+    if (GetNumEvictions(shard_id) != num_evictions) {
+        Close(got);
+        *err = StringPrintf("Shard %ld was evicted while its files were being opened.", shard_id);
+        return false;
+    }
+
+    // Another thread may have raced us to it, in which case use theirs.
+    auto it = entries_.find(shard_id);
+    if (it != entries_.end()) {
+        Close(got);
+        got = it->second;
+        ++got->num_pins;
+        lru_.splice(lru_.begin(), lru_, got->lru_it);
+        *entry = got;
+        return true;
+    }
+
+    lru_.emplace_front(shard_id);
+    got->lru_it = lru_.begin();
+    entries_[shard_id] = got;
+    num_files_ += got->files.size();
+    num_bytes_ += got->num_bytes;
+    Trim();
+    *entry = got;
+    return true;
+}
+
+void FileCache::Release(const FileCacheEntry* entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto got = const_cast<FileCacheEntry*>(entry);
+    assert(0 < got->num_pins);
+    --got->num_pins;
+    if (got->num_pins) {
+        return;
+    }
+    if (got->dropped) {
+        Close(got);
+    } else {
+        Trim();
+    }
+}
+
+void FileCache::Remove(FileCacheEntry* entry) {
+    entries_.erase(entry->shard_id);
+    lru_.erase(entry->lru_it);
+    num_files_ -= entry->files.size();
+    num_bytes_ -= entry->num_bytes;
+    if (entry->num_pins) {
+        entry->dropped = true;
+    } else {
+        Close(entry);
+    }
+}
+
+void FileCache::Trim() {
+    auto over = [this] {
+        return (0 <= max_files_ && max_files_ < num_files_) ||
+            (0 <= max_bytes_ && max_bytes_ < num_bytes_);
+    };
+    auto it = lru_.end();
+    while (over() && it != lru_.begin()) {
+        --it;
+        auto entry = entries_[*it];
+        if (entry->num_pins) {
+            continue;
+        }
+        ++it;
+        Remove(entry);
+    }
+}
+
+void FileCache::Drop(int64_t shard_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(shard_id);
+    if (it != entries_.end()) {
+        Remove(it->second);
+    }
+}
+
+void FileCache::Evict(int64_t shard_id, const Shard* shard, const Stream& stream) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++num_evictions_[shard_id];
+        auto it = entries_.find(shard_id);
+        if (it != entries_.end()) {
+            Remove(it->second);
+        }
+    }
+    shard->Evict(stream.local(), stream.split());
+
+    // Bumped again once deleted, so that an Acquire() overlapping any of it sees a change.
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++num_evictions_[shard_id];
+}
+
+int64_t FileCache::GetNumEvictions(int64_t shard_id) const {
+    auto it = num_evictions_.find(shard_id);
+    return it == num_evictions_.end() ? 0 : it->second;
+}
+
+int64_t FileCache::num_files() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_files_;
+}
+
+int64_t FileCache::num_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_bytes_;
+}
+
+}  // namespace xtreaming
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/mmap.h"
+#include "cache/memory_cache.h"
+#include "serial/base/shard.h"
+#include "stream.h"
+
+using std::list;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace xtreaming {
+
+// The open, mapped raw files of one shard.
+struct FileCacheEntry {
+    int64_t shard_id{-1L};
+    vector<MappedFile*> files;  // One per raw file of the shard, in `file_pairs()` order.
+    int64_t num_bytes{0};       // Total mapped bytes.
+    int64_t num_pins{0};        // Outstanding Acquire()s.
+    bool dropped{false};        // Removed from the cache while pinned (closed on last Release()).
+    bool is_shared{false};      // Mapped from the node's memory cache, which it holds a pin on.
+    list<int64_t>::iterator lru_it;
+};
+
+// LRU cache of open file descriptors and memory mappings of shard raw files, keyed by shard ID.
+//
+// Reading samples one at a time would otherwise open/mmap/munmap/close a shard's files per
+// sample. Entries are pinned while in use, and unpinned entries are evicted least recently used
+// first when over the open file or mapped byte limits.
+//
+// For streams that unzip to memory, this is also where raw data lives: a miss decompresses the
+// shard's zips into memfds, and mapped bytes are then memory rather than page cache.
+//
+// Given the node's memory cache, a miss maps the shard from there instead, filling it if need be,
+// and falls back to the above only if the shard doesn't fit.
+//
+// Thread-safe.
+class FileCache {
+  public:
+    int64_t max_files() const { return max_files_; }
+    int64_t max_bytes() const { return max_bytes_; }
+
+    // Closes all cached entries.
+    ~FileCache();
+
+    // Initialize with limits on open files and mapped bytes (-1 means unlimited). The memory cache
+    // is optional.
+    void Init(int64_t max_files, int64_t max_bytes, MemoryCache* memory_cache);
+
+    // Get the mapped raw files of a shard, opening them if not cached. Pins the entry until the
+    // matching Release().
+    bool Acquire(int64_t shard_id, const Shard* shard, const Stream& stream,
+                 const FileCacheEntry** entry, string* err);
+
+    // Unpin an entry.
+    void Release(const FileCacheEntry* entry);
+
+    // Drop a shard's entry, if any. If pinned, it is closed on last Release() instead.
+    void Drop(int64_t shard_id);
+
+    // Drop a shard's entry, then delete its files. Use this instead of calling Shard::Evict()
+    // directly, so that no stale descriptors or mappings outlive the files. An Acquire() that was
+    // opening the shard at any point meanwhile fails rather than caching what it opened.
+    void Evict(int64_t shard_id, const Shard* shard, const Stream& stream);
+
+    // Current usage.
+    int64_t num_files() const;
+    int64_t num_bytes() const;
+
+  private:
+    // Close an entry's files, unpinning them in the memory cache if from there, and free it.
+    void Close(FileCacheEntry* entry);
+
+    // Remove an entry from the cache, closing it unless pinned. Requires the lock.
+    void Remove(FileCacheEntry* entry);
+
+    // Evict unpinned entries, least recently used first, until within limits. Requires the lock.
+    void Trim();
+
+    // Get how many times a shard's files have begun or finished being evicted (odd while they are
+    // being deleted). Requires the lock.
+    int64_t GetNumEvictions(int64_t shard_id) const;
+
+    int64_t max_files_{-1L};                           // Limit on open files.
+    int64_t max_bytes_{-1L};                           // Limit on mapped bytes.
+    MemoryCache* memory_cache_{nullptr};               // Node's shared raw shard bytes, if any.
+    mutable std::mutex mutex_;                         // Guards everything below.
+    unordered_map<int64_t, FileCacheEntry*> entries_;  // Shard ID -> cached entry.
+    list<int64_t> lru_;                                // Shard IDs, most recently used first.
+    int64_t num_files_{0};                             // Open files over cached entries.
+    int64_t num_bytes_{0};                             // Mapped bytes over cached entries.
+    unordered_map<int64_t, int64_t> num_evictions_;    // Shard ID -> evictions begun plus finished.
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,227 @@
+#include "fused.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "base/file.h"
+#include "base/string.h"
+
+namespace xtreaming {
+namespace {
+
+// Set up hashing of a file if the stream and index allow it.
+bool InitHasher(const Stream& stream, const FileInfo* info, Hasher** hasher, string* digest,
+                string* err) {
+    string algo;
+    if (!stream.ChooseHashAlgo(info, &algo)) {
+        return true;
+    }
+    if (!HexToBytes(info->hashes.at(algo), digest)) {
+        *err = StringPrintf("Malformed `%s` digest of `%s` in index.", algo.c_str(),
+                            info->path.c_str());
+        return false;
+    }
+    *hasher = NewHasher(algo);
+    return true;
+}
+
+int OpenTemp(const string& path, string* err) {
+    string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        *err = StringPrintf("Unable to open file: `%s` (%s).", tmp_path.c_str(), strerror(errno));
+    }
+    return fd;
+}
+
+}  // namespace
+
+FusedSink::~FusedSink() {
+    Cleanup();
+}
+
+bool FusedSink::Init(const Stream& stream, const FileInfo* raw_info, const FileInfo* zip_info,
+                     ZSTD_DCtx* ctx, string* err) {
+    raw_info_ = raw_info;
+    zip_info_ = zip_info;
+    string dir = stream.local() + "/" + stream.split() + "/";
+    raw_path_ = dir + raw_info->path;
+
+    // Hash whatever we fetch, and also the decompressed output if there is a raw digest.
+    const FileInfo* in_info = zip_info ? zip_info : raw_info;
+    if (!InitHasher(stream, in_info, &in_hasher_, &in_digest_, err)) {
+        return false;
+    }
+    to_memory_ = zip_info && stream.unzip_to_memory();
+    if (zip_info && !to_memory_ &&
+            !InitHasher(stream, raw_info, &raw_hasher_, &raw_digest_, err)) {
+        return false;
+    }
+    if (!in_hasher_ && !raw_hasher_ && !stream.non_hashed_ok()) {
+        *err = StringPrintf("File `%s` can't be hash validated with any of the stream's hash "
+                            "algorithms.", in_info->path.c_str());
+        return false;
+    }
+
+    if (zip_info && stream.safe_keep_zip()) {
+        zip_path_ = dir + zip_info->path;
+        zip_fd_ = OpenTemp(zip_path_, err);
+        if (zip_fd_ == -1) {
+            Cleanup();
+            return false;
+        }
+    }
+
+    // When unzipping to memory, the zip is all that lands on disk.
+    if (to_memory_) {
+        return true;
+    }
+
+    if (zip_info) {
+        ctx_ = ctx;
+        ZSTD_DCtx_reset(ctx_, ZSTD_reset_session_only);
+        ZSTD_DCtx_refDDict(ctx_, stream.zstd_dict());
+        out_buf_.resize(ZSTD_DStreamOutSize());
+    }
+
+    raw_fd_ = OpenTemp(raw_path_, err);
+    if (raw_fd_ == -1) {
+        Cleanup();
+        return false;
+    }
+
+    return true;
+}
+
+bool FusedSink::Emit(const char* data, size_t size, string* err) {
+    if (raw_hasher_) {
+        raw_hasher_->Update(data, size);
+    }
+    if (!WriteAll(raw_fd_, data, size)) {
+        *err = StringPrintf("Unable to write file: `%s.tmp` (%s).", raw_path_.c_str(),
+                            strerror(errno));
+        return false;
+    }
+    num_raw_bytes_ += size;
+    return true;
+}
+
+bool FusedSink::Write(const char* data, int64_t size, string* err) {
+    num_in_bytes_ += size;
+    if (in_hasher_) {
+        in_hasher_->Update(data, size);
+    }
+
+    if (zip_fd_ != -1 && !WriteAll(zip_fd_, data, size)) {
+        *err = StringPrintf("Unable to write file: `%s.tmp` (%s).", zip_path_.c_str(),
+                            strerror(errno));
+        return false;
+    }
+
+    if (to_memory_) {
+        return true;
+    }
+
+    if (!ctx_) {
+        return Emit(data, size, err);
+    }
+
+    ZSTD_inBuffer input = {data, (size_t)size, 0};
+    while (input.pos < input.size) {
+        ZSTD_outBuffer output = {out_buf_.data(), out_buf_.size(), 0};
+        zstd_ret_ = ZSTD_decompressStream(ctx_, &output, &input);
+        if (ZSTD_isError(zstd_ret_)) {
+            *err = StringPrintf("Unable to decompress `%s`: %s.", zip_info_->path.c_str(),
+                                ZSTD_getErrorName(zstd_ret_));
+            return false;
+        }
+        if (!Emit(out_buf_.data(), output.pos, err)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FusedSink::Close(string* err) {
+    const FileInfo* in_info = zip_info_ ? zip_info_ : raw_info_;
+    bool ok = true;
+    if (ctx_ && zstd_ret_) {
+        *err = StringPrintf("Truncated zstd file: `%s`.", in_info->path.c_str());
+        ok = false;
+    } else if (num_in_bytes_ != in_info->num_bytes) {
+        *err = StringPrintf("Fetched %ld bytes of `%s`, but the index says %ld.", num_in_bytes_,
+                            in_info->path.c_str(), in_info->num_bytes);
+        ok = false;
+    } else if (!to_memory_ && num_raw_bytes_ != raw_info_->num_bytes) {
+        *err = StringPrintf("Got %ld bytes of `%s`, but the index says %ld.", num_raw_bytes_,
+                            raw_info_->path.c_str(), raw_info_->num_bytes);
+        ok = false;
+    } else if (in_hasher_ && in_hasher_->Digest() != in_digest_) {
+        *err = StringPrintf("Hash mismatch on `%s`.", in_info->path.c_str());
+        ok = false;
+    } else if (raw_hasher_ && raw_hasher_->Digest() != raw_digest_) {
+        *err = StringPrintf("Hash mismatch on `%s`.", raw_info_->path.c_str());
+        ok = false;
+    }
+
+    // Land the zip first, so that a raw file is never present without its kept zip.
+    for (auto pair : {make_pair(&zip_fd_, &zip_path_), make_pair(&raw_fd_, &raw_path_)}) {
+        int* fd = pair.first;
+        if (*fd == -1) {
+            continue;
+        }
+        const string& path = *pair.second;
+        string tmp_path = path + ".tmp";
+        if (close(*fd) && ok) {
+            *err = StringPrintf("Unable to write file: `%s` (%s).", tmp_path.c_str(),
+                                strerror(errno));
+            ok = false;
+        }
+        *fd = -1;
+        if (ok && rename(tmp_path.c_str(), path.c_str())) {
+            *err = StringPrintf("Unable to rename `%s` to `%s` (%s).", tmp_path.c_str(),
+                                path.c_str(), strerror(errno));
+            ok = false;
+        }
+        if (!ok) {
+            unlink(tmp_path.c_str());
+        }
+    }
+
+    if (!ok && !zip_path_.empty()) {
+        unlink(zip_path_.c_str());
+    }
+    Cleanup();
+    return ok;
+}
+
+void FusedSink::Abort() {
+    Cleanup();
+}
+
+void FusedSink::Cleanup() {
+    if (raw_fd_ != -1) {
+        close(raw_fd_);
+        unlink((raw_path_ + ".tmp").c_str());
+        raw_fd_ = -1;
+    }
+    if (zip_fd_ != -1) {
+        close(zip_fd_);
+        unlink((zip_path_ + ".tmp").c_str());
+        zip_fd_ = -1;
+    }
+    if (in_hasher_) {
+        delete in_hasher_;
+        in_hasher_ = nullptr;
+    }
+    if (raw_hasher_) {
+        delete raw_hasher_;
+        raw_hasher_ = nullptr;
+    }
+}
+
+}  // namespace xtreaming
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "base/hash/hash.h"
+#include "base/sink.h"
+#include "base/zip/zstd.h"
+#include "serial/base/shard.h"
+#include "stream.h"
+
+using std::string;
+using std::vector;
+
+namespace xtreaming {
+
+// Receives one fetched shard file and lands it in the cache in a single pass over memory.
+//
+// Fetched bytes are hashed with the stream's chosen algorithm and (if compressed) fed straight
+// into ZSTD_decompressStream. Decompressed output is hashed inline when the index has a raw digest
+// too, and written to a temp file that is renamed into place only if every check passes. The zip
+// is only written out if the stream keeps zips. If the stream unzips to memory, only the zip is
+// written, and decompression is left to whoever reads the shard.
+class FusedSink : public ByteSink {
+  public:
+    virtual ~FusedSink() override;
+
+    // Prepare to receive the zip file of the pair if it has one, else its raw file. `ctx` is
+    // required when there is a zip file.
+    bool Init(const Stream& stream, const FileInfo* raw_info, const FileInfo* zip_info,
+              ZSTD_DCtx* ctx, string* err);
+
+    virtual bool Write(const char* data, int64_t size, string* err) override;
+    virtual bool Close(string* err) override;
+    virtual void Abort() override;
+
+  private:
+    // Hash and write decompressed (or uncompressed) output.
+    bool Emit(const char* data, size_t size, string* err);
+
+    // Close and remove temp files, free hashers.
+    void Cleanup();
+
+    const FileInfo* raw_info_{nullptr};  // What the raw file should be.
+    const FileInfo* zip_info_{nullptr};  // What the zip file should be, if any.
+    string raw_path_;                    // Final raw file path.
+    string zip_path_;                    // Final zip file path, if keeping it.
+    int raw_fd_{-1};                     // Raw temp file.
+    int zip_fd_{-1};                     // Zip temp file, if keeping it.
+    bool to_memory_{false};              // Just store the zip (unzipping to memory).
+    ZSTD_DCtx* ctx_{nullptr};            // Borrowed decompression context, if zipped.
+    vector<char> out_buf_;               // Decompression output buffer.
+    size_t zstd_ret_{0};                 // Last ZSTD_decompressStream return (0 = frame done).
+    Hasher* in_hasher_{nullptr};         // Hashes the fetched bytes, if the index allows.
+    string in_digest_;                   // Expected raw digest of the fetched bytes.
+    Hasher* raw_hasher_{nullptr};        // Hashes decompressed output, if zipped and allowed.
+    string raw_digest_;                  // Expected raw digest of the decompressed output.
+    int64_t num_in_bytes_{0};            // Fetched bytes so far.
+    int64_t num_raw_bytes_{0};           // Raw bytes written so far.
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,295 @@
+#include "hedge.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "base/file.h"
+#include "base/string.h"
+#include "base/time.h"
+
+namespace xtreaming {
+namespace {
+
+const int64_t kWindow = 128;     // Recent latencies kept.
+const int64_t kMinSamples = 16;  // Latencies needed before hedging.
+const double kMaxTokens = 10;    // Most hedges that can be saved up.
+
+}  // namespace
+
+// Copies of one download racing to land the file.
+struct Hedger::Race {
+    std::mutex mutex;                  // Guards the below.
+    std::condition_variable cond;      // Signaled when a copy finishes.
+    std::atomic<bool> is_over{false};  // Whether one has won, so the others should stop.
+    int64_t num_running{0};            // Copies still going.
+    int64_t winner{-1};                // Which copy landed the file, if any.
+    string err;                        // First error, if they all fail.
+};
+
+namespace {
+
+// Writes a copy of a download to its own temporary path, giving up once another has won.
+class RaceSink : public ByteSink {
+  public:
+    RaceSink(const std::atomic<bool>* is_over) : is_over_(is_over) {
+    }
+
+    ~RaceSink() {
+        if (fd_ != -1) {
+            Abort();
+        }
+    }
+
+    bool Init(const string& path, string* err) {
+        path_ = path;
+        fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ == -1) {
+            *err = StringPrintf("Unable to open file: `%s` (%s).", path.c_str(), strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    virtual bool Write(const char* data, int64_t size, string* err) override {
+        if (is_over_->load()) {
+            *err = StringPrintf("Cancelled writing `%s`: another copy finished first.",
+                                path_.c_str());
+            return false;
+        }
+        if (!WriteAll(fd_, data, size)) {
+            *err = StringPrintf("Unable to write file: `%s` (%s).", path_.c_str(),
+                                strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    virtual bool Close(string* err) override {
+        int fd = fd_;
+        fd_ = -1;
+        if (close(fd)) {
+            *err = StringPrintf("Unable to write file: `%s` (%s).", path_.c_str(),
+                                strerror(errno));
+            unlink(path_.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    virtual void Abort() override {
+        if (fd_ != -1) {
+            close(fd_);
+            fd_ = -1;
+        }
+        unlink(path_.c_str());
+    }
+
+  private:
+    const std::atomic<bool>* is_over_;  // Whether to give up.
+    string path_;                       // Where it is written.
+    int fd_{-1};                        // Open file.
+};
+
+}  // namespace
+
+int64_t Hedger::num_downloads() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_downloads_;
+}
+
+int64_t Hedger::num_hedged() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_hedged_;
+}
+
+int64_t Hedger::num_won() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_won_;
+}
+
+Hedger::~Hedger() {
+    Wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    watch_cond_.notify_all();
+    if (watch_thread_.joinable()) {
+        watch_thread_.join();
+    }
+}
+
+void Hedger::Init(double percentile, double budget) {
+    percentile_ = percentile;
+    budget_ = budget;
+    watch_thread_ = std::thread(&Hedger::WatchThread, this);
+}
+
+bool Hedger::Download(const Remote* remote, const string& path, const string& local_path,
+                      int64_t deadline, string* err) {
+    int64_t start = NanoTime();
+    int64_t threshold;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++num_downloads_;
+        tokens_ = std::min(tokens_ + budget_, kMaxTokens);
+        threshold = tokens_ < 1 ? -1 : GetThresholdNs();
+    }
+
+    // Nothing to race against: take the remote's fastest way.
+    bool ok;
+    if (threshold < 0) {
+        ok = remote->Download(path, local_path, deadline, err);
+    } else {
+        auto race = std::make_shared<Race>();
+        race->num_running = 1;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            timers_.emplace(start + threshold, Timer{race, remote, path, local_path, deadline});
+        }
+        watch_cond_.notify_all();
+        Start(race, 0, remote, path, local_path, deadline);
+
+        // Return as soon as either copy lands the file, leaving a loser to wind down on its own.
+        std::unique_lock<std::mutex> lock(race->mutex);
+        race->cond.wait(lock, [&] { return 0 <= race->winner || !race->num_running; });
+        ok = 0 <= race->winner;
+        if (!ok) {
+            *err = race->err;
+        } else if (race->winner) {
+            std::lock_guard<std::mutex> self_lock(mutex_);
+            ++num_won_;
+        }
+    }
+
+    if (ok) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int64_t latency = NanoTime() - start;
+        if (latencies_.size() < kWindow) {
+            latencies_.emplace_back(latency);
+        } else {
+            latencies_[next_latency_] = latency;
+            next_latency_ = (next_latency_ + 1) % kWindow;
+        }
+    }
+    return ok;
+}
+
+double Hedger::GetThreshold() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t threshold = GetThresholdNs();
+    return threshold < 0 ? -1 : threshold / 1e9;
+}
+
+void Hedger::Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return !num_threads_; });
+}
+
+int64_t Hedger::GetThresholdNs() const {
+    if (latencies_.size() < kMinSamples) {
+        return -1;
+    }
+    vector<int64_t> sorted = latencies_;
+    auto nth = sorted.begin() + (int64_t)(percentile_ * (sorted.size() - 1));
+    std::nth_element(sorted.begin(), nth, sorted.end());
+    return *nth;
+}
+
+bool Hedger::TakeHedge() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tokens_ < 1) {
+        return false;
+    }
+    tokens_ -= 1;
+    ++num_hedged_;
+    return true;
+}
+
+void Hedger::Hedge(const Timer& timer) {
+    auto& race = timer.race;
+    {
+        std::lock_guard<std::mutex> lock(race->mutex);
+        if (0 <= race->winner || race->num_running != 1 || !TakeHedge()) {
+            return;
+        }
+        ++race->num_running;
+    }
+    Start(race, 1, timer.remote, timer.path, timer.local_path, timer.deadline);
+}
+
+void Hedger::Start(shared_ptr<Race> race, int64_t index, const Remote* remote, const string& path,
+                   const string& local_path, int64_t deadline) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++num_threads_;
+    }
+    std::thread([=] {
+        Run(race, index, remote, path, local_path, deadline);
+        std::lock_guard<std::mutex> lock(mutex_);
+        --num_threads_;
+        cond_.notify_all();
+    }).detach();
+}
+
+void Hedger::WatchThread() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        if (timers_.empty()) {
+            watch_cond_.wait(lock);
+            continue;
+        }
+        auto it = timers_.begin();
+        int64_t now = NanoTime();
+        if (now < it->first) {
+            watch_cond_.wait_for(lock, std::chrono::nanoseconds(it->first - now));
+            continue;
+        }
+        Timer timer = std::move(it->second);
+        timers_.erase(it);
+        lock.unlock();
+        Hedge(timer);
+        lock.lock();
+    }
+}
+
+void Hedger::Run(shared_ptr<Race> race, int64_t index, const Remote* remote, const string& path,
+                 const string& local_path, int64_t deadline) {
+    string tmp_path = StringPrintf("%s.%ld.tmp", local_path.c_str(), index);
+    RaceSink sink(&race->is_over);
+    string err;
+    bool ok = sink.Init(tmp_path, &err) && remote->Fetch(path, &sink, deadline, &err);
+
+    // First to finish lands it. A straggler that made it anyway just cleans up.
+    {
+        std::lock_guard<std::mutex> lock(race->mutex);
+        if (ok && race->winner < 0) {
+            if (rename(tmp_path.c_str(), local_path.c_str())) {
+                err = StringPrintf("Unable to rename `%s` to `%s` (%s).", tmp_path.c_str(),
+                                   local_path.c_str(), strerror(errno));
+                ok = false;
+            } else {
+                race->winner = index;
+                race->is_over = true;
+            }
+        }
+        if (race->winner != index) {
+            unlink(tmp_path.c_str());
+        }
+        if (!ok && race->err.empty()) {
+            race->err = err;
+        }
+        --race->num_running;
+    }
+    race->cond.notify_all();
+}
+
+}  // namespace xtreaming
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "remote/remote.h"
+
+using std::multimap;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace xtreaming {
+
+// Downloads files from one remote, hedging those that run slow.
+//
+// Once a download has taken longer than the `percentile` of recent download latencies, a second
+// copy of it is started alongside. Whichever finishes first lands the file, and the other is
+// cancelled at its next write. Hedges are paid for from a budget that each download adds `budget`
+// to (so at most about that fraction of downloads are hedged, plus a small burst saved up), which
+// keeps a slow remote from being hit with twice the load.
+//
+// Until enough latencies have been seen, or while the budget is spent, files are downloaded
+// plainly. Downloads that could be hedged are streamed through the remote's Fetch instead.
+//
+// Each copy runs on a thread of its own, the first started by the caller and the hedge by a watcher
+// thread once its download is due one. The caller returns as soon as either copy lands the file, so
+// a stalled copy doesn't hold it up; the loser stops at its next write, in the background.
+//
+// Thread-safe.
+class Hedger {
+  public:
+    int64_t num_downloads() const;
+    int64_t num_hedged() const;
+    int64_t num_won() const;
+
+    // Waits for cancelled downloads to wind down, and stops the watcher.
+    ~Hedger();
+
+    // Hedge at the given latency percentile (in (0, 1)), within the given budget per download,
+    // and start the watcher.
+    void Init(double percentile, double budget);
+
+    // Copy a remote file to a local path, which is either absent or complete afterward.
+    bool Download(const Remote* remote, const string& path, const string& local_path,
+                  int64_t deadline, string* err);
+
+    // Latency past which downloads are hedged, in seconds (or -1 if too few seen yet).
+    double GetThreshold() const;
+
+    // Wait for cancelled downloads to wind down.
+    void Wait();
+
+  private:
+    struct Race;
+
+    // A download to hedge, if still running, once its time comes.
+    struct Timer {
+        shared_ptr<Race> race;
+        const Remote* remote;
+        string path;
+        string local_path;
+        int64_t deadline;
+    };
+
+    // Get the hedging threshold in nanoseconds, or -1. Requires the lock.
+    int64_t GetThresholdNs() const;
+
+    // Spend a hedge from the budget, if there is one.
+    bool TakeHedge();
+
+    // Start a hedge of a download whose first copy is still running alone, within budget.
+    void Hedge(const Timer& timer);
+
+    // Start one copy of a download on its own thread.
+    void Start(shared_ptr<Race> race, int64_t index, const Remote* remote, const string& path,
+               const string& local_path, int64_t deadline);
+
+    // Hedge downloads as they come due.
+    void WatchThread();
+
+    // Body of one copy of a download.
+    void Run(shared_ptr<Race> race, int64_t index, const Remote* remote, const string& path,
+             const string& local_path, int64_t deadline);
+
+    double percentile_{0};      // Latency percentile past which to hedge.
+    double budget_{0};          // Hedges earned per download.
+    std::thread watch_thread_;  // Runs WatchThread().
+
+    mutable std::mutex mutex_;            // Guards the below.
+    std::condition_variable cond_;        // Signaled when a copy thread exits.
+    std::condition_variable watch_cond_;  // Signaled when a timer is added, or when stopping.
+    multimap<int64_t, Timer> timers_;     // Downloads to hedge, by when (ns since the epoch).
+    bool stopping_{false};                // Whether the watcher should exit.
+    vector<int64_t> latencies_;           // Recent download latencies in nanoseconds, as a ring.
+    int64_t next_latency_{0};             // Where in the ring the next one goes.
+    double tokens_{0};                    // Hedges we can afford.
+    int64_t num_threads_{0};              // Copy threads still running.
+    int64_t num_downloads_{0};            // Downloads so far.
+    int64_t num_hedged_{0};               // Of which hedged.
+    int64_t num_won_{0};                  // Of which the hedge finished first.
+};
+
+}  // namespace xtreaming
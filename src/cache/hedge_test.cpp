@@ -0,0 +1,103 @@
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "base/file.h"
+#include "base/string.h"
+#include "base/time.h"
+#include "cache/hedge.h"
+#include "remote/all.h"
+
+using std::string;
+using namespace xtreaming;
+
+namespace {
+
+const int64_t kNumFiles = 8;       // Files in the remote.
+const int64_t kSize = 256L << 10;  // Bytes per file.
+
+// Get the contents of a remote file.
+string GetData(int64_t i) {
+    return string(kSize, (char)('a' + i));
+}
+
+// Download every file over and over through a hedger, checking what lands, and that no temporary
+// copies are left behind. Returns the longest a download took once hedging was on, in seconds.
+double DownloadAll(Hedger* hedger, const string& query, int64_t num_rounds) {
+    char tmpl[] = "/tmp/hedge_test.XXXXXX";
+    string dir = mkdtemp(tmpl);
+    for (int64_t i = 0; i < kNumFiles; ++i) {
+        std::ofstream(StringPrintf("%s/%ld.bin", dir.c_str(), i), std::ios::binary) << GetData(i);
+    }
+    string err;
+    auto remote = GetRemote("mock://" + dir + query, &err);
+    assert(remote);
+
+    int64_t deadline = NanoTime() + 60L * 1000 * 1000 * 1000;
+    double max_latency = 0;
+    for (int64_t round = 0; round < num_rounds; ++round) {
+        for (int64_t i = 0; i < kNumFiles; ++i) {
+            string path = StringPrintf("%ld.bin", i);
+            string local_path = StringPrintf("%s/%ld.got", dir.c_str(), i);
+            bool is_hedging = 0 < hedger->GetThreshold();
+            int64_t start = NanoTime();
+            assert(hedger->Download(remote, path, local_path, deadline, &err));
+            double latency = (NanoTime() - start) / 1e9;
+            if (is_hedging && max_latency < latency) {
+                max_latency = latency;
+            }
+            string got;
+            assert(ReadFile(local_path, &got));
+            assert(got == GetData(i));
+            unlink(local_path.c_str());
+        }
+    }
+    hedger->Wait();
+    for (int64_t i = 0; i < kNumFiles; ++i) {
+        for (int64_t index = 0; index < 2; ++index) {
+            struct stat info;
+            string tmp_path = StringPrintf("%s/%ld.got.%ld.tmp", dir.c_str(), i, index);
+            assert(stat(tmp_path.c_str(), &info));
+        }
+    }
+
+    delete remote;
+    string cmd = "rm -rf " + dir;
+    assert(!system(cmd.c_str()));
+    return max_latency;
+}
+
+// Some requests stall partway, so their downloads run far past the median and get hedged, and the
+// hedges (fresh requests, which mostly don't stall) win. The caller gets the file as soon as a
+// hedge lands it, well before the stalled copy would have.
+void TestHedge() {
+    Hedger hedger;
+    hedger.Init(0.5, 1);
+    double max_latency = DownloadAll(&hedger, "?latency=1ms&stall_rate=0.1&stall=2s", 8);
+    assert(max_latency < 1);
+    assert(hedger.num_downloads() == 8 * kNumFiles);
+    assert(0 < hedger.GetThreshold());
+    assert(hedger.num_hedged());
+    assert(hedger.num_won());
+    assert(hedger.num_won() <= hedger.num_hedged());
+}
+
+// Without budget, nothing is hedged however slow.
+void TestNoBudget() {
+    Hedger hedger;
+    hedger.Init(0.5, 0);
+    DownloadAll(&hedger, "?latency=1ms&stall_rate=0.1&stall=10ms", 4);
+    assert(!hedger.num_hedged());
+}
+
+}  // namespace
+
+int main() {
+    TestHedge();
+    TestNoBudget();
+}
@@ -0,0 +1,281 @@
+#include "memory_cache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "base/file.h"
+#include "base/shmem/futex.h"
+#include "base/string.h"
+#include "base/zip/zstd.h"
+#include "cache/verifier.h"
+
+namespace xtreaming {
+namespace {
+
+const uint64_t kMagic = 0x6d656d6f72790001UL;  // "memory", version 1.
+const uint32_t kStateMask = 3;                  // State bits of a word.
+const int kStateBits = 2;                       // Where pins or the owner's pid start.
+const uint32_t kPin = 1 << kStateBits;          // One pin, in a ready word.
+
+// State of a shard in the cache.
+const uint32_t kAbsent = 0;    // Not cached.
+const uint32_t kFilling = 1;   // Being filled by one process.
+const uint32_t kReady = 2;     // Cached, with its pins above.
+const uint32_t kEvicting = 3;  // Being removed by one process.
+
+void DeleteFiles(vector<MappedFile*>* files) {
+    for (auto& file : *files) {
+        delete file;
+    }
+    files->clear();
+}
+
+}  // namespace
+
+MemoryCache::~MemoryCache() {
+    if (!table_.Detach()) {
+        return;
+    }
+    for (int64_t i = 0; i < header_->num_shards; ++i) {
+        if (entries_[i].word.load() & kStateMask) {
+            for (int64_t j = 0; j < (*shards_)[i]->file_pairs().size(); ++j) {
+                shm_unlink(GetSegmentName(i, j).c_str());
+            }
+        }
+    }
+}
+
+bool MemoryCache::Init(const string& name, int64_t max_bytes, const vector<Shard*>* shards,
+                       const vector<Stream>* streams, string* err) {
+    int64_t num_shards = shards->size();
+    int64_t size = sizeof(Header) + num_shards * sizeof(entries_[0]);
+    if (!table_.Init(name, kMagic, size, err)) {
+        return false;
+    }
+
+    auto header = (Header*)table_.data();
+    if (table_.is_creator()) {
+        header->num_shards = num_shards;
+        header->max_bytes = max_bytes;
+    } else if (header->num_shards != num_shards || header->max_bytes != max_bytes) {
+        *err = StringPrintf("Memory cache `%s` has %ld shards and a budget of %ld bytes, but we "
+                            "have %ld and %ld (left over from a crashed run? if so, remove "
+                            "/dev/shm%s*).", name.c_str(), header->num_shards, header->max_bytes,
+                            num_shards, max_bytes, name.c_str());
+        return false;
+    }
+    table_.Attach();
+
+    header_ = header;
+    entries_ = (Entry*)&header[1];
+    name_ = name;
+    max_bytes_ = max_bytes;
+    shards_ = shards;
+    streams_ = streams;
+    pid_bits_ = (uint32_t)getpid() << kStateBits;
+    return true;
+}
+
+bool MemoryCache::Acquire(int64_t shard_id, vector<MappedFile*>* files, string* err) {
+    auto& entry = entries_[shard_id];
+    uint32_t value = entry.word.load();
+    while (true) {
+        uint32_t state = value & kStateMask;
+        if (state == kReady) {
+            if (!entry.word.compare_exchange_weak(value, value + kPin)) {
+                continue;
+            }
+            entry.is_referenced = 1;
+            ++header_->num_hits;
+            if (!Map(shard_id, files, err)) {
+                Release(shard_id);
+                return false;
+            }
+            return true;
+        }
+        if (state == kAbsent) {
+            if (!entry.word.compare_exchange_weak(value, pid_bits_ | kFilling)) {
+                continue;
+            }
+            return Fill(shard_id, files, err);
+        }
+        Wait(shard_id, value);
+        value = entry.word.load();
+    }
+}
+
+void MemoryCache::Release(int64_t shard_id) {
+    entries_[shard_id].word -= kPin;
+}
+
+int64_t MemoryCache::num_bytes() const {
+    return header_->num_bytes.load();
+}
+
+int64_t MemoryCache::num_hits() const {
+    return header_->num_hits.load();
+}
+
+int64_t MemoryCache::num_fills() const {
+    return header_->num_fills.load();
+}
+
+int64_t MemoryCache::num_evicted() const {
+    return header_->num_evicted.load();
+}
+
+int64_t MemoryCache::num_rejected() const {
+    return header_->num_rejected.load();
+}
+
+string MemoryCache::GetSegmentName(int64_t shard_id, int64_t index) const {
+    return StringPrintf("%s-%ld-%ld", name_.c_str(), shard_id, index);
+}
+
+bool MemoryCache::Fill(int64_t shard_id, vector<MappedFile*>* files, string* err) {
+    auto shard = (*shards_)[shard_id];
+    auto& stream = (*streams_)[shard->stream_id()];
+    int64_t size = 0;
+    for (auto& pair : shard->file_pairs()) {
+        size += pair.first->num_bytes;
+    }
+    if (!MakeRoom(size)) {
+        ++header_->num_rejected;
+        Set(shard_id, kAbsent);
+        return true;
+    }
+    entries_[shard_id].num_bytes = size;
+
+    // Write each raw file into its segment, then map it from there like any other reader would.
+    bool to_memory = stream.unzip_to_memory() && !shard->zip_algo().empty();
+    string dir = stream.local() + "/" + stream.split() + "/";
+    bool ok = true;
+    for (int64_t i = 0; ok && i < shard->file_pairs().size(); ++i) {
+        auto& pair = shard->file_pairs()[i];
+        string name = GetSegmentName(shard_id, i);
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            *err = StringPrintf("Unable to create shared memory: `%s` (%s).", name.c_str(),
+                                strerror(errno));
+            ok = false;
+            break;
+        }
+        if (to_memory) {
+            ok = ZstdDecompressToFd(GetThreadZstdDCtx(), stream.zstd_dict(),
+                                    dir + pair.second->path, fd, name, err);
+        } else {
+            MappedFile raw;
+            ok = raw.Open(dir + pair.first->path, err);
+            if (ok && !WriteAll(fd, raw.data(), raw.size())) {
+                *err = StringPrintf("Unable to write shared memory: `%s` (%s).", name.c_str(),
+                                    strerror(errno));
+                ok = false;
+            }
+        }
+        auto file = new MappedFile;
+        if (!ok) {
+            close(fd);
+        } else if (!file->OpenFd(fd, name, err)) {
+            ok = false;
+        } else if (to_memory) {
+            ok = VerifyInMemory(stream, pair.first, *file, err);
+        } else if (file->size() != pair.first->num_bytes) {
+            *err = StringPrintf("Raw file `%s` of shard %ld is %ld bytes, but expected %ld.",
+                                pair.first->path.c_str(), shard_id, file->size(),
+                                pair.first->num_bytes);
+            ok = false;
+        }
+        files->emplace_back(file);
+    }
+
+    if (!ok) {
+        DeleteFiles(files);
+        Drop(shard_id);
+        Set(shard_id, kAbsent);
+        return false;
+    }
+    entries_[shard_id].is_referenced = 1;
+    ++header_->num_fills;
+    Set(shard_id, kReady | kPin);
+    return true;
+}
+
+bool MemoryCache::Map(int64_t shard_id, vector<MappedFile*>* files, string* err) {
+    for (int64_t i = 0; i < (*shards_)[shard_id]->file_pairs().size(); ++i) {
+        string name = GetSegmentName(shard_id, i);
+        int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (fd == -1) {
+            *err = StringPrintf("Unable to open shared memory: `%s` (%s).", name.c_str(),
+                                strerror(errno));
+            DeleteFiles(files);
+            return false;
+        }
+        auto file = new MappedFile;
+        files->emplace_back(file);
+        if (!file->OpenFd(fd, name, err)) {
+            DeleteFiles(files);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MemoryCache::MakeRoom(int64_t size) {
+    // Count the bytes once they fit, so usage never reads over budget. Two passes of the hand will
+    // do: the first may only clear reference bits that the second then finds still clear.
+    int64_t num_shards = header_->num_shards;
+    for (int64_t i = 0; i <= 2 * num_shards; ++i) {
+        int64_t num_bytes = header_->num_bytes.load();
+        while (num_bytes + size <= max_bytes_) {
+            if (header_->num_bytes.compare_exchange_weak(num_bytes, num_bytes + size)) {
+                return true;
+            }
+        }
+        if (i == 2 * num_shards) {
+            break;
+        }
+
+        int64_t shard_id = header_->hand++ % num_shards;
+        auto& entry = entries_[shard_id];
+        uint32_t value = kReady;
+        if (entry.word.load() != value || entry.is_referenced.exchange(0)) {
+            continue;
+        }
+        if (entry.word.compare_exchange_strong(value, pid_bits_ | kEvicting)) {
+            Drop(shard_id);
+            ++header_->num_evicted;
+            Set(shard_id, kAbsent);
+        }
+    }
+    return false;
+}
+
+void MemoryCache::Drop(int64_t shard_id) {
+    for (int64_t i = 0; i < (*shards_)[shard_id]->file_pairs().size(); ++i) {
+        shm_unlink(GetSegmentName(shard_id, i).c_str());
+    }
+    header_->num_bytes -= entries_[shard_id].num_bytes.exchange(0);
+}
+
+void MemoryCache::Set(int64_t shard_id, uint32_t value) {
+    entries_[shard_id].word.store(value);
+    FutexWakeAll(&entries_[shard_id].word);
+}
+
+void MemoryCache::Wait(int64_t shard_id, uint32_t value) {
+    auto& word = entries_[shard_id].word;
+    FutexWait(&word, value);
+
+    // If its owner died mid-fill or mid-eviction, nobody will finish it, so clean it up ourselves.
+    if (word.load() == value && !IsAlive(value >> kStateBits) &&
+            word.compare_exchange_strong(value, pid_bits_ | kEvicting)) {
+        Drop(shard_id);
+        Set(shard_id, kAbsent);
+    }
+}
+
+}  // namespace xtreaming
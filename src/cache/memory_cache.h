@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "base/mmap.h"
+#include "base/shmem/table.h"
+#include "serial/base/shard.h"
+#include "stream.h"
+
+using std::string;
+using std::vector;
+
+namespace xtreaming {
+
+// Cache of shards' raw bytes in shared memory, within a byte budget, that every process on the node
+// reads from, so that hot shards are neither read from disk nor held once per process.
+//
+// Each cached shard is one shared memory segment per raw file, which readers map. A shard is filled
+// by the first process to miss it, from its raw files, or by decompressing its zips for streams
+// that unzip to memory, while the others wait for it. Segments are counted against the budget by
+// their raw sizes, and a fill that would take usage over it first evicts by the clock algorithm:
+// the hand sweeps the shards, evicting unpinned ones not referenced since its last pass. If it
+// can't make room (everything cached is pinned), the shard isn't cached and the caller reads it on
+// its own instead.
+//
+// The index is a table of per-shard entries in shared memory, addressed by shard ID (which are
+// dense, so no hashing is needed). Each entry's state is one atomic 32-bit word, changed only by
+// compare-and-swap: the state in the low two bits, and above them either the number of pins (when
+// ready) or the pid of the process filling or evicting it. So lookups, pins, and eviction take no
+// locks. Waiters sleep on the word with a futex, and take a shard whose owner died back to absent.
+// Pins held by a process that crashes are not recovered, which only keeps those shards cached. The
+// last process to detach removes the table and every segment.
+//
+// Thread-safe.
+class MemoryCache {
+  public:
+    int64_t max_bytes() const { return max_bytes_; }
+
+    // Detaches, removing the table and segments if we were the last.
+    ~MemoryCache();
+
+    // Create or attach to the named cache with the given budget.
+    bool Init(const string& name, int64_t max_bytes, const vector<Shard*>* shards,
+              const vector<Stream>* streams, string* err);
+
+    // Map a shard's raw files (in `file_pairs()` order) from the cache, filling it first if absent.
+    // Pins the shard until the matching Release(). Gets no files if it can't be cached.
+    bool Acquire(int64_t shard_id, vector<MappedFile*>* files, string* err);
+
+    // Unpin a shard.
+    void Release(int64_t shard_id);
+
+    // Node-wide usage: bytes cached, and counts of hits, fills, evictions, and shards that didn't
+    // fit.
+    int64_t num_bytes() const;
+    int64_t num_hits() const;
+    int64_t num_fills() const;
+    int64_t num_evicted() const;
+    int64_t num_rejected() const;
+
+  private:
+    struct Header {
+        int64_t num_shards;                 // Number of entries that follow.
+        int64_t max_bytes;                  // Budget.
+        std::atomic<int64_t> num_bytes;     // Bytes counted against the budget.
+        std::atomic<int64_t> hand;          // Clock hand, as a count of entries swept.
+        std::atomic<int64_t> num_hits;      // Acquires of a cached shard.
+        std::atomic<int64_t> num_fills;     // Shards filled.
+        std::atomic<int64_t> num_evicted;   // Shards evicted.
+        std::atomic<int64_t> num_rejected;  // Fills given up for lack of room.
+    };
+
+    struct Entry {
+        std::atomic<uint32_t> word;           // State, and pins or owner.
+        std::atomic<uint32_t> is_referenced;  // Clock bit: used since the hand last passed.
+        std::atomic<int64_t> num_bytes;       // Bytes this shard counts against the budget.
+    };
+
+    // Get the name of the segment of one of a shard's raw files.
+    string GetSegmentName(int64_t shard_id, int64_t index) const;
+
+    // Fill a shard that we own, then map and pin it.
+    bool Fill(int64_t shard_id, vector<MappedFile*>* files, string* err);
+
+    // Map a shard's segments.
+    bool Map(int64_t shard_id, vector<MappedFile*>* files, string* err);
+
+    // Count bytes against the budget, evicting to fit. Returns false (counting nothing) if it
+    // can't.
+    bool MakeRoom(int64_t size);
+
+    // Remove a shard's segments and uncount its bytes, once we own it.
+    void Drop(int64_t shard_id);
+
+    // Set a word we own, and wake its waiters.
+    void Set(int64_t shard_id, uint32_t value);
+
+    // Sleep while another process fills or evicts a shard, taking it back if that process died.
+    void Wait(int64_t shard_id, uint32_t value);
+
+    SharedTable table_;                       // Backing table.
+    Header* header_{nullptr};                 // Start of the table.
+    Entry* entries_{nullptr};                 // Per-shard entries, after the header.
+    string name_;                             // Name of the table, which segment names extend.
+    int64_t max_bytes_{-1L};                  // Budget.
+    const vector<Shard*>* shards_{nullptr};   // All shards.
+    const vector<Stream>* streams_{nullptr};  // Streams, which shards refer to by ID.
+    uint32_t pid_bits_{0};                    // Our pid, shifted into place.
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,324 @@
+#include "partial.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "base/file.h"
+#include "base/string.h"
+
+namespace xtreaming {
+namespace {
+
+string DataPath(const string& path) {
+    return path + ".partial";
+}
+
+string RangesPath(const string& path) {
+    return path + ".partial.ranges";
+}
+
+// Writes a fetched range into place in the sparse file.
+class RangeSink : public ByteSink {
+  public:
+    RangeSink(int fd, int64_t offset, const string& path) :
+        fd_(fd), offset_(offset), path_(path) {
+    }
+
+    virtual bool Write(const char* data, int64_t size, string* err) override {
+        while (size) {
+            ssize_t num_written = pwrite(fd_, data, size, offset_);
+            if (num_written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                *err = StringPrintf("Unable to write file: `%s` (%s).", path_.c_str(),
+                                    strerror(errno));
+                return false;
+            }
+            data += num_written;
+            size -= num_written;
+            offset_ += num_written;
+        }
+        return true;
+    }
+
+    virtual bool Close(string*) override {
+        return true;
+    }
+
+    virtual void Abort() override {
+    }
+
+  private:
+    int fd_;          // The sparse file.
+    int64_t offset_;  // Where the next byte goes.
+    string path_;     // For errors.
+};
+
+// Get the parts of `range` not covered by `present` (sorted and merged).
+void Subtract(const pair<int64_t, int64_t>& range, const Ranges& present, Ranges* missing) {
+    int64_t begin = range.first;
+    for (auto& have : present) {
+        if (range.second <= have.first) {
+            break;
+        }
+        if (have.second <= begin) {
+            continue;
+        }
+        if (begin < have.first) {
+            missing->emplace_back(begin, have.first);
+        }
+        begin = have.second;
+        if (range.second <= begin) {
+            return;
+        }
+    }
+    if (begin < range.second) {
+        missing->emplace_back(begin, range.second);
+    }
+}
+
+// Get the ranges listed as present in a file's partial copy, if any, trusting nothing past `size`.
+void LoadRanges(const string& path, int64_t size, Ranges* ranges) {
+    string text;
+    if (!ReadFile(RangesPath(path), &text)) {
+        return;
+    }
+    vector<string> lines;
+    SplitString(text, '\n', &lines);
+    for (auto& line : lines) {
+        int64_t begin;
+        int64_t end;
+        if (sscanf(line.c_str(), "%" SCNd64 " %" SCNd64, &begin, &end) == 2 && 0 <= begin &&
+                begin < end && end <= size) {
+            ranges->emplace_back(begin, end);
+        }
+    }
+    MergeRanges(ranges, 0);
+}
+
+}  // namespace
+
+void MergeRanges(Ranges* ranges, int64_t gap) {
+    std::sort(ranges->begin(), ranges->end());
+    Ranges merged;
+    for (auto& range : *ranges) {
+        if (range.first == range.second) {
+            continue;
+        }
+        if (!merged.empty() && range.first - merged.back().second <= gap) {
+            if (merged.back().second < range.second) {
+                merged.back().second = range.second;
+            }
+        } else {
+            merged.emplace_back(range);
+        }
+    }
+    ranges->swap(merged);
+}
+
+PartialFile::~PartialFile() {
+    if (fd_ != -1) {
+        close(fd_);
+    }
+}
+
+bool PartialFile::Init(const string& path, int64_t size, string* err) {
+    path_ = path;
+    size_ = size;
+
+    string data_path = DataPath(path);
+    fd_ = open(data_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ == -1) {
+        *err = StringPrintf("Unable to open file: `%s` (%s).", data_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Pick up what earlier fetches left.
+    LoadRanges(path, size, &ranges_);
+
+    // Sparse: the gaps take no space.
+    if (ftruncate(fd_, size)) {
+        *err = StringPrintf("Unable to resize file: `%s` (%s).", data_path.c_str(),
+                            strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool PartialFile::Contains(int64_t begin, int64_t end) const {
+    Ranges missing;
+    Subtract({begin, end}, ranges_, &missing);
+    return missing.empty();
+}
+
+bool PartialFile::Fetch(const Remote* remote, const string& remote_path, const Ranges& ranges,
+                        int64_t deadline, string* err) {
+    Ranges missing;
+    for (auto& range : ranges) {
+        Subtract(range, ranges_, &missing);
+    }
+    if (missing.empty()) {
+        return true;
+    }
+
+    // Keep what was fetched even if a later range fails.
+    bool ok = true;
+    int64_t num_fetched = 0;
+    for (auto& range : missing) {
+        RangeSink sink(fd_, range.first, DataPath(path_));
+        if (!remote->FetchRange(remote_path, range.first, range.second - range.first, &sink,
+                                deadline, err)) {
+            ok = false;
+            break;
+        }
+        ++num_fetched;
+    }
+    if (!num_fetched) {
+        return false;
+    }
+
+    ranges_.insert(ranges_.end(), missing.begin(), missing.begin() + num_fetched);
+    MergeRanges(&ranges_, 0);
+    string save_err;
+    if (!Save(ok ? err : &save_err)) {
+        return false;
+    }
+    return ok;
+}
+
+bool PartialFile::Read(int64_t offset, int64_t size, char* data, string* err) const {
+    if (!Contains(offset, offset + size)) {
+        *err = StringPrintf("Bytes %ld to %ld of `%s` have not been fetched.", offset,
+                            offset + size, DataPath(path_).c_str());
+        return false;
+    }
+    while (size) {
+        ssize_t num_read = pread(fd_, data, size, offset);
+        if (num_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (num_read <= 0) {
+            *err = StringPrintf("Unable to read file: `%s` (%s).", DataPath(path_).c_str(),
+                                num_read ? strerror(errno) : "truncated");
+            return false;
+        }
+        data += num_read;
+        size -= num_read;
+        offset += num_read;
+    }
+    return true;
+}
+
+bool PartialFile::Complete(const Remote* remote, const string& remote_path,
+                           const string& full_path, int64_t deadline, string* err) {
+    if (!Fetch(remote, remote_path, {{0, size_}}, deadline, err)) {
+        return false;
+    }
+
+    string data_path = DataPath(path_);
+    if (rename(data_path.c_str(), full_path.c_str())) {
+        *err = StringPrintf("Unable to rename `%s` to `%s` (%s).", data_path.c_str(),
+                            full_path.c_str(), strerror(errno));
+        return false;
+    }
+    unlink(RangesPath(path_).c_str());
+    return true;
+}
+
+bool PartialFile::Exists(const string& path) {
+    struct stat info;
+    return !stat(RangesPath(path).c_str(), &info);
+}
+
+int64_t PartialFile::GetNumBytes(const string& path, int64_t size) {
+    Ranges ranges;
+    LoadRanges(path, size, &ranges);
+    int64_t num_bytes = 0;
+    for (auto& range : ranges) {
+        num_bytes += range.second - range.first;
+    }
+    return num_bytes;
+}
+
+void PartialFile::Remove(const string& path) {
+    unlink(RangesPath(path).c_str());
+    unlink(DataPath(path).c_str());
+}
+
+bool PartialFile::Save(string* err) const {
+    string text;
+    for (auto& range : ranges_) {
+        StringAppendF(&text, "%ld %ld\n", range.first, range.second);
+    }
+
+    string path = RangesPath(path_);
+    string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        *err = StringPrintf("Unable to open file: `%s` (%s).", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = WriteAll(fd, text.data(), text.size());
+    if (close(fd)) {
+        ok = false;
+    }
+    if (!ok || rename(tmp_path.c_str(), path.c_str())) {
+        *err = StringPrintf("Unable to write file: `%s` (%s).", path.c_str(), strerror(errno));
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool CanFetchPartial(const Shard* shard) {
+    auto mds = dynamic_cast<const MDSShard*>(shard);
+    return mds && mds->can_fetch_partial();
+}
+
+bool FetchMDSPartial(const Remote* remote, const string& remote_path, const string& local_path,
+                     const MDSShard* shard, const vector<int64_t>& samples, int64_t merge_gap,
+                     int64_t deadline, string* err) {
+    for (auto& sample : samples) {
+        if (sample < 0 || shard->num_samples() <= sample) {
+            *err = StringPrintf("Sample %ld is out of range for shard `%s` (has %ld samples).",
+                                sample, remote_path.c_str(), shard->num_samples());
+            return false;
+        }
+    }
+
+    PartialFile partial;
+    if (!partial.Init(local_path, shard->raw_data()->num_bytes, err)) {
+        return false;
+    }
+
+    // The header says where each sample is.
+    int64_t header_size = shard->GetHeaderSize();
+    string header;
+    header.resize(header_size);
+    vector<int64_t> offsets;
+    if (!partial.Fetch(remote, remote_path, {{0, header_size}}, deadline, err) ||
+            !partial.Read(0, header_size, &header[0], err)) {
+        return false;
+    }
+    if (!shard->ParseHeader(header.data(), header_size, &offsets, err)) {
+        PartialFile::Remove(local_path);
+        return false;
+    }
+
+    Ranges ranges;
+    for (auto& sample : samples) {
+        ranges.emplace_back(offsets[sample], offsets[sample + 1]);
+    }
+    MergeRanges(&ranges, merge_gap);
+    return partial.Fetch(remote, remote_path, ranges, deadline, err);
+}
+
+}  // namespace xtreaming
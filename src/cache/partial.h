@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "remote/remote.h"
+#include "serial/base/shard.h"
+#include "serial/mds/shard.h"
+
+using std::pair;
+using std::string;
+using std::vector;
+
+namespace xtreaming {
+
+// Byte ranges as (begin, end).
+typedef vector<pair<int64_t, int64_t>> Ranges;
+
+// Sort ranges and merge those at most `gap` bytes apart, trading a little extra data for fewer
+// requests.
+void MergeRanges(Ranges* ranges, int64_t gap);
+
+// Local copy of just some byte ranges of a remote file.
+//
+// Kept as a sparse `<path>.partial` file the full size of the original, with each fetched range at
+// its own offset, next to a `<path>.partial.ranges` file listing the ranges present (one
+// "begin end" per line). The listing is only updated once a range has been written, so a crash
+// leaves at worst some unlisted data. It survives restarts, grows as more ranges are fetched, and
+// can be completed into the full file by fetching the gaps, at which point it can be hash verified
+// as usual.
+class PartialFile {
+  public:
+    const Ranges& ranges() const { return ranges_; }
+
+    // Closes the file.
+    ~PartialFile();
+
+    // Open the partial copy of a file of `size` bytes at `path`, creating it if absent.
+    bool Init(const string& path, int64_t size, string* err);
+
+    // Whether a range is wholly present.
+    bool Contains(int64_t begin, int64_t end) const;
+
+    // Fetch whatever of the given ranges is missing.
+    bool Fetch(const Remote* remote, const string& remote_path, const Ranges& ranges,
+               int64_t deadline, string* err);
+
+    // Read bytes that are present.
+    bool Read(int64_t offset, int64_t size, char* data, string* err) const;
+
+    // Fetch everything missing, then move the now full file to `full_path`.
+    bool Complete(const Remote* remote, const string& remote_path, const string& full_path,
+                  int64_t deadline, string* err);
+
+    // Whether a file has a partial copy.
+    static bool Exists(const string& path);
+
+    // Get how many bytes of a file of `size` bytes its partial copy has (0 if none).
+    static int64_t GetNumBytes(const string& path, int64_t size);
+
+    // Remove a file's partial copy, if any.
+    static void Remove(const string& path);
+
+  private:
+    // Write out the listing of ranges present.
+    bool Save(string* err) const;
+
+    string path_;      // Path of the full file.
+    int64_t size_{0};  // Size of the full file.
+    int fd_{-1};       // The sparse file.
+    Ranges ranges_;    // What is present, sorted and merged.
+};
+
+// Whether a shard can be fetched partially: only uncompressed MDS shards can locate their samples
+// from the header alone.
+bool CanFetchPartial(const Shard* shard);
+
+// Fetch just an MDS shard's header and the given samples (indices within the shard) into the
+// partial copy of its local raw file. Sample byte ranges at most `merge_gap` apart are fetched
+// together, and ranges already present are skipped.
+bool FetchMDSPartial(const Remote* remote, const string& remote_path, const string& local_path,
+                     const MDSShard* shard, const vector<int64_t>& samples, int64_t merge_gap,
+                     int64_t deadline, string* err);
+
+}  // namespace xtreaming
@@ -0,0 +1,111 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "base/file.h"
+#include "base/time.h"
+#include "cache/partial.h"
+#include "remote/all.h"
+
+using std::string;
+using namespace xtreaming;
+
+namespace {
+
+const int64_t kSize = 1L << 20;  // Bytes in the remote file.
+
+void TestMergeRanges() {
+    // Sorted, with overlapping and touching ranges joined and empty ones dropped.
+    Ranges ranges = {{50, 60}, {0, 10}, {5, 20}, {30, 30}, {20, 25}, {55, 58}};
+    MergeRanges(&ranges, 0);
+    assert((ranges == Ranges{{0, 25}, {50, 60}}));
+
+    // Ranges within the gap of each other are joined too.
+    ranges = {{0, 10}, {14, 20}, {30, 40}};
+    MergeRanges(&ranges, 4);
+    assert((ranges == Ranges{{0, 20}, {30, 40}}));
+    MergeRanges(&ranges, 10);
+    assert((ranges == Ranges{{0, 40}}));
+
+    ranges.clear();
+    MergeRanges(&ranges, 10);
+    assert(ranges.empty());
+}
+
+// Fetch ranges piecemeal, read them back, pick them up again after a restart, and complete the
+// file.
+void TestPartialFile() {
+    char tmpl[] = "/tmp/partial_test.XXXXXX";
+    string dir = mkdtemp(tmpl);
+    string data(kSize, '\0');
+    for (int64_t i = 0; i < kSize; ++i) {
+        data[i] = (char)(i * 7 + i / 251);
+    }
+    std::ofstream(dir + "/data.bin", std::ios::binary) << data;
+    string err;
+    auto remote = GetRemote(dir, &err);
+    assert(remote);
+    string path = dir + "/copy.bin";
+    int64_t deadline = NanoTime() + 60L * 1000 * 1000 * 1000;
+
+    {
+        PartialFile file;
+        assert(file.Init(path, kSize, &err));
+        assert(file.ranges().empty());
+        assert(!file.Contains(0, 1));
+        assert(file.Contains(5, 5));
+
+        assert(file.Fetch(remote, "data.bin", {{1000, 2000}, {1500, 3000}, {5000, 6000}}, deadline,
+                          &err));
+        assert((file.ranges() == Ranges{{1000, 3000}, {5000, 6000}}));
+        assert(file.Contains(1000, 3000));
+        assert(!file.Contains(2000, 5500));
+
+        string got(500, '\0');
+        assert(file.Read(2500, 500, &got[0], &err));
+        assert(got == data.substr(2500, 500));
+        assert(!file.Read(2900, 500, &got[0], &err));
+        assert(PartialFile::Exists(path));
+    }
+
+    // A reopened copy has what was listed, and fetches only the gap between.
+    {
+        PartialFile file;
+        assert(file.Init(path, kSize, &err));
+        assert((file.ranges() == Ranges{{1000, 3000}, {5000, 6000}}));
+        assert(file.Fetch(remote, "data.bin", {{2000, 5500}}, deadline, &err));
+        assert((file.ranges() == Ranges{{1000, 6000}}));
+
+        string full_path = dir + "/full.bin";
+        assert(file.Complete(remote, "data.bin", full_path, deadline, &err));
+        assert((file.ranges() == Ranges{{0, kSize}}));
+        string got;
+        assert(ReadFile(full_path, &got));
+        assert(got == data);
+        assert(!PartialFile::Exists(path));
+    }
+
+    // Listed ranges that run past the end are not trusted.
+    std::ofstream(path + ".partial.ranges") << "0 100\n" << kSize << " " << kSize + 10 << "\n"
+                                            << "bad\n";
+    {
+        PartialFile file;
+        assert(file.Init(path, kSize, &err));
+        assert((file.ranges() == Ranges{{0, 100}}));
+    }
+    PartialFile::Remove(path);
+    assert(!PartialFile::Exists(path));
+
+    delete remote;
+    string cmd = "rm -rf " + dir;
+    assert(!system(cmd.c_str()));
+}
+
+}  // namespace
+
+int main() {
+    TestMergeRanges();
+    TestPartialFile();
+}
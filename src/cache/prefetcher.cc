@@ -0,0 +1,342 @@
+#include "prefetcher.h"
+
+#include <algorithm>
+
+#include "base/string.h"
+#include "cache/partial.h"
+
+namespace xtreaming {
+
+Prefetcher::~Prefetcher() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return !num_in_flight_; });
+}
+
+bool Prefetcher::Init(int64_t prefetch, double partial_fraction, const vector<Shard*>* shards,
+                      const vector<bool>& is_present, Downloader* downloader,
+                      DiskCache* disk_cache, Logger* logger, string* err) {
+    if (prefetch < 0) {
+        *err = StringPrintf("Prefetch must be non-negative (got: %ld).", prefetch);
+        return false;
+    }
+
+    if (partial_fraction < 0 || 1 < partial_fraction) {
+        *err = StringPrintf("Partial fraction must be from 0 to 1 (got: %.3lf).",
+                            partial_fraction);
+        return false;
+    }
+
+    prefetch_ = prefetch;
+    partial_fraction_ = partial_fraction;
+    shards_ = shards;
+    downloader_ = downloader;
+    disk_cache_ = disk_cache;
+    logger_ = logger;
+    states_.resize(shards->size());
+    for (int64_t i = 0; i < shards->size(); ++i) {
+        states_[i] = is_present[i] ? State::PRESENT : State::ABSENT;
+    }
+    errs_.resize(shards->size());
+    indices_.resize(shards->size(), -1L);
+    next_indices_.resize(shards->size(), -1L);
+    return true;
+}
+
+void Prefetcher::Order(const int64_t* sample_ids, int64_t num_samples,
+                       const Spanner& shard_index, vector<int64_t>* order,
+                       vector<int64_t>* first_touches,
+                       unordered_map<int64_t, vector<int64_t>>* partials) const {
+    vector<bool> is_seen;
+    is_seen.resize(shards_->size());
+    for (int64_t i = 0; i < num_samples; ++i) {
+        if (sample_ids[i] == -1L) {
+            continue;
+        }
+        int64_t shard_id;
+        int64_t shard_sample_id;
+        shard_index.Find(sample_ids[i], &shard_id, &shard_sample_id);
+        if (partial_fraction_ && CanFetchPartial((*shards_)[shard_id])) {
+            (*partials)[shard_id].emplace_back(shard_sample_id);
+        }
+        if (is_seen[shard_id]) {
+            continue;
+        }
+        is_seen[shard_id] = true;
+        order->emplace_back(shard_id);
+        first_touches->emplace_back(i);
+    }
+
+    // Keep just the shards sampled sparsely enough to be worth fetching partially.
+    for (auto it = partials->begin(); it != partials->end();) {
+        auto& samples = it->second;
+        std::sort(samples.begin(), samples.end());
+        samples.erase(std::unique(samples.begin(), samples.end()), samples.end());
+        if (partial_fraction_ * (*shards_)[it->first]->num_samples() < samples.size()) {
+            it = partials->erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void Prefetcher::Plan(const int64_t* sample_ids, int64_t num_samples,
+                      const Spanner& shard_index) {
+    vector<int64_t> order;
+    vector<int64_t> first_touches;
+    unordered_map<int64_t, vector<int64_t>> partials;
+    Order(sample_ids, num_samples, shard_index, &order, &first_touches, &partials);
+    vector<int64_t> indices;
+    Index(order, &indices);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    order_.swap(order);
+    first_touches_.swap(first_touches);
+    indices_.swap(indices);
+    partials_.swap(partials);
+    plan_size_ = num_samples;
+    cursor_ = 0;
+    position_ = 0;
+    downloader_->Advance(0);
+    next_order_.clear();
+    next_first_touches_.clear();
+    next_indices_.assign(states_.size(), -1L);
+    next_partials_.clear();
+
+    // Partial shards missing samples of the new plan count as absent again. Those fetched ahead
+    // for this plan (see PlanNext()) have them.
+    for (int64_t i = 0; i < states_.size(); ++i) {
+        if (states_[i] == State::PARTIAL && !IsCovered(i)) {
+            states_[i] = State::ABSENT;
+            samples_.erase(i);
+        }
+    }
+
+    // Requeue what the new window still wants at its new priority, and cancel the rest, along
+    // with partial fetches of the wrong samples (to be queued again with the right ones).
+    unordered_map<int64_t, int64_t> window;
+    for (int64_t i = 0; i < order_.size() && i < prefetch_; ++i) {
+        window[order_[i]] = first_touches_[i];
+    }
+    for (int64_t i = 0; i < states_.size(); ++i) {
+        if (states_[i] != State::FETCHING) {
+            continue;
+        }
+        auto it = window.find(i);
+        if (it != window.end() && (!samples_.count(i) || IsCovered(i))) {
+            downloader_->Reprioritize(i, it->second);
+        } else if (downloader_->Cancel(i)) {
+            states_[i] = State::ABSENT;
+            samples_.erase(i);
+            --num_in_flight_;
+            if (disk_cache_) {
+                disk_cache_->Abort(i);
+            }
+        }
+    }
+    cond_.notify_all();
+
+    Pump();
+}
+
+void Prefetcher::PlanNext(const int64_t* sample_ids, int64_t num_samples,
+                          const Spanner& shard_index) {
+    vector<int64_t> order;
+    vector<int64_t> first_touches;
+    unordered_map<int64_t, vector<int64_t>> partials;
+    Order(sample_ids, num_samples, shard_index, &order, &first_touches, &partials);
+    vector<int64_t> indices;
+    Index(order, &indices);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    next_order_.swap(order);
+    next_first_touches_.swap(first_touches);
+    next_indices_.swap(indices);
+    next_partials_.swap(partials);
+    Pump();
+}
+
+void Prefetcher::Advance(int64_t position) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    position_ = position;
+    downloader_->Advance(position);
+    if (disk_cache_) {
+        disk_cache_->Advance(position);
+    }
+    int64_t old_cursor = cursor_;
+    while (cursor_ < order_.size() && first_touches_[cursor_] < position) {
+        if (disk_cache_) {
+            disk_cache_->Touch(order_[cursor_]);
+        }
+        ++cursor_;
+    }
+    if (cursor_ != old_cursor) {
+        Pump();
+    }
+}
+
+bool Prefetcher::Wait(int64_t shard_id, string* err) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    bool is_fetched = false;
+    while (true) {
+        auto state = states_[shard_id];
+        if (state == State::PRESENT || (state == State::PARTIAL && IsCovered(shard_id))) {
+            if (disk_cache_) {
+                disk_cache_->Touch(shard_id);
+            }
+            return true;
+        }
+        if (state == State::FAILED && is_fetched) {
+            *err = errs_[shard_id];
+            return false;
+        }
+
+        // It's needed now, which is more urgent than anything planned.
+        if (state == State::FETCHING) {
+            downloader_->Reprioritize(shard_id, position_);
+        } else {
+            Fetch(shard_id, position_, partials_);
+            is_fetched = true;
+        }
+        cond_.wait(lock);
+    }
+}
+
+bool Prefetcher::is_present(int64_t shard_id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return states_[shard_id] == State::PRESENT;
+}
+
+void Prefetcher::Fetch(int64_t shard_id, int64_t priority,
+                       const unordered_map<int64_t, vector<int64_t>>& partials) {
+    states_[shard_id] = State::FETCHING;
+    ++num_in_flight_;
+    auto it = partials.find(shard_id);
+    bool is_partial = it != partials.end();
+    if (is_partial) {
+        samples_[shard_id] = it->second;
+    } else {
+        samples_.erase(shard_id);
+    }
+    auto done = [this, is_partial](int64_t shard_id, bool ok, const string& err) {
+        OnDone(shard_id, is_partial, ok, err);
+    };
+
+    // Shards evicted to make room are fetched again if the plan reaches them. A partial fetch
+    // reserves about its share of the shard's raw bytes.
+    auto shard = (*shards_)[shard_id];
+    if (disk_cache_) {
+        vector<int64_t> evicted;
+        auto is_pinned = [this](int64_t id) { return IsPinned(id); };
+        if (!is_partial) {
+            disk_cache_->Reserve(shard_id, is_pinned, &evicted);
+        } else if (0 < shard->num_samples()) {
+            int64_t num_bytes = shard->GetRawSize() * (int64_t)it->second.size() /
+                shard->num_samples();
+            disk_cache_->ReservePartial(shard_id, num_bytes, is_pinned, &evicted);
+        }
+        for (auto& id : evicted) {
+            if (states_[id] == State::PRESENT || states_[id] == State::PARTIAL) {
+                states_[id] = State::ABSENT;
+                samples_.erase(id);
+            }
+        }
+    }
+    if (is_partial) {
+        downloader_->SubmitPartial(shard_id, shard, it->second, priority, done);
+    } else {
+        downloader_->Submit(shard_id, shard, priority, done);
+    }
+}
+
+void Prefetcher::Pump() {
+    // Shards that failed are left for Wait() to retry, so a bad shard isn't hammered.
+    int64_t end = cursor_ + prefetch_;
+    if (order_.size() < end) {
+        end = order_.size();
+    }
+    for (int64_t i = cursor_; i < end; ++i) {
+        int64_t shard_id = order_[i];
+        if (states_[shard_id] == State::ABSENT) {
+            Fetch(shard_id, first_touches_[i], partials_);
+        }
+    }
+
+    // In the last stretch of the plan, spend the rest of the window on the next plan's first
+    // shards, queued behind everything in this one.
+    int64_t num_ahead = cursor_ + prefetch_ - order_.size();
+    for (int64_t i = 0; i < num_ahead && i < next_order_.size(); ++i) {
+        int64_t shard_id = next_order_[i];
+        if (states_[shard_id] == State::ABSENT) {
+            Fetch(shard_id, plan_size_ + next_first_touches_[i], next_partials_);
+        }
+    }
+}
+
+bool Prefetcher::IsPinned(int64_t shard_id) const {
+    if (states_[shard_id] == State::FETCHING) {
+        return true;
+    }
+    int64_t index = indices_[shard_id];
+    if (cursor_ <= index && index < cursor_ + prefetch_) {
+        return true;
+    }
+    index = next_indices_[shard_id];
+    return 0 <= index && index < cursor_ + prefetch_ - (int64_t)order_.size();
+}
+
+const vector<int64_t>* Prefetcher::GetPlanned(int64_t shard_id) const {
+    auto& partials = indices_[shard_id] < 0 && 0 <= next_indices_[shard_id] ? next_partials_ :
+        partials_;
+    auto it = partials.find(shard_id);
+    return it == partials.end() ? nullptr : &it->second;
+}
+
+bool Prefetcher::IsCovered(int64_t shard_id) const {
+    auto planned = GetPlanned(shard_id);
+    auto it = samples_.find(shard_id);
+    return planned && it != samples_.end() &&
+           std::includes(it->second.begin(), it->second.end(), planned->begin(), planned->end());
+}
+
+void Prefetcher::Index(const vector<int64_t>& order, vector<int64_t>* indices) const {
+    indices->assign(shards_->size(), -1L);
+    for (int64_t i = 0; i < order.size(); ++i) {
+        (*indices)[order[i]] = i;
+    }
+}
+
+void Prefetcher::OnDone(int64_t shard_id, bool is_partial, bool ok, const string& err) {
+    // Shards cancelled on shutdown aren't worth a warning each.
+    if (!ok && !downloader_->is_stopping()) {
+        logger_->Log(LogLevel::WARN, StringPrintf("Unable to prefetch shard %ld: %s", shard_id,
+                                                  err.c_str()));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // A partial fetch that a replan left short of samples is done over when next needed.
+        if (!ok) {
+            states_[shard_id] = State::FAILED;
+        } else if (!is_partial) {
+            states_[shard_id] = State::PRESENT;
+        } else {
+            states_[shard_id] = IsCovered(shard_id) ? State::PARTIAL : State::ABSENT;
+        }
+        if (states_[shard_id] != State::PARTIAL) {
+            samples_.erase(shard_id);
+        }
+        // Even a failed partial fetch may have kept some ranges.
+        if (disk_cache_ && is_partial) {
+            disk_cache_->CommitPartial(shard_id);
+        } else if (disk_cache_ && ok) {
+            disk_cache_->Commit(shard_id);
+        } else if (disk_cache_) {
+            disk_cache_->Abort(shard_id);
+        }
+        errs_[shard_id] = err;
+        --num_in_flight_;
+    }
+    cond_.notify_all();
+}
+
+}  // namespace xtreaming
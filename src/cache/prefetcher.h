@@ -0,0 +1,152 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/logger.h"
+#include "base/spanner.h"
+#include "cache/disk_cache.h"
+#include "cache/downloader.h"
+#include "serial/base/shard.h"
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace xtreaming {
+
+// Keeps the next few shards a worker will read downloaded ahead of it.
+//
+// Given the worker's sample IDs in the order it will consume them, the plan is the order in which
+// it first touches each shard. The window is the next `prefetch` shards of the plan from the
+// consumer's current position, and any of those not yet present are handed to the downloader (which
+// also decompresses them). As the consumer advances, the window slides along the plan.
+//
+// Each download is queued at the plan position that first needs it, so the most urgent go first.
+// Replanning reprioritizes queued shards that are still in the window and cancels the rest. A
+// queued shard that another process fetches meanwhile is caught when the downloader dequeues it,
+// and is then just reported present.
+//
+// A shard the plan samples only sparsely (at most `partial_fraction` of its samples, as when a
+// stream is downsampled) is fetched partially where possible, getting just the planned samples. It
+// then counts as ready only for plans that want no other samples of it.
+//
+// The plan of the following epoch can be given ahead of time. Once the rest of the current plan
+// fits in the window, the window's spare room goes to the next plan's first shards, so the new
+// epoch doesn't start cold. Within the window, this never has more shards in flight than usual.
+//
+// Downloads, whole or partial, reserve their room in the disk cache, if given, which may evict
+// shards to make it. Shards in the window (of either plan) or being fetched are pinned against
+// that, and shards are marked used (and the disk cache's position advanced) as the consumer reaches
+// them.
+class Prefetcher {
+  public:
+    int64_t prefetch() const { return prefetch_; }
+    double partial_fraction() const { return partial_fraction_; }
+
+    // Waits for shards still being downloaded for us.
+    ~Prefetcher();
+
+    // Borrow the shards, downloader and disk cache (optional), and take which shards are already
+    // present.
+    bool Init(int64_t prefetch, double partial_fraction, const vector<Shard*>* shards,
+              const vector<bool>& is_present, Downloader* downloader, DiskCache* disk_cache,
+              Logger* logger, string* err);
+
+    // Replace the plan with one derived from the worker's sample IDs (-1 for padding), then start
+    // fetching the first window.
+    void Plan(const int64_t* sample_ids, int64_t num_samples, const Spanner& shard_index);
+
+    // Take the plan that will follow the current one, whose first shards are fetched as the current
+    // one winds down. Cleared by Plan(), which should then be given the same sample IDs.
+    void PlanNext(const int64_t* sample_ids, int64_t num_samples, const Spanner& shard_index);
+
+    // Note that the consumer has now consumed this many of its sample IDs, passing that on to the
+    // downloader and disk cache, and slide the window.
+    void Advance(int64_t position);
+
+    // Block until a shard is present (or has the samples planned, if fetched partially), fetching
+    // it right away (or moving it to the front of the queue) if needed. Returns false if its
+    // download failed.
+    bool Wait(int64_t shard_id, string* err);
+
+    // Whether a shard is present.
+    bool is_present(int64_t shard_id) const;
+
+  private:
+    enum class State : uint8_t {
+        ABSENT,
+        FETCHING,
+        PRESENT,
+        PARTIAL,
+        FAILED
+    };
+
+    // Derive a plan from sample IDs: shards in order of first touch, where they are first touched,
+    // and the planned samples of the shards to fetch partially.
+    void Order(const int64_t* sample_ids, int64_t num_samples, const Spanner& shard_index,
+               vector<int64_t>* order, vector<int64_t>* first_touches,
+               unordered_map<int64_t, vector<int64_t>>* partials) const;
+
+    // Queue a shard for download at the given priority, partially if the plan says so. Requires
+    // the lock.
+    void Fetch(int64_t shard_id, int64_t priority,
+               const unordered_map<int64_t, vector<int64_t>>& partials);
+
+    // Fetch whatever is missing in the window. Requires the lock.
+    void Pump();
+
+    // Whether a shard must not be evicted: being fetched, or in the window. Requires the lock.
+    bool IsPinned(int64_t shard_id) const;
+
+    // Get the samples the plans want of a shard fetched partially: the current plan's if it has
+    // the shard, else the next plan's. Null if wanted whole, or not at all. Requires the lock.
+    const vector<int64_t>* GetPlanned(int64_t shard_id) const;
+
+    // Whether a partial shard has, or is getting, every sample the plans want of it. Requires the
+    // lock.
+    bool IsCovered(int64_t shard_id) const;
+
+    // Get each shard's index in a plan order (-1 if not in it).
+    void Index(const vector<int64_t>& order, vector<int64_t>* indices) const;
+
+    // Downloader callback.
+    void OnDone(int64_t shard_id, bool is_partial, bool ok, const string& err);
+
+    int64_t prefetch_{0};                    // Number of upcoming shards to keep fetched.
+    double partial_fraction_{0};             // Most of a shard to plan for fetching partially.
+    const vector<Shard*>* shards_{nullptr};  // All shards.
+    Downloader* downloader_{nullptr};        // Does the fetching.
+    DiskCache* disk_cache_{nullptr};         // Makes room, if given.
+    Logger* logger_{nullptr};                // Notes failures.
+
+    mutable std::mutex mutex_;       // Guards the below.
+    std::condition_variable cond_;   // Signaled when a download finishes.
+    vector<State> states_;           // State of each shard.
+    vector<string> errs_;            // Why each failed shard failed.
+    vector<int64_t> order_;          // Shard IDs in the order the worker first touches them.
+    vector<int64_t> first_touches_;  // Sample position of each of those first touches.
+    vector<int64_t> indices_;        // Index of each shard in the plan (-1 if not in it).
+    int64_t cursor_{0};              // Index in the plan of the next shard yet to be touched.
+    int64_t position_{0};            // Number of sample IDs consumed so far.
+    int64_t num_in_flight_{0};       // Number of our downloads not yet done.
+    int64_t plan_size_{0};           // Number of sample IDs in the plan.
+
+    // Planned samples of each shard to fetch partially, by shard ID.
+    unordered_map<int64_t, vector<int64_t>> partials_;
+
+    // Samples of each shard that is partial or being fetched partially, by shard ID.
+    unordered_map<int64_t, vector<int64_t>> samples_;
+
+    // Likewise for the next plan, if given.
+    vector<int64_t> next_order_;
+    vector<int64_t> next_first_touches_;
+    vector<int64_t> next_indices_;
+    unordered_map<int64_t, vector<int64_t>> next_partials_;
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,192 @@
+#include "resume.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "base/file.h"
+#include "base/hash/crc32c.h"
+#include "base/string.h"
+
+using std::vector;
+
+namespace xtreaming {
+namespace {
+
+const int64_t kCheckpointSize = 64L << 20;  // Bytes fetched between progress records.
+const int64_t kBufferSize = 1L << 20;       // Bytes per read when checking a resumed file.
+
+string PartPath(const string& path) {
+    return path + ".part";
+}
+
+string ProgressPath(const string& path) {
+    return path + ".part.progress";
+}
+
+// Appends fetched bytes to the `.part` file, recording progress as it goes.
+class PartSink : public ByteSink {
+  public:
+    PartSink(int fd, int64_t offset, int64_t size, uint32_t crc, const string& path) :
+        fd_(fd), offset_(offset), size_(size), crc_(crc), path_(path), saved_(offset) {
+    }
+
+    virtual bool Write(const char* data, int64_t size, string* err) override {
+        while (size) {
+            ssize_t num_written = pwrite(fd_, data, size, offset_);
+            if (num_written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                *err = StringPrintf("Unable to write file: `%s` (%s).", PartPath(path_).c_str(),
+                                    strerror(errno));
+                return false;
+            }
+            crc_ = Crc32cExtend(crc_, data, num_written);
+            data += num_written;
+            size -= num_written;
+            offset_ += num_written;
+        }
+        if (kCheckpointSize <= offset_ - saved_) {
+            Save();
+        }
+        return true;
+    }
+
+    virtual bool Close(string* err) override {
+        if (offset_ != size_) {
+            *err = StringPrintf("Fetched %ld bytes of `%s`, expected %ld.", offset_,
+                                PartPath(path_).c_str(), size_);
+            Save();
+            return false;
+        }
+        return true;
+    }
+
+    // Keep what made it, for next time.
+    virtual void Abort() override {
+        Save();
+    }
+
+  private:
+    // Sync the data, then record how much there is. Best effort: a lost record only costs a
+    // refetch.
+    void Save() {
+        if (offset_ == saved_ || fdatasync(fd_)) {
+            return;
+        }
+        string text = StringPrintf("%ld %ld %u\n", offset_, size_, crc_);
+        string path = ProgressPath(path_);
+        string tmp_path = path + ".tmp";
+        int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            return;
+        }
+        bool ok = WriteAll(fd, text.data(), text.size());
+        if (close(fd) || !ok || rename(tmp_path.c_str(), path.c_str())) {
+            unlink(tmp_path.c_str());
+            return;
+        }
+        saved_ = offset_;
+    }
+
+    int fd_;          // The `.part` file.
+    int64_t offset_;  // Bytes in it so far.
+    int64_t size_;    // Bytes it should end up with.
+    uint32_t crc_;    // CRC-32C of the bytes so far.
+    string path_;     // Path of the file being fetched.
+    int64_t saved_;   // Offset last recorded.
+};
+
+// Get how many bytes of the `.part` file (and their CRC) can be trusted from the progress record,
+// or zero if none.
+int64_t LoadProgress(int fd, const string& path, int64_t size, uint32_t* crc) {
+    *crc = 0;
+    string text;
+    int64_t offset;
+    int64_t record_size;
+    uint32_t record_crc;
+    if (!ReadFile(ProgressPath(path), &text) ||
+            sscanf(text.c_str(), "%" SCNd64 " %" SCNd64 " %" SCNu32, &offset, &record_size,
+                   &record_crc) != 3 ||
+            record_size != size || offset <= 0 || size < offset) {
+        return 0;
+    }
+
+    // Check the data is what was recorded, in case it was cut short or damaged since.
+    vector<char> buf(kBufferSize);
+    uint32_t check = 0;
+    for (int64_t done = 0; done < offset;) {
+        int64_t chunk_size = offset - done < kBufferSize ? offset - done : kBufferSize;
+        ssize_t num_read = pread(fd, buf.data(), chunk_size, done);
+        if (num_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (num_read <= 0) {
+            return 0;
+        }
+        check = Crc32cExtend(check, buf.data(), num_read);
+        done += num_read;
+    }
+    if (check != record_crc) {
+        return 0;
+    }
+    *crc = check;
+    return offset;
+}
+
+}  // namespace
+
+bool FetchResumable(const Remote* remote, const string& remote_path, const string& path,
+                    int64_t size, const string& fetched_path, int64_t deadline, string* err) {
+    string part_path = PartPath(path);
+    int fd = open(part_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        *err = StringPrintf("Unable to open file: `%s` (%s).", part_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Drop anything past what was recorded, as it may not have made it to disk intact.
+    uint32_t crc;
+    int64_t offset = LoadProgress(fd, path, size, &crc);
+    if (ftruncate(fd, offset)) {
+        *err = StringPrintf("Unable to resize file: `%s` (%s).", part_path.c_str(),
+                            strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    bool ok = true;
+    if (offset < size) {
+        PartSink sink(fd, offset, size, crc, path);
+        ok = remote->FetchRange(remote_path, offset, size - offset, &sink, deadline, err);
+    }
+    if (close(fd) && ok) {
+        *err = StringPrintf("Unable to write file: `%s` (%s).", part_path.c_str(),
+                            strerror(errno));
+        ok = false;
+    }
+    if (!ok) {
+        return false;
+    }
+
+    if (rename(part_path.c_str(), fetched_path.c_str())) {
+        *err = StringPrintf("Unable to rename `%s` to `%s` (%s).", part_path.c_str(),
+                            fetched_path.c_str(), strerror(errno));
+        return false;
+    }
+    unlink(ProgressPath(path).c_str());
+    return true;
+}
+
+void RemovePart(const string& path) {
+    unlink(ProgressPath(path).c_str());
+    unlink(PartPath(path).c_str());
+}
+
+}  // namespace xtreaming
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "remote/remote.h"
+
+using std::string;
+
+namespace xtreaming {
+
+// Fetch a remote file of `size` bytes into `<path>.part`, picking up where an earlier failed try
+// left off, then move it to `fetched_path` once complete.
+//
+// As bytes arrive, every so often (and when the fetch fails) the `.part` file is synced and its
+// length recorded in `<path>.part.progress` as "offset size crc", with a CRC-32C of everything
+// before the offset. The record never runs ahead of the data, so a crash loses at most the last
+// stretch. A later call first checks the `.part` file against the record, then fetches only the
+// rest. A record that doesn't match (different size, short file, bad CRC) means starting over.
+bool FetchResumable(const Remote* remote, const string& remote_path, const string& path,
+                    int64_t size, const string& fetched_path, int64_t deadline, string* err);
+
+// Remove a file's `.part` file and its progress record, if any.
+void RemovePart(const string& path);
+
+}  // namespace xtreaming
@@ -0,0 +1,116 @@
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "base/file.h"
+#include "base/string.h"
+#include "base/time.h"
+#include "cache/resume.h"
+#include "remote/all.h"
+
+using std::string;
+using namespace xtreaming;
+
+namespace {
+
+const int64_t kSize = 4L << 20;  // Bytes in the remote file.
+
+// Make a scratch dir holding a remote file of kSize patterned bytes, getting its contents.
+string MakeRemote(string* data) {
+    char tmpl[] = "/tmp/resume_test.XXXXXX";
+    string dir = mkdtemp(tmpl);
+    data->resize(kSize);
+    for (int64_t i = 0; i < kSize; ++i) {
+        (*data)[i] = (char)(i * 7 + i / 251);
+    }
+    std::ofstream(dir + "/data.bin", std::ios::binary) << *data;
+    return dir;
+}
+
+void RemoveDir(const string& dir) {
+    string cmd = "rm -rf " + dir;
+    assert(!system(cmd.c_str()));
+}
+
+// Get the size of a file, or -1 if absent.
+int64_t GetSize(const string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) ? -1 : info.st_size;
+}
+
+// Requests fail partway through most of the time, so getting the file takes several tries, each of
+// which must pick up where the last left off.
+void TestResume() {
+    string data;
+    string dir = MakeRemote(&data);
+    int64_t num_failed = 0;
+    int64_t num_resumed = 0;
+    for (int64_t seed = 0; seed < 8; ++seed) {
+        string err;
+        string url = StringPrintf("mock://%s?error_rate=0.8&seed=%ld", dir.c_str(), seed);
+        auto remote = GetRemote(url, &err);
+        assert(remote);
+
+        string path = StringPrintf("%s/%ld.bin", dir.c_str(), seed);
+        string fetched_path = path + ".fetched";
+        int64_t deadline = NanoTime() + 60L * 1000 * 1000 * 1000;
+        int64_t last_size = 0;
+        for (int64_t i = 0;
+             !FetchResumable(remote, "data.bin", path, kSize, fetched_path, deadline, &err); ++i) {
+            // What made it is kept, and never shrinks.
+            int64_t size = GetSize(path + ".part");
+            assert(last_size <= size && size < kSize);
+            num_resumed += 0 < size;
+            last_size = size;
+            ++num_failed;
+            assert(i < 1000);
+        }
+
+        string got;
+        assert(ReadFile(fetched_path, &got));
+        assert(got == data);
+        assert(GetSize(path + ".part") == -1);
+        assert(GetSize(path + ".part.progress") == -1);
+        delete remote;
+    }
+    assert(num_failed);
+    assert(num_resumed);
+    RemoveDir(dir);
+}
+
+// A `.part` file that doesn't match its progress record is fetched over from the start.
+void TestBadProgress() {
+    string data;
+    string dir = MakeRemote(&data);
+    string err;
+    auto remote = GetRemote(dir, &err);
+    assert(remote);
+
+    string path = dir + "/copy.bin";
+    string fetched_path = path + ".fetched";
+    int64_t deadline = NanoTime() + 60L * 1000 * 1000 * 1000;
+    for (auto& record : {"1024 4194304 0\n", "1024 999 0\n", "garbage\n"}) {
+        std::ofstream(path + ".part", std::ios::binary) << string(1024, 'x');
+        std::ofstream(path + ".part.progress") << record;
+        assert(FetchResumable(remote, "data.bin", path, kSize, fetched_path, deadline, &err));
+        string got;
+        assert(ReadFile(fetched_path, &got));
+        assert(got == data);
+        unlink(fetched_path.c_str());
+    }
+
+    delete remote;
+    RemoveDir(dir);
+}
+
+}  // namespace
+
+int main() {
+    TestResume();
+    TestBadProgress();
+}
@@ -0,0 +1,103 @@
+#include "shard_states.h"
+
+#include <unistd.h>
+
+#include "base/shmem/futex.h"
+#include "base/string.h"
+
+namespace xtreaming {
+namespace {
+
+const uint64_t kMagic = 0x7374617465730001UL;  // "states", version 1.
+const uint32_t kStateMask = 3;                  // State bits of a word.
+const int kStateBits = 2;                       // Where the owner's pid starts.
+
+}  // namespace
+
+bool ShardStates::Init(const string& name, int64_t num_shards, string* err) {
+    int64_t size = sizeof(Header) + num_shards * sizeof(words_[0]);
+    if (!table_.Init(name, kMagic, size, err)) {
+        return false;
+    }
+
+    auto header = (Header*)table_.data();
+    if (table_.is_creator()) {
+        header->num_shards = num_shards;
+    } else if (header->num_shards != num_shards) {
+        *err = StringPrintf("Shard state table `%s` has %ld shards, but we have %ld (left over "
+                            "from a crashed run? if so, remove /dev/shm%s).", name.c_str(),
+                            header->num_shards, num_shards, name.c_str());
+        return false;
+    }
+    table_.Attach();
+
+    header_ = header;
+    words_ = (std::atomic<uint32_t>*)&header[1];
+    num_shards_ = num_shards;
+    pid_bits_ = (uint32_t)getpid() << kStateBits;
+    return true;
+}
+
+ShardState ShardStates::Get(int64_t shard_id) const {
+    return (ShardState)(words_[shard_id].load() & kStateMask);
+}
+
+void ShardStates::MarkPresent(int64_t shard_id) {
+    uint32_t expected = (uint32_t)ShardState::ABSENT;
+    words_[shard_id].compare_exchange_strong(expected, (uint32_t)ShardState::PRESENT);
+}
+
+bool ShardStates::TryDownload(int64_t shard_id, ShardState* state) {
+    auto& word = words_[shard_id];
+    uint32_t value = word.load();
+    while (true) {
+        *state = (ShardState)(value & kStateMask);
+        if (*state != ShardState::ABSENT) {
+            return false;
+        }
+        if (word.compare_exchange_weak(value, pid_bits_ | (uint32_t)ShardState::DOWNLOADING)) {
+            *state = ShardState::DOWNLOADING;
+            return true;
+        }
+    }
+}
+
+void ShardStates::EndDownload(int64_t shard_id, bool ok) {
+    Set(shard_id, ok ? ShardState::PRESENT : ShardState::ABSENT);
+}
+
+bool ShardStates::TryEvict(int64_t shard_id) {
+    uint32_t expected = (uint32_t)ShardState::PRESENT;
+    return words_[shard_id].compare_exchange_strong(
+        expected, pid_bits_ | (uint32_t)ShardState::EVICTING);
+}
+
+void ShardStates::EndEvict(int64_t shard_id) {
+    Set(shard_id, ShardState::ABSENT);
+}
+
+ShardState ShardStates::Wait(int64_t shard_id) {
+    auto& word = words_[shard_id];
+    while (true) {
+        uint32_t value = word.load();
+        auto state = (ShardState)(value & kStateMask);
+        if (state == ShardState::ABSENT || state == ShardState::PRESENT) {
+            return state;
+        }
+
+        FutexWait(&word, value);
+
+        // If its owner died mid-transition, nobody will finish it, so take it back to absent.
+        if (word.load() == value && !IsAlive(value >> kStateBits) &&
+                word.compare_exchange_strong(value, (uint32_t)ShardState::ABSENT)) {
+            FutexWakeAll(&word);
+        }
+    }
+}
+
+void ShardStates::Set(int64_t shard_id, ShardState state) {
+    words_[shard_id].store((uint32_t)state);
+    FutexWakeAll(&words_[shard_id]);
+}
+
+}  // namespace xtreaming
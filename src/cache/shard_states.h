@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "base/shmem/table.h"
+
+using std::string;
+
+namespace xtreaming {
+
+// State of a shard in the node's local cache.
+enum class ShardState : uint32_t {
+    ABSENT = 0,       // Not cached.
+    DOWNLOADING = 1,  // Being fetched by one process.
+    PRESENT = 2,      // Cached.
+    EVICTING = 3      // Being removed by one process.
+};
+
+// Table of shard states shared by every process on the node, so that each shard is fetched (or
+// evicted) by exactly one of them while the rest wait on or observe the outcome.
+//
+// Each state is one atomic 32-bit word in shared memory: the state in the low two bits, and the
+// pid of the process that owns a transitional state above them. Waiters sleep on the word with a
+// futex. A waiter that finds the owner has died takes the shard back to absent, so a crashed
+// process can't wedge the node. That relies on pids, so the processes sharing the table must share
+// a PID namespace too, which attaching checks. The last process to detach removes the table.
+class ShardStates {
+  public:
+    int64_t num_shards() const { return num_shards_; }
+
+    // Create or attach to the named table.
+    bool Init(const string& name, int64_t num_shards, string* err);
+
+    // Get a shard's current state.
+    ShardState Get(int64_t shard_id) const;
+
+    // Note that a shard was found present on disk (absent -> present).
+    void MarkPresent(int64_t shard_id);
+
+    // Try to become the one to download a shard (absent -> downloading). On failure, gets the
+    // state it was in instead.
+    bool TryDownload(int64_t shard_id, ShardState* state);
+
+    // Finish our download (downloading -> present, or back to absent if it failed).
+    void EndDownload(int64_t shard_id, bool ok);
+
+    // Try to become the one to evict a shard (present -> evicting).
+    bool TryEvict(int64_t shard_id);
+
+    // Finish our eviction (evicting -> absent).
+    void EndEvict(int64_t shard_id);
+
+    // Block while another process is downloading or evicting a shard, then get the state it
+    // settled in (present or absent).
+    ShardState Wait(int64_t shard_id);
+
+  private:
+    struct Header {
+        int64_t num_shards;  // Number of states that follow.
+    };
+
+    // Set a word we own, and wake its waiters.
+    void Set(int64_t shard_id, ShardState state);
+
+    SharedTable table_;                      // Backing table, detached on destruction.
+    Header* header_{nullptr};                // Start of the table's data.
+    std::atomic<uint32_t>* words_{nullptr};  // State words, after the header.
+    int64_t num_shards_{0};                  // Number of shards.
+    uint32_t pid_bits_{0};                   // Our pid, shifted into place.
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,325 @@
+#include "verifier.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <thread>
+
+#include "base/file.h"
+#include "base/hash/hash.h"
+#include "base/json.h"
+#include "base/mmap.h"
+#include "base/string.h"
+
+using std::atomic;
+using std::map;
+
+namespace xtreaming {
+namespace {
+
+// What we last verified about a file.
+struct Record {
+    int64_t num_bytes;
+    int64_t mtime;  // Nanoseconds since the epoch.
+    string algo;
+    string digest;  // Hex, as in the index.
+};
+
+// A file to hash.
+struct Job {
+    int64_t shard_id;
+    int64_t stream_id;
+    string path;  // Relative to the stream's local split dir.
+    int64_t num_bytes;
+    int64_t mtime;
+    string algo;
+    string digest;   // Hex, as in the index.
+    bool ok{false};  // Result.
+};
+
+string GetDir(const Stream& stream) {
+    return stream.local() + "/" + stream.split() + "/";
+}
+
+void LoadSidecar(const Stream& stream, map<string, Record>* records) {
+    records->clear();
+    string txt;
+    if (!ReadFile(GetDir(stream) + Verifier::sidecar_basename(), &txt)) {
+        return;
+    }
+
+    // A corrupt sidecar just means everything gets re-verified.
+    json obj = json::parse(txt, nullptr, false);
+    if (!obj.is_object()) {
+        return;
+    }
+    for (auto it : obj.items()) {
+        auto& val = it.value();
+        if (!val.is_object() || !val["bytes"].is_number_integer() ||
+                !val["mtime"].is_number_integer() || !val["algo"].is_string() ||
+                !val["digest"].is_string()) {
+            continue;
+        }
+        auto& record = (*records)[it.key()];
+        record.num_bytes = val["bytes"];
+        record.mtime = val["mtime"];
+        record.algo = val["algo"];
+        record.digest = val["digest"];
+    }
+}
+
+void SaveSidecar(const Stream& stream, const map<string, Record>& records, Logger* logger) {
+    json obj = json::object();
+    for (auto& it : records) {
+        auto& record = it.second;
+        obj[it.first] = {
+            {"bytes", record.num_bytes},
+            {"mtime", record.mtime},
+            {"algo", record.algo},
+            {"digest", record.digest},
+        };
+    }
+
+    // Write to a temp file and rename it into place, so the sidecar is never half-written. Every
+    // process sharing the dir may save at once, so each gets its own uniquely named temp file.
+    string path = GetDir(stream) + Verifier::sidecar_basename();
+    string tmp_path = path + ".XXXXXX";
+    string txt = obj.dump();
+    int fd = mkstemp(&tmp_path[0]);
+    FILE* file = nullptr;
+    if (0 <= fd) {
+        fchmod(fd, 0644);
+        file = fdopen(fd, "wb");
+        if (!file) {
+            close(fd);
+        }
+    }
+    bool ok = file && fwrite(txt.data(), 1, txt.size(), file) == txt.size();
+    ok = file && !fclose(file) && ok;
+    if (!ok || rename(tmp_path.c_str(), path.c_str())) {
+        if (0 <= fd) {
+            remove(tmp_path.c_str());
+        }
+        logger->Log(LogLevel::WARN, StringPrintf("Unable to write verification sidecar: `%s`.",
+                                                 path.c_str()));
+    }
+}
+
+void HashThread(vector<Job>* jobs, const vector<Stream>* streams, atomic<int64_t>* next) {
+    while (true) {
+        int64_t i = (*next)++;
+        if (jobs->size() <= i) {
+            break;
+        }
+        auto& job = (*jobs)[i];
+        auto& stream = (*streams)[job.stream_id];
+
+        string expected;
+        if (!HexToBytes(job.digest, &expected)) {
+            continue;
+        }
+
+        MappedFile file;
+        string err;
+        if (!file.Open(GetDir(stream) + job.path, &err)) {
+            continue;
+        }
+        if (file.size() != job.num_bytes) {
+            continue;
+        }
+
+        Hasher* hasher = NewHasher(job.algo);
+        if (file.size()) {
+            madvise((void*)file.data(), file.size(), MADV_SEQUENTIAL);
+            hasher->Update(file.data(), file.size());
+        }
+        job.ok = hasher->Digest() == expected;
+        delete hasher;
+    }
+}
+
+}  // namespace
+
+bool Verifier::Init(int64_t num_threads, string* err) {
+    if (num_threads < 1) {
+        *err = StringPrintf("Verification thread count must be positive (got: %ld).",
+                            num_threads);
+        return false;
+    }
+
+    num_threads_ = num_threads;
+    return true;
+}
+
+bool Verifier::Verify(const vector<Stream>& streams, const vector<Shard*>& shards,
+                      vector<bool>* is_present, Logger* logger, string* err) const {
+    auto scope = logger->Scope("init/caches/verify");
+
+    // Load what earlier runs verified.
+    vector<map<string, Record>> sidecars;
+    sidecars.resize(streams.size());
+    for (int64_t i = 0; i < streams.size(); ++i) {
+        LoadSidecar(streams[i], &sidecars[i]);
+    }
+
+    // Gather the files that need hashing, failing fast on wrong sizes.
+    vector<Job> jobs;
+    vector<bool> is_bad;
+    is_bad.resize(shards.size());
+    int64_t num_skipped = 0;
+    for (int64_t stream_id = 0; stream_id < streams.size(); ++stream_id) {
+        auto& stream = streams[stream_id];
+        auto& sidecar = sidecars[stream_id];
+        string dir = GetDir(stream);
+        for (int64_t i = stream.shard_offset(); i < stream.shard_offset() + stream.num_shards();
+             ++i) {
+            if (!(*is_present)[i]) {
+                continue;
+            }
+            bool to_memory = stream.unzip_to_memory() && !shards[i]->zip_algo().empty();
+            for (auto& pair : shards[i]->file_pairs()) {
+                for (auto file : {pair.first, pair.second}) {
+                    // Raw files of shards unzipped to memory are never on disk.
+                    if (!file || (to_memory && file == pair.first)) {
+                        continue;
+                    }
+
+                    struct stat info;
+                    if (stat((dir + file->path).c_str(), &info)) {
+                        // Zips may legitimately be absent. Raw files were just checked for.
+                        if (file == pair.first) {
+                            is_bad[i] = true;
+                        }
+                        continue;
+                    }
+                    if (info.st_size != file->num_bytes) {
+                        is_bad[i] = true;
+                        continue;
+                    }
+
+                    string algo;
+                    if (!stream.ChooseHashAlgo(file, &algo)) {
+                        if (stream.non_hashed_ok()) {
+                            continue;
+                        }
+                        string path = dir + file->path;
+                        *err = StringPrintf("File `%s` can't be hash validated with any of the "
+                                            "stream's hash algorithms.", path.c_str());
+                        return false;
+                    }
+
+                    Job job;
+                    job.shard_id = i;
+                    job.stream_id = stream_id;
+                    job.path = file->path;
+                    job.num_bytes = info.st_size;
+                    job.mtime = info.st_mtim.tv_sec * 1000000000L + info.st_mtim.tv_nsec;
+                    job.algo = algo;
+                    job.digest = file->hashes.at(algo);
+
+                    auto it = sidecar.find(job.path);
+                    if (it != sidecar.end()) {
+                        auto& record = it->second;
+                        if (record.num_bytes == job.num_bytes && record.mtime == job.mtime &&
+                                record.algo == job.algo && record.digest == job.digest) {
+                            ++num_skipped;
+                            continue;
+                        }
+                        sidecar.erase(it);
+                    }
+
+                    jobs.emplace_back(job);
+                }
+            }
+        }
+    }
+
+    // Hash in parallel.
+    {
+        auto scope2 = logger->Scope("init/caches/verify/hash");
+        atomic<int64_t> next{0};
+        vector<std::thread> threads;
+        threads.resize(num_threads_);
+        for (auto& thread : threads) {
+            thread = std::thread(HashThread, &jobs, &streams, &next);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Record successes, and evict any shards with a failure.
+    for (auto& job : jobs) {
+        if (job.ok) {
+            sidecars[job.stream_id][job.path] = {job.num_bytes, job.mtime, job.algo, job.digest};
+        } else {
+            is_bad[job.shard_id] = true;
+        }
+    }
+    int64_t num_bad = 0;
+    for (int64_t i = 0; i < shards.size(); ++i) {
+        if (!is_bad[i]) {
+            continue;
+        }
+        auto& stream = streams[shards[i]->stream_id()];
+        shards[i]->Evict(stream.local(), stream.split());
+        (*is_present)[i] = false;
+        ++num_bad;
+    }
+
+    // Forget about files that are gone.
+    for (int64_t i = 0; i < streams.size(); ++i) {
+        auto& sidecar = sidecars[i];
+        string dir = GetDir(streams[i]);
+        for (auto it = sidecar.begin(); it != sidecar.end(); ) {
+            struct stat info;
+            if (stat((dir + it->first).c_str(), &info)) {
+                it = sidecar.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        SaveSidecar(streams[i], sidecar, logger);
+    }
+
+    logger->Log(LogLevel::INFO, StringPrintf("[Verify] Hashed %ld files, skipped %ld already "
+                                             "verified, evicted %ld bad shards.",
+                                             (int64_t)jobs.size(), num_skipped, num_bad));
+    return true;
+}
+
+bool VerifyInMemory(const Stream& stream, const FileInfo* info, const MappedFile& file,
+                    string* err) {
+    if (file.size() != info->num_bytes) {
+        *err = StringPrintf("Raw file `%s` unzipped to %ld bytes, but expected %ld.",
+                            info->path.c_str(), file.size(), info->num_bytes);
+        return false;
+    }
+
+    string algo;
+    if (!stream.ChooseHashAlgo(info, &algo)) {
+        return true;
+    }
+    string expected;
+    if (!HexToBytes(info->hashes.at(algo), &expected)) {
+        *err = StringPrintf("Malformed `%s` digest of `%s` in index.", algo.c_str(),
+                            info->path.c_str());
+        return false;
+    }
+    string digest;
+    if (!HashData(file.data(), file.size(), algo, &digest, err)) {
+        return false;
+    }
+    if (digest != expected) {
+        *err = StringPrintf("Hash mismatch on `%s`.", info->path.c_str());
+        return false;
+    }
+    return true;
+}
+
+}  // namespace xtreaming
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "base/logger.h"
+#include "base/mmap.h"
+#include "serial/base/shard.h"
+#include "stream.h"
+
+using std::string;
+using std::vector;
+
+namespace xtreaming {
+
+// Checks cached shard files against the hashes in their index, in parallel.
+//
+// Each stream's hash algorithms are ranked; a file is checked with the first one that both the
+// stream and the index list. Digests are compared as raw bytes.
+//
+// Successful checks are recorded in a sidecar file in each stream's local split dir, keyed by
+// (path, size, mtime), so files verified by an earlier run are skipped instead of re-hashed.
+class Verifier {
+  public:
+    // Initialize with the number of hashing threads.
+    bool Init(int64_t num_threads, string* err);
+
+    // Verify the files of all present shards, evicting any shards that fail and marking them not
+    // present. Errors out if a shard can't be hashed and its stream requires hashing.
+    bool Verify(const vector<Stream>& streams, const vector<Shard*>& shards,
+                vector<bool>* is_present, Logger* logger, string* err) const;
+
+    // Basename of the sidecar file.
+    static const char* sidecar_basename() { return ".xtreaming_verified.json"; }
+
+  private:
+    int64_t num_threads_;  // Number of threads to hash with.
+};
+
+// Check a raw file unzipped to memory against its size, and its digest if the stream can hash it.
+// Such files are never on disk, so this is the only check their raw hashes get.
+bool VerifyInMemory(const Stream& stream, const FileInfo* info, const MappedFile& file,
+                    string* err);
+
+}  // namespace xtreaming
@@ -3,9 +3,11 @@
 #include <functional>
 #include <thread>
 
+#include "base/hash/xxhash.h"
 #include "base/string.h"
 #include "base/time.h"
 #include "base/xtensor.h"
+#include "cache/verifier.h"
 #include "determiner/all.h"
 #include "sampler/all.h"
 #include "serial/index.h"
@@ -15,6 +17,18 @@ using std::function;
 
 namespace xtreaming {
 
+Dataset::~Dataset() {
+    if (plan_ahead_thread_.joinable()) {
+        plan_ahead_thread_.join();
+    }
+
+    // Downloads decompress with the streams' dictionaries, so finish them before freeing those.
+    downloader_.Stop();
+    for (auto& zstd_dict : zstd_dicts_) {
+        delete zstd_dict;
+    }
+}
+
 bool Dataset::InitLogger(const json& obj, string* err) {
     json empty;
     const json* section;
@@ -164,11 +178,12 @@ bool Dataset::InitShards(string* err) {
         vector<std::thread> threads;
         threads.resize(streams_.size());
         shard_lists.resize(streams_.size());
+        zstd_dicts_.resize(streams_.size());
         vector<string> thread_errs;
         thread_errs.resize(streams_.size());
         for (int64_t i = 0; i < streams_.size(); ++i) {
-            threads[i] = std::thread(LoadIndex, i, &streams_[i], &shard_lists[i], &logger_,
-                                     &thread_errs[i]);
+            threads[i] = std::thread(LoadIndex, i, &streams_[i], &shard_lists[i],
+                                     &zstd_dicts_[i], &logger_, &thread_errs[i]);
         }
 
         // Join threads.
@@ -185,6 +200,13 @@ bool Dataset::InitShards(string* err) {
         }
     }
 
+    // Point each stream at its shared zstd dictionary, if any.
+    for (int64_t i = 0; i < streams_.size(); ++i) {
+        if (zstd_dicts_[i]) {
+            streams_[i].set_zstd_dict(zstd_dicts_[i]->ddict());
+        }
+    }
+
     // Allocate space for the global list of shards.
     {
         auto scope2 = logger_.Scope("init/shards/allocate_combined_shards");
@@ -253,16 +275,144 @@ bool Dataset::InitShardIndex(int64_t bucket_size, string* err) {
     return true;
 }
 
-bool Dataset::InitCaches(string* err) {
+bool Dataset::InitCaches(const json& obj, string* err) {
     auto scope = logger_.Scope("init/caches");
-    vector<bool> is_shard_present;
-    is_shard_present.resize(shards_.size());
+
+    json empty;
+    const json* section;
+    if (!GetObject(obj, "cache", &empty, &section, err)) {
+        return false;
+    }
+
+    int64_t max_open_files;
+    if (!GetInt64(*section, "max_open_files", 1024, &max_open_files, err)) {
+        return false;
+    }
+
+    int64_t max_mapped;
+    if (!GetBytes(*section, "max_mapped", -1L, &max_mapped, err)) {
+        return false;
+    }
+
+    // Shared memory on the node is named after the local caches it serves.
+    string key;
     for (auto& stream : streams_) {
-        stream.CheckLocalDir(shards_, &is_shard_present);
+        key += stream.local() + "/" + stream.split() + "\n";
+    }
+    string name = "/xtreaming-" + XXH64(key.data(), key.size());
+
+    // Optionally hold raw shard bytes in memory that every process on the node maps.
+    int64_t max_memory;
+    if (!GetBytes(*section, "memory", -1L, &max_memory, err)) {
+        return false;
+    }
+    MemoryCache* memory_cache = nullptr;
+    if (0 <= max_memory) {
+        if (!memory_cache_.Init(name + "-mem", max_memory, &shards_, &streams_, err)) {
+            return false;
+        }
+        memory_cache = &memory_cache_;
+    }
+
+    file_cache_.Init(max_open_files, max_mapped, memory_cache);
+
+    int64_t max_disk;
+    if (!GetBytes(*section, "disk", -1L, &max_disk, err)) {
+        return false;
+    }
+
+    string eviction;
+    if (!GetString(*section, "eviction", "belady", &eviction, err)) {
+        return false;
+    }
+    EvictionPolicy policy;
+    if (eviction == "lru") {
+        policy = EvictionPolicy::LRU;
+    } else if (eviction == "belady") {
+        policy = EvictionPolicy::BELADY;
+    } else {
+        *err = StringPrintf("`cache.eviction` must be `lru` or `belady` (got: `%s`).",
+                            eviction.c_str());
+        return false;
+    }
+
+    int64_t verify_threads;
+    int64_t default_verify_threads = std::thread::hardware_concurrency();
+    if (!GetInt64(*section, "verify_threads", default_verify_threads, &verify_threads, err)) {
+        return false;
+    }
+
+    Verifier verifier;
+    if (!verifier.Init(verify_threads, err)) {
+        return false;
+    }
+
+    is_shard_present_.resize(shards_.size());
+    for (auto& stream : streams_) {
+        stream.CheckLocalDir(shards_, &is_shard_present_);
+    }
+
+    if (!verifier.Verify(streams_, shards_, &is_shard_present_, &logger_, err)) {
+        return false;
+    }
+
+    // Processes on the node using the same local caches share one shard state table, so that each
+    // shard is downloaded once per node.
+    if (!GetBool(*section, "share_states", true, &share_shard_states_, err)) {
+        return false;
+    }
+
+    // Keep what is cached on disk within budget, evicting least recently used shards.
+    ShardStates* states = share_shard_states_ ? &shard_states_ : nullptr;
+    disk_cache_.Init(max_disk, policy, &shards_, &streams_, is_shard_present_, states,
+                     &file_cache_, &logger_);
+
+    if (!share_shard_states_) {
+        return true;
+    }
+    if (!shard_states_.Init(name, shards_.size(), err)) {
+        return false;
+    }
+    for (int64_t i = 0; i < shards_.size(); ++i) {
+        if (is_shard_present_[i]) {
+            shard_states_.MarkPresent(i);
+        }
     }
     return true;
 }
 
+bool Dataset::InitDownloader(const json& obj, string* err) {
+    auto scope = logger_.Scope("init/downloader");
+
+    json empty;
+    const json* section;
+    if (!GetObject(obj, "downloader", &empty, &section, err)) {
+        return false;
+    }
+
+    ShardStates* states = share_shard_states_ ? &shard_states_ : nullptr;
+    if (!downloader_.Init(*section, &streams_, states, &logger_, err)) {
+        return false;
+    }
+
+    int64_t prefetch;
+    if (!GetInt64(*section, "prefetch", 1024, &prefetch, err)) {
+        return false;
+    }
+
+    double partial_fraction;
+    if (!GetDouble(*section, "partial_fraction", 0.25, &partial_fraction, err)) {
+        return false;
+    }
+
+    if (!GetBool(*section, "plan_ahead", true, &plan_ahead_, err)) {
+        return false;
+    }
+
+    return prefetcher_.Init(prefetch, partial_fraction, &shards_, is_shard_present_, &downloader_,
+                            &disk_cache_, &logger_, err);
+}
+
 bool Dataset::Init(const json& obj, string* err) {
     if (!InitLogger(obj, err)) {
         return false;
@@ -282,7 +432,8 @@ bool Dataset::Init(const json& obj, string* err) {
         [&]{ return InitShardIndex(bucket_size, err); },
         [&]{ return Stream::DeriveSampling(&streams_, relative_weights, sampler_->seed(),
                                            sampler_->mutable_epoch_size(), &logger_, err); },
-        [&]{ return InitCaches(err); },
+        [&]{ return InitCaches(obj, err); },
+        [&]{ return InitDownloader(obj, err); },
     };
 
     for (auto& stage : stages) {
@@ -310,11 +461,30 @@ void Map(const vector<int64_t>& mapping, xt::xarray<int64_t>* ids) {
     }
 }
 
-}  // namespace
+// Get this worker's slice of an epoch's sample IDs.
+const int64_t* GetWorkerSampleIDs(const xt::xarray<int64_t>& sample_ids, int64_t* num_samples) {
+    int64_t node = 0;
+    int64_t rank_of_node = 0;
+    int64_t worker_of_rank = 0;
+    auto& shape = sample_ids.shape();
+    *num_samples = shape[3] * shape[4];
+    int64_t worker = (node * shape[1] + rank_of_node) * shape[2] + worker_of_rank;
+    return &sample_ids.data()[worker * *num_samples];
+}
 
-bool Dataset::Iter() {
-    auto scope = logger_.Scope("iter");
+// Get this node's slice of an epoch's sample IDs, as one run per worker.
+const int64_t* GetNodeSampleIDs(const xt::xarray<int64_t>& sample_ids, int64_t* num_workers,
+                                int64_t* num_samples) {
+    int64_t node = 0;
+    auto& shape = sample_ids.shape();
+    *num_workers = shape[1] * shape[2];
+    *num_samples = shape[3] * shape[4];
+    return &sample_ids.data()[node * *num_workers * *num_samples];
+}
 
+}  // namespace
+
+bool Dataset::PlanEpoch(int64_t epoch, xt::xarray<int64_t>* sample_ids, string* err) {
     // Sample each shard of each stream according to its weight.
     //
     // This gives us:
@@ -325,7 +495,6 @@ bool Dataset::Iter() {
     // as to not perserverate and tank the model. These are called subshards.
     //
     // Do this work in parallel. Its results aren't immediately needed.
-    int64_t epoch = 0;
     vector<int64_t> subshard_sizes;
     vector<int64_t> fake_to_real;
     auto sampling_thread = std::thread(&Dataset::SampleThread, this, epoch, &subshard_sizes,
@@ -337,17 +506,15 @@ bool Dataset::Iter() {
     // This gives us:
     // * Tensor of shape (num physical nodes, ranks per node, workers per rank, batches per worker,
     //   samples per batch).
-    xt::xarray<int64_t> sample_ids;
     int64_t num_physical_nodes = 16;
     int64_t ranks_per_node = 5;
     int64_t workers_per_rank = 7;
     int64_t sample_offset = 256;
     {
-        auto scope2 = logger_.Scope("iter/determine");
-        string err;
+        auto scope = logger_.Scope("iter/determine");
         if (!determiner_->Determine(num_physical_nodes, ranks_per_node, workers_per_rank,
-                                    sampler_->epoch_size(), sample_offset, &sample_ids, &err)) {
-            fprintf(stderr, "%s\n", err.c_str());
+                                    sampler_->epoch_size(), sample_offset, sample_ids, err)) {
+            sampling_thread.join();
             return false;
         }
     }
@@ -357,7 +524,7 @@ bool Dataset::Iter() {
 
     // If we need to shuffle, shuffle in a node-aware and *underlying* shard-aware way.
     if (shuffle_) {
-        auto scope2 = logger_.Scope("iter/shuffle");
+        auto scope = logger_.Scope("iter/shuffle");
 
         // Generate the sample ID mapping.
         vector<int64_t> shuffle;
@@ -366,19 +533,128 @@ bool Dataset::Iter() {
 
         // Appply that mapping.
         {
-            auto scope3 = logger_.Scope("iter/shuffle/map");
-            Map(shuffle, &sample_ids);
+            auto scope2 = logger_.Scope("iter/shuffle/map");
+            Map(shuffle, sample_ids);
         }
     }
 
     // Now that twe have partitioned and shuffled with fake resampled sample IDs, we don't need
     // them anymore, and now convert back to their underlying physical sample IDs.
     {
-        auto scope2 = logger_.Scope("iter/map");
-        Map(fake_to_real, &sample_ids);
+        auto scope = logger_.Scope("iter/map");
+        Map(fake_to_real, sample_ids);
     }
 
     return true;
 }
 
+void Dataset::PlanAheadThread() {
+    auto scope = logger_.Scope("iter/plan_ahead");
+    string err;
+    is_next_planned_ = PlanEpoch(next_epoch_, &next_sample_ids_, &err);
+    if (!is_next_planned_) {
+        logger_.Log(LogLevel::WARN, StringPrintf("Unable to plan epoch %ld ahead: %s",
+                                                 next_epoch_, err.c_str()));
+        return;
+    }
+
+    int64_t num_samples;
+    auto ids = GetWorkerSampleIDs(next_sample_ids_, &num_samples);
+    prefetcher_.PlanNext(ids, num_samples, shard_index_);
+}
+
+bool Dataset::Iter(int64_t epoch) {
+    auto scope = logger_.Scope("iter");
+
+    // Use this epoch's plan if it was already made in the background.
+    xt::xarray<int64_t> sample_ids;
+    bool is_planned = false;
+    if (plan_ahead_thread_.joinable()) {
+        plan_ahead_thread_.join();
+        if (next_epoch_ == epoch && is_next_planned_) {
+            sample_ids = std::move(next_sample_ids_);
+            is_planned = true;
+        }
+        is_next_planned_ = false;
+    }
+    if (!is_planned) {
+        string err;
+        if (!PlanEpoch(epoch, &sample_ids, &err)) {
+            fprintf(stderr, "%s\n", err.c_str());
+            return false;
+        }
+    }
+
+    // Tell the disk cache when the node will next need each shard.
+    {
+        auto scope2 = logger_.Scope("iter/plan_eviction");
+        int64_t num_workers;
+        int64_t num_samples;
+        auto ids = GetNodeSampleIDs(sample_ids, &num_workers, &num_samples);
+        disk_cache_.Plan(ids, num_workers, num_samples, sample_ids.shape()[4], shard_index_);
+    }
+
+    // Plan which shards to fetch ahead of this worker, in the order it will first need them.
+    {
+        auto scope2 = logger_.Scope("iter/plan_prefetch");
+        int64_t num_samples;
+        auto ids = GetWorkerSampleIDs(sample_ids, &num_samples);
+        prefetcher_.Plan(ids, num_samples, shard_index_);
+    }
+
+    logger_.Log(LogLevel::INFO, StringPrintf("[Cache] Disk: %ld bytes in %ld shards (%ld reserved, "
+                                             "budget %ld), %ld evicted so far.",
+                                             disk_cache_.num_bytes(), disk_cache_.num_shards(),
+                                             disk_cache_.num_reserved(), disk_cache_.max_bytes(),
+                                             disk_cache_.num_evicted()));
+    if (0 <= memory_cache_.max_bytes()) {
+        logger_.Log(LogLevel::INFO, StringPrintf("[Cache] Memory: %ld bytes (budget %ld) on the "
+                                                 "node, %ld hits, %ld fills, %ld evicted, %ld "
+                                                 "that didn't fit.", memory_cache_.num_bytes(),
+                                                 memory_cache_.max_bytes(),
+                                                 memory_cache_.num_hits(),
+                                                 memory_cache_.num_fills(),
+                                                 memory_cache_.num_evicted(),
+                                                 memory_cache_.num_rejected()));
+    }
+
+    // Get a head start on the next epoch.
+    if (plan_ahead_) {
+        next_epoch_ = epoch + 1;
+        plan_ahead_thread_ = std::thread(&Dataset::PlanAheadThread, this);
+    }
+
+    return true;
+}
+
+void Dataset::Advance(int64_t position) {
+    prefetcher_.Advance(position);
+}
+
+bool Dataset::AcquireShard(int64_t shard_id, const FileCacheEntry** entry, string* err) {
+    if (shard_id < 0 || shards_.size() <= shard_id) {
+        *err = StringPrintf("Shard ID %ld is out of range (have %ld shards).", shard_id,
+                            (int64_t)shards_.size());
+        return false;
+    }
+
+    if (!prefetcher_.Wait(shard_id, err)) {
+        return false;
+    }
+
+    *entry = nullptr;
+    if (!prefetcher_.is_present(shard_id)) {
+        return true;
+    }
+
+    auto shard = shards_[shard_id];
+    return file_cache_.Acquire(shard_id, shard, streams_[shard->stream_id()], entry, err);
+}
+
+void Dataset::ReleaseShard(const FileCacheEntry* entry) {
+    if (entry) {
+        file_cache_.Release(entry);
+    }
+}
+
 }  // namespace xtreaming
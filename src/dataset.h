@@ -1,11 +1,19 @@
 #pragma once
 
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "base/json.h"
 #include "base/logger.h"
 #include "base/spanner.h"
+#include "base/xtensor.h"
+#include "cache/disk_cache.h"
+#include "cache/downloader.h"
+#include "cache/file_cache.h"
+#include "cache/memory_cache.h"
+#include "cache/prefetcher.h"
+#include "cache/shard_states.h"
 #include "determiner/determiner.h"
 #include "serial/base/shard.h"
 #include "sampler/sampler.h"
@@ -19,9 +27,31 @@ namespace xtreaming {
 
 class Dataset {
   public:
+    // Waits for any planning still running in the background, cancels queued downloads and waits
+    // for those under way, then frees the zstd dictionaries.
+    ~Dataset();
+
     bool Init(const json& obj, string* err);
 
-    bool Iter();
+    // Plan the given epoch and start prefetching for it. With `downloader.plan_ahead`, the next
+    // epoch is then planned in the background, so that its first shards are fetched as this one
+    // winds down, and its Iter() can reuse that plan.
+    bool Iter(int64_t epoch);
+
+    // Note that this worker has consumed this many of the epoch's sample IDs, which slides the
+    // prefetch window along and tells the disk cache how far the node has got.
+    void Advance(int64_t position);
+
+    // Get a shard's mapped raw files, waiting for it to be downloaded first if need be. Pins them
+    // until the matching ReleaseShard(). Gets no entry for a shard fetched only partially, whose
+    // planned samples are read from its partial copy instead.
+    bool AcquireShard(int64_t shard_id, const FileCacheEntry** entry, string* err);
+
+    // Unpin a shard's files.
+    void ReleaseShard(const FileCacheEntry* entry);
+
+    // Shards cached on local disk, for monitoring usage.
+    const DiskCache& disk_cache() const { return disk_cache_; }
 
   private:
     bool InitLogger(const json& obj, string* err);
@@ -32,19 +62,41 @@ class Dataset {
     bool InitStreams(const json& obj, string* err);
     bool InitShards(string* err);
     bool InitShardIndex(int64_t bucket_size, string* err);
-    bool InitCaches(string* err);
+    bool InitCaches(const json& obj, string* err);
+    bool InitDownloader(const json& obj, string* err);
 
     void SampleThread(int64_t epoch, vector<int64_t>* subshard_sizes,
                       vector<int64_t>* fake_to_real);
 
+    // Get the global sample ordering of an epoch, shaped (nodes, ranks per node, workers per rank,
+    // batches per worker, samples per batch).
+    bool PlanEpoch(int64_t epoch, xt::xarray<int64_t>* sample_ids, string* err);
+
+    // Plan the next epoch in the background, handing it to the prefetcher.
+    void PlanAheadThread();
+
     Logger logger_;
     vector<Stream> streams_;
     vector<Shard*> shards_;
+    vector<ZstdDict*> zstd_dicts_;
     Spanner shard_index_;
     Sampler* sampler_;
     Determiner* determiner_;
     bool shuffle_;
     Shuffler* shuffler_;
+    MemoryCache memory_cache_;
+    FileCache file_cache_;
+    vector<bool> is_shard_present_;
+    ShardStates shard_states_;
+    bool share_shard_states_;
+    DiskCache disk_cache_;
+    Downloader downloader_;
+    Prefetcher prefetcher_;
+    bool plan_ahead_;
+    std::thread plan_ahead_thread_;
+    int64_t next_epoch_{-1};
+    xt::xarray<int64_t> next_sample_ids_;
+    bool is_next_planned_{false};
 };
 
 }  // namespace xtreaming
@@ -36,7 +36,7 @@ int main() {
         return 3;
     }
 
-    assert(dataset.Iter());
+    assert(dataset.Iter(0));
 
     // Sleep.
     // std::this_thread::sleep_for(60s);
@@ -0,0 +1,24 @@
+#include "all.h"
+
+#include "base/string.h"
+#include "remote/local.h"
+#include "remote/mock.h"
+
+namespace xtreaming {
+
+Remote* GetRemote(const string& remote, string* err) {
+    size_t index = remote.find("://");
+    string scheme = index == string::npos ? "" : remote.substr(0, index);
+
+    if (scheme.empty() || scheme == "file") {
+        return LocalRemote::New(remote, err);
+    } else if (scheme == "mock") {
+        return MockRemote::New(remote, err);
+    } else {
+        *err = StringPrintf("Unsupported remote scheme: `%s` (remote: `%s`).", scheme.c_str(),
+                            remote.c_str());
+        return nullptr;
+    }
+}
+
+}  // namespace xtreaming
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+
+#include "remote/remote.h"
+
+using std::string;
+
+namespace xtreaming {
+
+// Get the backend for a remote path or URL, according to its scheme.
+Remote* GetRemote(const string& remote, string* err);
+
+}  // namespace xtreaming
@@ -0,0 +1,216 @@
+#include "local.h"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "base/file.h"
+#include "base/string.h"
+#include "base/time.h"
+
+using std::vector;
+
+namespace xtreaming {
+namespace {
+
+const int64_t kCopyChunkSize = 64L << 20;  // Bytes per copy_file_range call, between deadline
+                                           // checks.
+const int64_t kBufferSize = 1L << 20;      // Bytes per read when copying or fetching in userspace.
+
+// Copy the whole of `in_fd` (`size` bytes) to `out_fd`, fastest way first.
+bool CopyData(int in_fd, int out_fd, int64_t size, const string& src, const string& dst,
+              int64_t deadline, string* err) {
+    // A reflink shares the source's extents outright, copying nothing.
+    if (!ioctl(out_fd, FICLONE, in_fd)) {
+        return true;
+    }
+
+    bool in_kernel = true;
+    vector<char> buf;
+    int64_t offset = 0;
+    while (offset < size) {
+        if (deadline < NanoTime()) {
+            *err = StringPrintf("Timed out copying `%s` to `%s`.", src.c_str(), dst.c_str());
+            return false;
+        }
+
+        int64_t chunk_size = size - offset;
+        ssize_t num_copied;
+        if (in_kernel) {
+            if (kCopyChunkSize < chunk_size) {
+                chunk_size = kCopyChunkSize;
+            }
+            num_copied = copy_file_range(in_fd, nullptr, out_fd, nullptr, chunk_size, 0);
+
+            // Fall back to userspace if the kernel or filesystem pair can't do it.
+            if (num_copied < 0 && !offset && (errno == EXDEV || errno == ENOSYS ||
+                                              errno == EINVAL || errno == EOPNOTSUPP)) {
+                in_kernel = false;
+                continue;
+            }
+        } else {
+            if (kBufferSize < chunk_size) {
+                chunk_size = kBufferSize;
+            }
+            buf.resize(kBufferSize);
+            num_copied = read(in_fd, buf.data(), chunk_size);
+            if (0 < num_copied && !WriteAll(out_fd, buf.data(), num_copied)) {
+                *err = StringPrintf("Unable to write file: `%s` (%s).", dst.c_str(),
+                                    strerror(errno));
+                return false;
+            }
+        }
+
+        if (num_copied < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *err = StringPrintf("Unable to copy `%s` to `%s` (%s).", src.c_str(), dst.c_str(),
+                                strerror(errno));
+            return false;
+        }
+        if (!num_copied) {
+            *err = StringPrintf("File shrank while being copied: `%s`.", src.c_str());
+            return false;
+        }
+        offset += num_copied;
+    }
+
+    return true;
+}
+
+// Stream `size` bytes of a file from `offset` (or the rest of it, if -1) into a sink, which is
+// closed on success and aborted on failure.
+bool SendFile(const string& src, int64_t offset, int64_t size, ByteSink* sink, int64_t deadline,
+              string* err) {
+    int fd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        *err = StringPrintf("Unable to open file: `%s` (%s).", src.c_str(), strerror(errno));
+        sink->Abort();
+        return false;
+    }
+
+    vector<char> buf(kBufferSize);
+    int64_t end = size < 0 ? -1 : offset + size;
+    while (end < 0 || offset < end) {
+        if (deadline < NanoTime()) {
+            *err = StringPrintf("Timed out fetching `%s`.", src.c_str());
+            close(fd);
+            sink->Abort();
+            return false;
+        }
+        int64_t chunk_size = buf.size();
+        if (0 <= end && end - offset < chunk_size) {
+            chunk_size = end - offset;
+        }
+        ssize_t num_read = pread(fd, buf.data(), chunk_size, offset);
+        if (num_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *err = StringPrintf("Unable to read file: `%s` (%s).", src.c_str(), strerror(errno));
+            close(fd);
+            sink->Abort();
+            return false;
+        }
+        if (!num_read) {
+            if (end < 0) {
+                break;
+            }
+            *err = StringPrintf("File `%s` ended before byte %ld.", src.c_str(), end);
+            close(fd);
+            sink->Abort();
+            return false;
+        }
+        if (!sink->Write(buf.data(), num_read, err)) {
+            close(fd);
+            sink->Abort();
+            return false;
+        }
+        offset += num_read;
+    }
+
+    close(fd);
+    return sink->Close(err);
+}
+
+}  // namespace
+
+LocalRemote* LocalRemote::New(const string& remote, string* err) {
+    string root = remote;
+    if (!root.compare(0, 7, "file://")) {
+        root = root.substr(7);
+    }
+
+    struct stat info;
+    if (stat(root.c_str(), &info) || !S_ISDIR(info.st_mode)) {
+        *err = StringPrintf("Remote is not a directory: `%s`.", root.c_str());
+        return nullptr;
+    }
+
+    auto ret = new LocalRemote;
+    ret->root_ = root;
+    return ret;
+}
+
+bool LocalRemote::Download(const string& path, const string& local_path, int64_t deadline,
+                           string* err) const {
+    string src = root_ + "/" + path;
+    int in_fd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in_fd == -1) {
+        *err = StringPrintf("Unable to open file: `%s` (%s).", src.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat info;
+    if (fstat(in_fd, &info)) {
+        *err = StringPrintf("Unable to stat file: `%s` (%s).", src.c_str(), strerror(errno));
+        close(in_fd);
+        return false;
+    }
+
+    string tmp_path = local_path + ".tmp";
+    int out_fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out_fd == -1) {
+        *err = StringPrintf("Unable to open file: `%s` (%s).", tmp_path.c_str(), strerror(errno));
+        close(in_fd);
+        return false;
+    }
+
+    bool ok = CopyData(in_fd, out_fd, info.st_size, src, tmp_path, deadline, err);
+    close(in_fd);
+
+    if (close(out_fd) && ok) {
+        *err = StringPrintf("Unable to write file: `%s` (%s).", tmp_path.c_str(), strerror(errno));
+        ok = false;
+    }
+
+    if (ok && rename(tmp_path.c_str(), local_path.c_str())) {
+        *err = StringPrintf("Unable to rename `%s` to `%s` (%s).", tmp_path.c_str(),
+                            local_path.c_str(), strerror(errno));
+        ok = false;
+    }
+
+    if (!ok) {
+        unlink(tmp_path.c_str());
+    }
+    return ok;
+}
+
+bool LocalRemote::Fetch(const string& path, ByteSink* sink, int64_t deadline,
+                        string* err) const {
+    return SendFile(root_ + "/" + path, 0, -1, sink, deadline, err);
+}
+
+bool LocalRemote::FetchRange(const string& path, int64_t offset, int64_t size, ByteSink* sink,
+                             int64_t deadline, string* err) const {
+    return SendFile(root_ + "/" + path, offset, size, sink, deadline, err);
+}
+
+}  // namespace xtreaming
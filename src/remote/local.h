@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "remote/remote.h"
+
+using std::string;
+
+namespace xtreaming {
+
+// Remote that is a directory on a filesystem we can see, such as a shared network mount.
+//
+// Downloads clone the file if the filesystem supports reflinks, else copy it in the kernel with
+// copy_file_range, else fall back to read/write.
+class LocalRemote : public Remote {
+  public:
+    // Serve files under a plain path or a `file://` URL.
+    static LocalRemote* New(const string& remote, string* err);
+
+    virtual bool Download(const string& path, const string& local_path, int64_t deadline,
+                          string* err) const override;
+
+    virtual bool Fetch(const string& path, ByteSink* sink, int64_t deadline,
+                       string* err) const override;
+
+    virtual bool FetchRange(const string& path, int64_t offset, int64_t size, ByteSink* sink,
+                            int64_t deadline, string* err) const override;
+
+  private:
+    string root_;  // Directory the remote paths are relative to.
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,321 @@
+#include "mock.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "base/file.h"
+#include "base/string.h"
+#include "base/time.h"
+
+using std::vector;
+
+namespace xtreaming {
+namespace {
+
+const int64_t kChunkSize = 64L << 10;  // Bytes sent at a time, between throttling and checks.
+
+// Writes a fetched file to a temporary path, renaming it into place on success.
+class FileSink : public ByteSink {
+  public:
+    ~FileSink() {
+        if (fd_ != -1) {
+            Abort();
+        }
+    }
+
+    bool Init(const string& path, string* err) {
+        path_ = path;
+        tmp_path_ = path + ".tmp";
+        fd_ = open(tmp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ == -1) {
+            *err = StringPrintf("Unable to open file: `%s` (%s).", tmp_path_.c_str(),
+                                strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    virtual bool Write(const char* data, int64_t size, string* err) override {
+        if (!WriteAll(fd_, data, size)) {
+            *err = StringPrintf("Unable to write file: `%s` (%s).", tmp_path_.c_str(),
+                                strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    virtual bool Close(string* err) override {
+        int fd = fd_;
+        fd_ = -1;
+        if (close(fd)) {
+            *err = StringPrintf("Unable to write file: `%s` (%s).", tmp_path_.c_str(),
+                                strerror(errno));
+            unlink(tmp_path_.c_str());
+            return false;
+        }
+        if (rename(tmp_path_.c_str(), path_.c_str())) {
+            *err = StringPrintf("Unable to rename `%s` to `%s` (%s).", tmp_path_.c_str(),
+                                path_.c_str(), strerror(errno));
+            unlink(tmp_path_.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    virtual void Abort() override {
+        if (fd_ != -1) {
+            close(fd_);
+            fd_ = -1;
+        }
+        unlink(tmp_path_.c_str());
+    }
+
+  private:
+    string path_;      // Where it goes.
+    string tmp_path_;  // Where it is written.
+    int fd_{-1};       // Open temporary file.
+};
+
+// Sleep until `when`, or just until `deadline` if that's sooner. Returns whether we made it.
+bool SleepUntil(int64_t when, int64_t deadline) {
+    bool ok = when <= deadline;
+    int64_t until = ok ? when : deadline;
+    int64_t now = NanoTime();
+    if (now < until) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(until - now));
+    }
+    return ok;
+}
+
+}  // namespace
+
+MockRemote* MockRemote::New(const string& remote, string* err) {
+    if (remote.compare(0, 7, "mock://")) {
+        *err = StringPrintf("Mock remote must start with `mock://` (got: `%s`).", remote.c_str());
+        return nullptr;
+    }
+
+    size_t index = remote.find('?');
+    string root = remote.substr(7, index == string::npos ? string::npos : index - 7);
+    struct stat info;
+    if (stat(root.c_str(), &info) || !S_ISDIR(info.st_mode)) {
+        *err = StringPrintf("Remote is not a directory: `%s`.", root.c_str());
+        return nullptr;
+    }
+
+    auto ret = new MockRemote;
+    ret->root_ = root;
+    if (index == string::npos) {
+        return ret;
+    }
+
+    vector<string> params;
+    SplitString(remote.substr(index + 1), '&', &params);
+    for (auto& param : params) {
+        size_t eq = param.find('=');
+        string key = param.substr(0, eq);
+        string value = eq == string::npos ? "" : param.substr(eq + 1);
+        bool ok;
+        string parse_err;
+        if (key == "latency") {
+            ok = ParseTime(value, &ret->latency_, &parse_err) && 0 <= ret->latency_;
+        } else if (key == "jitter") {
+            ok = ParseFloat(value, &ret->jitter_) && 0 <= ret->jitter_;
+        } else if (key == "bandwidth") {
+            ok = ParseBytes(value, &ret->bandwidth_, &parse_err) && 0 <= ret->bandwidth_;
+        } else if (key == "error_rate") {
+            ok = ParseFloat(value, &ret->error_rate_) && 0 <= ret->error_rate_ &&
+                 ret->error_rate_ <= 1;
+        } else if (key == "stall_rate") {
+            ok = ParseFloat(value, &ret->stall_rate_) && 0 <= ret->stall_rate_ &&
+                 ret->stall_rate_ <= 1;
+        } else if (key == "stall") {
+            ok = ParseTime(value, &ret->stall_, &parse_err) && 0 <= ret->stall_;
+        } else if (key == "seed") {
+            int64_t seed;
+            ok = ParseInt(value, &seed);
+            ret->seed_ = seed;
+        } else {
+            *err = StringPrintf("Unknown mock remote parameter `%s` (remote: `%s`).", key.c_str(),
+                                remote.c_str());
+            delete ret;
+            return nullptr;
+        }
+        if (!ok) {
+            *err = StringPrintf("Invalid mock remote parameter `%s` (remote: `%s`).",
+                                param.c_str(), remote.c_str());
+            delete ret;
+            return nullptr;
+        }
+    }
+    return ret;
+}
+
+MockRemote::Fate MockRemote::NextFate(const string& path) const {
+    int64_t request_id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        request_id = num_requests_[path]++;
+    }
+
+    uint64_t path_hash = std::hash<string>()(path);
+    std::seed_seq seq = {(uint32_t)seed_, (uint32_t)(seed_ >> 32), (uint32_t)path_hash,
+                         (uint32_t)(path_hash >> 32), (uint32_t)request_id};
+    std::mt19937_64 rng(seq);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> normal;
+
+    // Draw everything every time, so that changing one rate doesn't reshuffle the rest.
+    Fate fate;
+    double latency = latency_ * exp(jitter_ * normal(rng));
+    fate.latency_ns = (int64_t)(latency * 1e9);
+    bool is_error = uniform(rng) < error_rate_;
+    double error_at = uniform(rng);
+    fate.error_at = is_error ? error_at : -1;
+    bool is_stall = uniform(rng) < stall_rate_;
+    double stall_at = uniform(rng);
+    fate.stall_at = is_stall ? stall_at : -1;
+    return fate;
+}
+
+bool MockRemote::Download(const string& path, const string& local_path, int64_t deadline,
+                          string* err) const {
+    return DownloadFile(path, local_path, false, deadline, err);
+}
+
+bool MockRemote::CanBatch() const {
+    return true;
+}
+
+bool MockRemote::DownloadBatch(const vector<string>& paths, const vector<string>& local_paths,
+                               int64_t deadline, vector<string>* errs) const {
+    bool ok = true;
+    errs->clear();
+    errs->resize(paths.size());
+    for (int64_t i = 0; i < paths.size(); ++i) {
+        if (!DownloadFile(paths[i], local_paths[i], 0 < i, deadline, &(*errs)[i])) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool MockRemote::DownloadFile(const string& path, const string& local_path, bool is_pipelined,
+                              int64_t deadline, string* err) const {
+    FileSink sink;
+    if (!sink.Init(local_path, err)) {
+        return false;
+    }
+    return Send(path, 0, -1, is_pipelined, &sink, deadline, err);
+}
+
+bool MockRemote::Fetch(const string& path, ByteSink* sink, int64_t deadline, string* err) const {
+    return Send(path, 0, -1, false, sink, deadline, err);
+}
+
+bool MockRemote::FetchRange(const string& path, int64_t offset, int64_t size, ByteSink* sink,
+                            int64_t deadline, string* err) const {
+    return Send(path, offset, size, false, sink, deadline, err);
+}
+
+bool MockRemote::Send(const string& path, int64_t begin, int64_t size, bool is_pipelined,
+                      ByteSink* sink, int64_t deadline, string* err) const {
+    auto fate = NextFate(path);
+    int64_t start = NanoTime();
+
+    string src = root_ + "/" + path;
+    int fd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        *err = StringPrintf("Unable to open file: `%s` (%s).", src.c_str(), strerror(errno));
+        sink->Abort();
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info)) {
+        *err = StringPrintf("Unable to stat file: `%s` (%s).", src.c_str(), strerror(errno));
+        close(fd);
+        sink->Abort();
+        return false;
+    }
+    int64_t end = size < 0 ? info.st_size : begin + size;
+    if (info.st_size < end) {
+        *err = StringPrintf("File `%s` ended before byte %ld.", src.c_str(), end);
+        close(fd);
+        sink->Abort();
+        return false;
+    }
+    int64_t error_at = fate.error_at < 0 ? -1 : begin + (int64_t)(fate.error_at * (end - begin));
+    int64_t stall_at = fate.stall_at < 0 ? -1 : begin + (int64_t)(fate.stall_at * (end - begin));
+
+    bool ok = is_pipelined || SleepUntil(start + fate.latency_ns, deadline);
+    if (!ok) {
+        *err = StringPrintf("Timed out waiting for `%s`.", src.c_str());
+    }
+
+    // Send it a chunk at a time, never ahead of the bandwidth cap.
+    vector<char> buf(kChunkSize);
+    int64_t sent_start = NanoTime();
+    int64_t offset = begin;
+    while (ok && offset < end) {
+        if (offset <= stall_at && stall_at < offset + kChunkSize &&
+                !SleepUntil(NanoTime() + (int64_t)(stall_ * 1e9), deadline)) {
+            *err = StringPrintf("Timed out fetching `%s` (stalled).", src.c_str());
+            ok = false;
+            break;
+        }
+        if (offset <= error_at && error_at < offset + kChunkSize) {
+            *err = StringPrintf("Injected error fetching `%s` at byte %ld of %ld.", src.c_str(),
+                                error_at, info.st_size);
+            ok = false;
+            break;
+        }
+
+        int64_t chunk_size = end - offset < kChunkSize ? end - offset : kChunkSize;
+        if (bandwidth_) {
+            int64_t when = sent_start + (int64_t)((offset - begin + chunk_size) * 1e9 / bandwidth_);
+            if (!SleepUntil(when, deadline)) {
+                *err = StringPrintf("Timed out fetching `%s`.", src.c_str());
+                ok = false;
+                break;
+            }
+        } else if (deadline < NanoTime()) {
+            *err = StringPrintf("Timed out fetching `%s`.", src.c_str());
+            ok = false;
+            break;
+        }
+
+        ssize_t num_read = pread(fd, buf.data(), chunk_size, offset);
+        if (num_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (num_read <= 0) {
+            *err = num_read ? StringPrintf("Unable to read file: `%s` (%s).", src.c_str(),
+                                           strerror(errno)) :
+                StringPrintf("File shrank while being fetched: `%s`.", src.c_str());
+            ok = false;
+            break;
+        }
+        ok = sink->Write(buf.data(), num_read, err);
+        offset += num_read;
+    }
+
+    close(fd);
+    if (!ok) {
+        sink->Abort();
+        return false;
+    }
+    return sink->Close(err);
+}
+
+}  // namespace xtreaming
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "remote/remote.h"
+
+using std::string;
+using std::unordered_map;
+
+namespace xtreaming {
+
+// Remote that serves a local directory like object storage would: slowly and unreliably.
+//
+// For benchmarking prefetching, retries and timeouts without a real bucket. Configured by query
+// parameters, as in `mock:///data/c4?latency=50ms&jitter=0.5&bandwidth=100mb&error_rate=0.01`:
+// * latency: Median time to first byte of each request (default: 0s).
+// * jitter: Spread of latency, which is lognormal with this sigma (default: 0, i.e. fixed).
+// * bandwidth: Bytes per second per request (default: 0, i.e. unlimited).
+// * error_rate: Chance a request fails partway through (default: 0).
+// * stall_rate: Chance a request stalls partway through (default: 0).
+// * stall: How long a stall lasts, hitting the deadline if longer (default: 1m).
+// * seed: Seeds the injected behavior (default: 1337).
+//
+// A batched download pays the latency once, as if its requests were pipelined on one connection,
+// but each file still gets its own errors and stalls.
+//
+// What happens to a request is drawn from the seed, the path, and how many requests for that path
+// came before, so a run replays the same way regardless of thread timing.
+class MockRemote : public Remote {
+  public:
+    // Serve files under the directory of a `mock://` URL.
+    static MockRemote* New(const string& remote, string* err);
+
+    virtual bool Download(const string& path, const string& local_path, int64_t deadline,
+                          string* err) const override;
+
+    virtual bool CanBatch() const override;
+
+    virtual bool DownloadBatch(const vector<string>& paths, const vector<string>& local_paths,
+                               int64_t deadline, vector<string>* errs) const override;
+
+    virtual bool Fetch(const string& path, ByteSink* sink, int64_t deadline,
+                       string* err) const override;
+
+    virtual bool FetchRange(const string& path, int64_t offset, int64_t size, ByteSink* sink,
+                            int64_t deadline, string* err) const override;
+
+  private:
+    // What will go wrong with one request.
+    struct Fate {
+        int64_t latency_ns;  // Delay before the first byte.
+        double error_at;     // Fraction of the file after which it fails, or negative for never.
+        double stall_at;     // Fraction of the file after which it stalls, or negative for never.
+    };
+
+    // Draw the fate of the next request for a path.
+    Fate NextFate(const string& path) const;
+
+    // Serve `size` bytes of a file from `offset` (or the rest of it, if -1) as configured, with or
+    // without the latency of a new request.
+    bool Send(const string& path, int64_t offset, int64_t size, bool is_pipelined, ByteSink* sink,
+              int64_t deadline, string* err) const;
+
+    // Download to a local path, with or without the latency of a new request.
+    bool DownloadFile(const string& path, const string& local_path, bool is_pipelined,
+                      int64_t deadline, string* err) const;
+
+    string root_;           // Directory the remote paths are relative to.
+    double latency_{0};     // Median seconds to first byte.
+    double jitter_{0};      // Sigma of the lognormal latency.
+    int64_t bandwidth_{0};  // Bytes per second per request, or 0 for unlimited.
+    double error_rate_{0};  // Chance of failing.
+    double stall_rate_{0};  // Chance of stalling.
+    double stall_{60};      // Seconds a stall lasts.
+    uint64_t seed_{1337};   // Seeds everything.
+
+    mutable std::mutex mutex_;                             // Guards the below.
+    mutable unordered_map<string, int64_t> num_requests_;  // Requests so far by path.
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,25 @@
+#include "remote.h"
+
+namespace xtreaming {
+
+Remote::~Remote() {
+}
+
+bool Remote::CanBatch() const {
+    return false;
+}
+
+bool Remote::DownloadBatch(const vector<string>& paths, const vector<string>& local_paths,
+                           int64_t deadline, vector<string>* errs) const {
+    bool ok = true;
+    errs->clear();
+    errs->resize(paths.size());
+    for (int64_t i = 0; i < paths.size(); ++i) {
+        if (!Download(paths[i], local_paths[i], deadline, &(*errs)[i])) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+}  // namespace xtreaming
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "base/sink.h"
+
+using std::string;
+using std::vector;
+
+namespace xtreaming {
+
+// Backend for a stream's remote: the persistent copy of its dataset that shards are fetched from.
+//
+// Paths are relative to the remote root. Calls may come from many threads at once. A call still
+// running at `deadline` (in NanoTime() nanoseconds) gives up and fails.
+class Remote {
+  public:
+    virtual ~Remote();
+
+    // Copy a remote file to a local path, which is either absent or complete afterward.
+    virtual bool Download(const string& path, const string& local_path, int64_t deadline,
+                          string* err) const = 0;
+
+    // Whether DownloadBatch() is a real batched transfer, cheaper than downloading its files in
+    // parallel. By default, not.
+    virtual bool CanBatch() const;
+
+    // Copy several remote files to local paths in one batched transfer, for backends where that
+    // saves per-request overhead. Each file is either absent or complete afterward. `errs` gets the
+    // error of each file, or empty if it made it. Returns whether all did. By default, downloads
+    // them one by one.
+    virtual bool DownloadBatch(const vector<string>& paths, const vector<string>& local_paths,
+                               int64_t deadline, vector<string>* errs) const;
+
+    // Stream a remote file into a sink, which is closed on success and aborted on failure.
+    virtual bool Fetch(const string& path, ByteSink* sink, int64_t deadline,
+                       string* err) const = 0;
+
+    // Stream `size` bytes of a remote file starting at `offset` into a sink, likewise. The range
+    // must lie within the file.
+    virtual bool FetchRange(const string& path, int64_t offset, int64_t size, ByteSink* sink,
+                            int64_t deadline, string* err) const = 0;
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,160 @@
+#include "flatbuf.h"
+
+namespace xtreaming {
+namespace {
+
+// Read a little-endian scalar at `pos`, failing if it would run off the end of the buffer.
+template <typename T>
+bool Read(const char* buf, int64_t buf_size, int64_t pos, T* ret) {
+    if (pos < 0 || buf_size < pos + (int64_t)sizeof(T)) {
+        return false;
+    }
+    memcpy(ret, &buf[pos], sizeof(T));
+    return true;
+}
+
+}  // namespace
+
+bool FlatVector::Init(const char* buf, int64_t buf_size, int64_t pos) {
+    uint32_t size;
+    if (!Read(buf, buf_size, pos, &size)) {
+        return false;
+    }
+    buf_ = buf;
+    buf_size_ = buf_size;
+    begin_ = pos + (int64_t)sizeof(size);
+    size_ = size;
+    return true;
+}
+
+bool FlatVector::GetStruct(int64_t index, int64_t struct_size, const char** ret) const {
+    if (index < 0 || size_ <= index) {
+        return false;
+    }
+    int64_t pos = begin_ + index * struct_size;
+    if (buf_size_ < pos + struct_size) {
+        return false;
+    }
+    *ret = &buf_[pos];
+    return true;
+}
+
+bool FlatVector::GetTable(int64_t index, FlatTable* ret) const {
+    if (index < 0 || size_ <= index) {
+        return false;
+    }
+    int64_t pos = begin_ + index * (int64_t)sizeof(uint32_t);
+    uint32_t offset;
+    if (!Read(buf_, buf_size_, pos, &offset)) {
+        return false;
+    }
+    return ret->Init(buf_, buf_size_, pos + offset);
+}
+
+bool FlatTable::InitRoot(const char* buf, int64_t buf_size) {
+    uint32_t offset;
+    if (!Read(buf, buf_size, 0, &offset)) {
+        return false;
+    }
+    return Init(buf, buf_size, offset);
+}
+
+bool FlatTable::Init(const char* buf, int64_t buf_size, int64_t pos) {
+    int32_t soffset;
+    if (!Read(buf, buf_size, pos, &soffset)) {
+        return false;
+    }
+    int64_t vtable = pos - soffset;
+    uint16_t vtable_size;
+    if (!Read(buf, buf_size, vtable, &vtable_size)) {
+        return false;
+    }
+    if (vtable_size < 4 || buf_size < vtable + vtable_size) {
+        return false;
+    }
+    buf_ = buf;
+    buf_size_ = buf_size;
+    pos_ = pos;
+    vtable_ = vtable;
+    vtable_size_ = vtable_size;
+    return true;
+}
+
+bool FlatTable::GetFieldPos(int64_t field, int64_t* pos) const {
+    // The vtable is (vtable size, table size, field offsets...), all uint16.
+    int64_t entry = 4 + 2 * field;
+    if (vtable_size_ < entry + 2) {
+        *pos = -1L;
+        return true;
+    }
+    uint16_t offset;
+    if (!Read(buf_, buf_size_, vtable_ + entry, &offset)) {
+        return false;
+    }
+    *pos = offset ? pos_ + offset : -1L;
+    return true;
+}
+
+bool FlatTable::GetFieldTarget(int64_t field, int64_t* target) const {
+    int64_t pos;
+    if (!GetFieldPos(field, &pos)) {
+        return false;
+    }
+    if (pos < 0) {
+        *target = -1L;
+        return true;
+    }
+    uint32_t offset;
+    if (!Read(buf_, buf_size_, pos, &offset)) {
+        return false;
+    }
+    *target = pos + offset;
+    return true;
+}
+
+bool FlatTable::GetTable(int64_t field, FlatTable* ret, bool* present) const {
+    int64_t target;
+    if (!GetFieldTarget(field, &target)) {
+        return false;
+    }
+    *present = 0 <= target;
+    if (!*present) {
+        return true;
+    }
+    return ret->Init(buf_, buf_size_, target);
+}
+
+bool FlatTable::GetVector(int64_t field, FlatVector* ret) const {
+    int64_t target;
+    if (!GetFieldTarget(field, &target)) {
+        return false;
+    }
+    if (target < 0) {
+        *ret = FlatVector();
+        return true;
+    }
+    return ret->Init(buf_, buf_size_, target);
+}
+
+bool FlatTable::GetString(int64_t field, string* ret) const {
+    int64_t target;
+    if (!GetFieldTarget(field, &target)) {
+        return false;
+    }
+    if (target < 0) {
+        ret->clear();
+        return true;
+    }
+    uint32_t size;
+    if (!Read(buf_, buf_size_, target, &size)) {
+        return false;
+    }
+    int64_t begin = target + (int64_t)sizeof(size);
+    if (buf_size_ < begin + size) {
+        return false;
+    }
+    ret->assign(&buf_[begin], size);
+    return true;
+}
+
+}  // namespace xtreaming
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+using std::string;
+
+namespace xtreaming {
+
+// Minimal read-only flatbuffer access, just enough to walk Arrow IPC metadata without pulling in
+// the flatbuffers library.
+//
+// Every read is bounds-checked against the enclosing buffer, because the bytes come from files
+// we don't control. Accessors return false on malformed input. Absent fields take the default.
+
+class FlatTable;
+
+// A vector field: either inline structs or offsets to tables.
+class FlatVector {
+  public:
+    int64_t size() const { return size_; }
+
+    // Point at the vector whose length prefix starts at `pos`.
+    bool Init(const char* buf, int64_t buf_size, int64_t pos);
+
+    // Get a pointer to the `index`-th inline struct of `struct_size` bytes.
+    bool GetStruct(int64_t index, int64_t struct_size, const char** ret) const;
+
+    // Get the `index`-th table of a vector of tables.
+    bool GetTable(int64_t index, FlatTable* ret) const;
+
+  private:
+    const char* buf_{nullptr};  // Enclosing flatbuffer.
+    int64_t buf_size_{0};       // Size of the enclosing flatbuffer in bytes.
+    int64_t begin_{0};          // Offset of the first element.
+    int64_t size_{0};           // Number of elements.
+};
+
+// A table: a vtable-indexed set of optional fields.
+class FlatTable {
+  public:
+    // Point at the root table of a flatbuffer.
+    bool InitRoot(const char* buf, int64_t buf_size);
+
+    // Point at the table starting at `pos`.
+    bool Init(const char* buf, int64_t buf_size, int64_t pos);
+
+    // Get a scalar field (ints, bools, enums, union type tags).
+    template <typename T>
+    bool GetScalar(int64_t field, T def, T* ret) const {
+        int64_t pos;
+        if (!GetFieldPos(field, &pos)) {
+            return false;
+        }
+        if (pos < 0) {
+            *ret = def;
+            return true;
+        }
+        if (buf_size_ < pos + (int64_t)sizeof(T)) {
+            return false;
+        }
+        memcpy(ret, &buf_[pos], sizeof(T));
+        return true;
+    }
+
+    // Get a table (or union value) field. Sets `present` to whether the field exists.
+    bool GetTable(int64_t field, FlatTable* ret, bool* present) const;
+
+    // Get a vector field. Absent vectors are returned as empty.
+    bool GetVector(int64_t field, FlatVector* ret) const;
+
+    // Get a string field. Absent strings are returned as empty.
+    bool GetString(int64_t field, string* ret) const;
+
+  private:
+    // Get the absolute offset of a field, or -1 if absent.
+    bool GetFieldPos(int64_t field, int64_t* pos) const;
+
+    // Follow the uoffset stored in a field to its absolute target offset, or -1 if absent.
+    bool GetFieldTarget(int64_t field, int64_t* target) const;
+
+    const char* buf_{nullptr};  // Enclosing flatbuffer.
+    int64_t buf_size_{0};       // Size of the enclosing flatbuffer in bytes.
+    int64_t pos_{0};            // Offset of this table.
+    int64_t vtable_{0};         // Offset of this table's vtable.
+    int64_t vtable_size_{0};    // Size of this table's vtable in bytes.
+};
+
+}  // namespace xtreaming
@@ -0,0 +1,125 @@
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "serial/arrow/flatbuf.h"
+
+using namespace xtreaming;
+using std::vector;
+
+namespace {
+
+// A footer-like flatbuffer: a root table with an int64 (field 0), a vector of two 16-byte structs
+// (field 1), and an absent string (field 2).
+vector<char> MakeFooter() {
+    vector<char> buf(68);
+    auto put = [&](int64_t pos, const void* data, int64_t size) { memcpy(&buf[pos], data, size); };
+    uint32_t root = 16;
+    put(0, &root, 4);
+    uint16_t vtable[] = {10, 16, 4, 12, 0};
+    put(4, vtable, sizeof(vtable));
+    int32_t soffset = 16 - 4;
+    put(16, &soffset, 4);
+    int64_t version = 42;
+    put(20, &version, 8);
+    uint32_t blocks = 32 - 28;
+    put(28, &blocks, 4);
+    uint32_t num_blocks = 2;
+    put(32, &num_blocks, 4);
+    for (int64_t i = 0; i < 4; ++i) {
+        int64_t value = 100 + i;
+        put(36 + 8 * i, &value, 8);
+    }
+    return buf;
+}
+
+// Read everything in the footer, returning whether it all parsed.
+bool Walk(const char* buf, int64_t size) {
+    FlatTable footer;
+    int64_t version;
+    FlatVector blocks;
+    string name;
+    if (!footer.InitRoot(buf, size) || !footer.GetScalar<int64_t>(0, 0, &version) ||
+            !footer.GetVector(1, &blocks) || !footer.GetString(2, &name)) {
+        return false;
+    }
+    for (int64_t i = 0; i < blocks.size(); ++i) {
+        const char* block;
+        if (!blocks.GetStruct(i, 16, &block)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TestFooter() {
+    auto buf = MakeFooter();
+    FlatTable footer;
+    assert(footer.InitRoot(buf.data(), buf.size()));
+
+    int64_t version;
+    assert(footer.GetScalar<int64_t>(0, 0, &version));
+    assert(version == 42);
+
+    // Fields past the end of the vtable, or with a zero offset, are absent.
+    int32_t missing;
+    assert(footer.GetScalar<int32_t>(7, -1, &missing));
+    assert(missing == -1);
+    string name = "x";
+    assert(footer.GetString(2, &name));
+    assert(name.empty());
+
+    FlatVector blocks;
+    assert(footer.GetVector(1, &blocks));
+    assert(blocks.size() == 2);
+    const char* block;
+    assert(blocks.GetStruct(1, 16, &block));
+    int64_t value;
+    memcpy(&value, &block[8], 8);
+    assert(value == 103);
+    assert(!blocks.GetStruct(2, 16, &block));
+    assert(!blocks.GetStruct(-1, 16, &block));
+}
+
+void TestTruncatedFooter() {
+    auto buf = MakeFooter();
+    assert(Walk(buf.data(), buf.size()));
+    for (int64_t size = 0; size < buf.size(); ++size) {
+        assert(!Walk(buf.data(), size));
+    }
+}
+
+void TestMalformedFooter() {
+    // A vector whose length runs past the end of the buffer: the count alone isn't enough.
+    auto buf = MakeFooter();
+    uint32_t num_blocks = 1000;
+    memcpy(&buf[32], &num_blocks, 4);
+    FlatTable footer;
+    FlatVector blocks;
+    assert(footer.InitRoot(buf.data(), buf.size()));
+    assert(footer.GetVector(1, &blocks));
+    assert(blocks.size() == 1000);
+    const char* block;
+    assert(blocks.GetStruct(1, 16, &block));
+    assert(!blocks.GetStruct(2, 16, &block));
+
+    // A table whose vtable lies outside the buffer.
+    buf = MakeFooter();
+    int32_t soffset = -1000;
+    memcpy(&buf[16], &soffset, 4);
+    assert(!footer.InitRoot(buf.data(), buf.size()));
+
+    // A root offset past the end.
+    buf = MakeFooter();
+    uint32_t root = 1 << 30;
+    memcpy(&buf[0], &root, 4);
+    assert(!footer.InitRoot(buf.data(), buf.size()));
+}
+
+}  // namespace
+
+int main() {
+    TestFooter();
+    TestTruncatedFooter();
+    TestMalformedFooter();
+}
@@ -0,0 +1,445 @@
+#include "shard.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+#include "base/string.h"
+#include "serial/arrow/flatbuf.h"
+
+using std::make_pair;
+using std::upper_bound;
+
+namespace xtreaming {
+namespace {
+
+// File layout: magic, padding, messages, footer, footer size (int32), magic.
+const char kMagic[] = "ARROW1";
+const int64_t kMagicSize = 6;
+const int64_t kHeaderSize = 8;
+
+// Flatbuffer field IDs from the Arrow format schema (File.fbs, Schema.fbs, Message.fbs).
+enum FooterField { kFooterSchema = 1, kFooterRecordBatches = 3 };
+enum SchemaField { kSchemaEndianness = 0, kSchemaFields = 1 };
+enum FieldField { kFieldName = 0, kFieldTypeType = 2, kFieldType = 3, kFieldDictionary = 4 };
+enum MessageField { kMessageHeaderType = 1, kMessageHeader = 2 };
+enum BatchField { kBatchLength = 0, kBatchNodes = 1, kBatchBuffers = 2, kBatchCompression = 3 };
+
+// Arrow `Type` union tags we can serve.
+enum TypeTag {
+    kInt = 2,
+    kFloatingPoint = 3,
+    kBinary = 4,
+    kUtf8 = 5,
+    kBool = 6,
+    kDecimal = 7,
+    kDate = 8,
+    kTime = 9,
+    kTimestamp = 10,
+    kFixedSizeBinary = 15,
+    kDuration = 18,
+    kLargeBinary = 19,
+    kLargeUtf8 = 20,
+};
+
+// Arrow `MessageHeader` union tag of a record batch.
+const uint8_t kRecordBatchHeader = 3;
+
+// Sizes of the inline structs `Block`, `FieldNode`, and `Buffer`.
+const int64_t kBlockSize = 24;
+const int64_t kFieldNodeSize = 16;
+const int64_t kBufferSize = 16;
+
+// Derive a column's physical layout from its schema `Field` table.
+bool GetColumn(const FlatTable& field, ArrowColumn* column, string* err) {
+    if (!field.GetString(kFieldName, &column->name)) {
+        *err = "Malformed field name.";
+        return false;
+    }
+
+    FlatTable dict;
+    bool has_dict;
+    if (!field.GetTable(kFieldDictionary, &dict, &has_dict)) {
+        *err = "Malformed field dictionary.";
+        return false;
+    }
+    if (has_dict) {
+        *err = StringPrintf("Column `%s` is dictionary-encoded, which is not supported.",
+                            column->name.c_str());
+        return false;
+    }
+
+    uint8_t tag;
+    FlatTable type;
+    bool has_type;
+    if (!field.GetScalar<uint8_t>(kFieldTypeType, 0, &tag) ||
+            !field.GetTable(kFieldType, &type, &has_type) || !has_type) {
+        *err = StringPrintf("Malformed type of column `%s`.", column->name.c_str());
+        return false;
+    }
+    column->type = tag;
+    column->bit_width = -1L;
+    column->offset_width = -1L;
+    column->num_buffers = 2;
+
+    bool ok = true;
+    switch (tag) {
+    case kInt: {
+        int32_t bit_width = 0;
+        ok = type.GetScalar<int32_t>(0, 0, &bit_width);
+        column->bit_width = bit_width;
+        break;
+    }
+    case kFloatingPoint: {
+        int16_t precision = 0;
+        // Half, single, or double.
+        ok = type.GetScalar<int16_t>(0, 0, &precision) && 0 <= precision && precision <= 2;
+        column->bit_width = ok ? 16L << precision : -1L;
+        break;
+    }
+    case kBool:
+        column->bit_width = 1;
+        break;
+    case kDecimal: {
+        int32_t bit_width = 0;
+        ok = type.GetScalar<int32_t>(2, 128, &bit_width);
+        column->bit_width = bit_width;
+        break;
+    }
+    case kDate: {
+        int16_t unit = 0;
+        ok = type.GetScalar<int16_t>(0, 1, &unit);
+        column->bit_width = unit ? 64 : 32;
+        break;
+    }
+    case kTime: {
+        int32_t bit_width = 0;
+        ok = type.GetScalar<int32_t>(1, 32, &bit_width);
+        column->bit_width = bit_width;
+        break;
+    }
+    case kTimestamp:
+    case kDuration:
+        column->bit_width = 64;
+        break;
+    case kFixedSizeBinary: {
+        int32_t byte_width = 0;
+        ok = type.GetScalar<int32_t>(0, 0, &byte_width);
+        column->bit_width = 8L * byte_width;
+        break;
+    }
+    case kBinary:
+    case kUtf8:
+        column->offset_width = 32;
+        column->num_buffers = 3;
+        break;
+    case kLargeBinary:
+    case kLargeUtf8:
+        column->offset_width = 64;
+        column->num_buffers = 3;
+        break;
+    default:
+        *err = StringPrintf("Column `%s` has Arrow type %d, which is not supported (only flat "
+                            "primitive and binary/string columns are).", column->name.c_str(),
+                            (int)tag);
+        return false;
+    }
+
+    if (!ok || (column->num_buffers == 2 && column->bit_width <= 0)) {
+        *err = StringPrintf("Malformed type of column `%s`.", column->name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+}  // namespace
+
+ArrowShard::~ArrowShard() {
+}
+
+void ArrowShard::Init(int64_t stream_id, const set<string>& hash_algos, int64_t num_samples,
+                      int64_t size_limit, FileInfo* raw_data) {
+    Shard::Init(stream_id, hash_algos, num_samples, size_limit, "");
+    raw_data_ = raw_data;
+    file_pairs_.emplace_back(make_pair(raw_data, nullptr));
+}
+
+void ArrowShard::InitFromJSON(int64_t stream_id, const json& obj) {
+    set<string> hash_algos;
+    if (obj.contains("hashes")) {
+        for (auto& algo : obj["hashes"]) {
+            hash_algos.insert(algo);
+        }
+    }
+
+    int64_t num_samples = -1L;
+    if (obj.contains("samples") && obj["samples"].is_number_integer()) {
+        num_samples = obj["samples"];
+    }
+
+    int64_t size_limit = -1L;
+    if (obj.contains("size_limit") && obj["size_limit"].is_number_integer()) {
+        size_limit = obj["size_limit"];
+    }
+
+    auto& raw_obj = obj["raw_data"];
+    FileInfo* raw_data = new FileInfo;
+    raw_data->path = raw_obj["basename"];
+    raw_data->num_bytes = raw_obj["bytes"];
+    for (auto it : raw_obj["hashes"].items()) {
+        raw_data->hashes[it.key()] = it.value();
+    }
+
+    Init(stream_id, hash_algos, num_samples, size_limit, raw_data);
+}
+
+bool ArrowShard::Open(const string& local, const string& split, string* err) {
+    string path = local + "/" + split + "/" + raw_data_->path;
+    if (!file_.Open(path, err)) {
+        return false;
+    }
+
+    if (!ParseFooter(path, err)) {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void ArrowShard::Close() {
+    file_.Close();
+}
+
+bool ArrowShard::ParseFooter(const string& path, string* err) {
+    auto data = file_.data();
+    int64_t size = file_.size();
+
+    // Check the magic at both ends.
+    if (size < kHeaderSize + 4 + kMagicSize || memcmp(data, kMagic, kMagicSize) ||
+            memcmp(&data[size - kMagicSize], kMagic, kMagicSize)) {
+        *err = StringPrintf("Not an Arrow IPC file: `%s`.", path.c_str());
+        return false;
+    }
+
+    // Locate the footer.
+    int32_t footer_size;
+    memcpy(&footer_size, &data[size - kMagicSize - 4], 4);
+    int64_t footer_offset = size - kMagicSize - 4 - footer_size;
+    if (footer_size <= 0 || footer_offset < kHeaderSize) {
+        *err = StringPrintf("Malformed Arrow footer size in `%s`.", path.c_str());
+        return false;
+    }
+    FlatTable footer;
+    if (!footer.InitRoot(&data[footer_offset], footer_size)) {
+        *err = StringPrintf("Malformed Arrow footer in `%s`.", path.c_str());
+        return false;
+    }
+
+    // Get the columns from the schema.
+    FlatTable schema;
+    bool has_schema;
+    FlatVector fields;
+    int16_t endianness;
+    if (!footer.GetTable(kFooterSchema, &schema, &has_schema) || !has_schema ||
+            !schema.GetScalar<int16_t>(kSchemaEndianness, 0, &endianness) ||
+            !schema.GetVector(kSchemaFields, &fields)) {
+        *err = StringPrintf("Malformed Arrow schema in `%s`.", path.c_str());
+        return false;
+    }
+    if (endianness) {
+        *err = StringPrintf("Big-endian Arrow files are not supported: `%s`.", path.c_str());
+        return false;
+    }
+    vector<ArrowColumn> columns;
+    columns.resize(fields.size());
+    for (int64_t i = 0; i < fields.size(); ++i) {
+        FlatTable field;
+        if (!fields.GetTable(i, &field)) {
+            *err = StringPrintf("Malformed Arrow schema in `%s`.", path.c_str());
+            return false;
+        }
+        if (!GetColumn(field, &columns[i], err)) {
+            *err = StringPrintf("%s (file: `%s`)", err->c_str(), path.c_str());
+            return false;
+        }
+    }
+    columns_ = columns;
+
+    // Get each record batch.
+    FlatVector blocks;
+    if (!footer.GetVector(kFooterRecordBatches, &blocks)) {
+        *err = StringPrintf("Malformed Arrow record batch list in `%s`.", path.c_str());
+        return false;
+    }
+    vector<ArrowBatch> batches;
+    batches.resize(blocks.size());
+    int64_t num_samples = 0;
+    for (int64_t i = 0; i < blocks.size(); ++i) {
+        const char* block;
+        if (!blocks.GetStruct(i, kBlockSize, &block)) {
+            *err = StringPrintf("Malformed Arrow record batch list in `%s`.", path.c_str());
+            return false;
+        }
+        int64_t offset;
+        int32_t meta_num_bytes;
+        int64_t body_num_bytes;
+        memcpy(&offset, &block[0], 8);
+        memcpy(&meta_num_bytes, &block[8], 4);
+        memcpy(&body_num_bytes, &block[16], 8);
+        auto& batch = batches[i];
+        if (!ParseBatch(path, offset, meta_num_bytes, body_num_bytes, &batch, err)) {
+            return false;
+        }
+        batch.sample_offset = num_samples;
+        num_samples += batch.num_samples;
+    }
+    batches_ = batches;
+
+    // The footer is authoritative, but must agree with the index if the index says anything.
+    if (0 <= num_samples_ && num_samples_ != num_samples) {
+        *err = StringPrintf("Index says `%s` has %ld samples, but its footer says %ld.",
+                            path.c_str(), num_samples_, num_samples);
+        return false;
+    }
+    num_samples_ = num_samples;
+
+    return true;
+}
+
+bool ArrowShard::ParseBatch(const string& path, int64_t offset, int64_t meta_num_bytes,
+                            int64_t body_num_bytes, ArrowBatch* batch, string* err) const {
+    auto data = file_.data();
+    int64_t size = file_.size();
+    // Compared piecewise, as sums of values from the file could overflow.
+    if (offset < kHeaderSize || meta_num_bytes < 8 || body_num_bytes < 0 || size < offset ||
+            size - offset < meta_num_bytes || size - offset - meta_num_bytes < body_num_bytes) {
+        *err = StringPrintf("Arrow record batch out of bounds in `%s`.", path.c_str());
+        return false;
+    }
+
+    // Messages are prefixed by a continuation marker (since 0.15) and the metadata size.
+    int32_t prefix;
+    memcpy(&prefix, &data[offset], 4);
+    int64_t message_offset = offset + 4;
+    int32_t message_size = prefix;
+    if (prefix == -1) {
+        memcpy(&message_size, &data[offset + 4], 4);
+        message_offset += 4;
+    }
+    if (message_size <= 0 || offset + meta_num_bytes < message_offset + message_size) {
+        *err = StringPrintf("Malformed Arrow message in `%s`.", path.c_str());
+        return false;
+    }
+
+    FlatTable message;
+    uint8_t header_type;
+    FlatTable header;
+    bool has_header;
+    if (!message.InitRoot(&data[message_offset], message_size) ||
+            !message.GetScalar<uint8_t>(kMessageHeaderType, 0, &header_type) ||
+            !message.GetTable(kMessageHeader, &header, &has_header) || !has_header ||
+            header_type != kRecordBatchHeader) {
+        *err = StringPrintf("Malformed Arrow record batch message in `%s`.", path.c_str());
+        return false;
+    }
+
+    FlatTable compression;
+    bool has_compression;
+    if (!header.GetTable(kBatchCompression, &compression, &has_compression)) {
+        *err = StringPrintf("Malformed Arrow record batch in `%s`.", path.c_str());
+        return false;
+    }
+    if (has_compression) {
+        *err = StringPrintf("Compressed Arrow record batches are not supported: `%s`.",
+                            path.c_str());
+        return false;
+    }
+
+    FlatVector nodes;
+    FlatVector buffers;
+    if (!header.GetScalar<int64_t>(kBatchLength, 0, &batch->num_samples) ||
+            !header.GetVector(kBatchNodes, &nodes) ||
+            !header.GetVector(kBatchBuffers, &buffers) || batch->num_samples < 0) {
+        *err = StringPrintf("Malformed Arrow record batch in `%s`.", path.c_str());
+        return false;
+    }
+
+    // One field node per column.
+    if (nodes.size() != columns_.size()) {
+        *err = StringPrintf("Arrow record batch has %ld field nodes for %ld columns in `%s`.",
+                            nodes.size(), (int64_t)columns_.size(), path.c_str());
+        return false;
+    }
+    batch->null_counts.resize(columns_.size());
+    batch->column_to_buffer.resize(columns_.size());
+    int64_t num_buffers = 0;
+    for (int64_t i = 0; i < columns_.size(); ++i) {
+        const char* node;
+        if (!nodes.GetStruct(i, kFieldNodeSize, &node)) {
+            *err = StringPrintf("Malformed Arrow record batch in `%s`.", path.c_str());
+            return false;
+        }
+        int64_t length;
+        memcpy(&length, &node[0], 8);
+        memcpy(&batch->null_counts[i], &node[8], 8);
+        if (length != batch->num_samples) {
+            *err = StringPrintf("Arrow column `%s` length disagrees with its record batch in "
+                                "`%s`.", columns_[i].name.c_str(), path.c_str());
+            return false;
+        }
+        batch->column_to_buffer[i] = num_buffers;
+        num_buffers += columns_[i].num_buffers;
+    }
+
+    // Buffers must all lie within the body.
+    if (buffers.size() != num_buffers) {
+        *err = StringPrintf("Arrow record batch has %ld buffers, expected %ld, in `%s`.",
+                            buffers.size(), num_buffers, path.c_str());
+        return false;
+    }
+    batch->buffers.resize(num_buffers);
+    for (int64_t i = 0; i < num_buffers; ++i) {
+        const char* buffer;
+        if (!buffers.GetStruct(i, kBufferSize, &buffer)) {
+            *err = StringPrintf("Malformed Arrow record batch in `%s`.", path.c_str());
+            return false;
+        }
+        auto& info = batch->buffers[i];
+        memcpy(&info.offset, &buffer[0], 8);
+        memcpy(&info.num_bytes, &buffer[8], 8);
+        if (info.offset < 0 || info.num_bytes < 0 || body_num_bytes < info.offset ||
+                body_num_bytes - info.offset < info.num_bytes) {
+            *err = StringPrintf("Arrow buffer out of bounds in `%s`.", path.c_str());
+            return false;
+        }
+    }
+
+    batch->body_offset = offset + meta_num_bytes;
+    batch->body_num_bytes = body_num_bytes;
+    return true;
+}
+
+void ArrowShard::FindSample(int64_t sample_id, int64_t* batch_id, int64_t* row) const {
+    assert(0 <= sample_id);
+    assert(sample_id < num_samples_);
+    auto it = upper_bound(batches_.begin(), batches_.end(), sample_id,
+                          [](int64_t id, const ArrowBatch& batch) {
+        return id < batch.sample_offset;
+    });
+    *batch_id = (it - batches_.begin()) - 1;
+    *row = sample_id - batches_[*batch_id].sample_offset;
+}
+
+void ArrowShard::GetBuffer(int64_t batch_id, int64_t column_id, int64_t buffer_id,
+                           const char** data, int64_t* num_bytes) const {
+    assert(is_open());
+    auto& batch = batches_[batch_id];
+    assert(0 <= buffer_id && buffer_id < columns_[column_id].num_buffers);
+    auto& buffer = batch.buffers[batch.column_to_buffer[column_id] + buffer_id];
+    *data = &file_.data()[batch.body_offset + buffer.offset];
+    *num_bytes = buffer.num_bytes;
+}
+
+}  // namespace xtreaming
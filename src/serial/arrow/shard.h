@@ -0,0 +1,93 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "base/json.h"
+#include "base/mmap.h"
+#include "serial/base/shard.h"
+
+using std::set;
+using std::string;
+using std::vector;
+
+namespace xtreaming {
+
+// A column of an Arrow IPC file, taken from the schema in the footer.
+//
+// Only flat, non-dictionary-encoded columns are supported.
+struct ArrowColumn {
+    string name;
+    int64_t type;          // Arrow `Type` union tag (e.g. 2 for Int, 5 for Utf8).
+    int64_t bit_width;     // Bits per value for fixed-width types, or -1 if variable-length.
+    int64_t offset_width;  // Bits per offset for variable-length types (32 or 64), else -1.
+    int64_t num_buffers;   // Buffers per record batch: validity, [offsets,] data.
+};
+
+// A body buffer, relative to the start of its record batch body.
+struct ArrowBuffer {
+    int64_t offset;
+    int64_t num_bytes;
+};
+
+// A record batch of an Arrow IPC file, located through the footer.
+struct ArrowBatch {
+    int64_t num_samples;               // Rows in this batch.
+    int64_t sample_offset;             // Rows in all prior batches.
+    int64_t body_offset;               // File offset of the batch body.
+    int64_t body_num_bytes;            // Size of the batch body.
+    vector<int64_t> null_counts;       // Null count per column.
+    vector<ArrowBuffer> buffers;       // Body buffers of all columns, in column order.
+    vector<int64_t> column_to_buffer;  // Index of each column's first buffer in `buffers`.
+};
+
+// An uncompressed Arrow IPC (Feather v2) file used directly as a shard.
+//
+// The sample count and column layout come from the file footer. Column buffers are served
+// zero-copy out of a memory mapping of the file.
+class ArrowShard : public Shard {
+  public:
+    const FileInfo* raw_data() const { return raw_data_; }
+    const vector<ArrowColumn>& columns() const { return columns_; }
+    const vector<ArrowBatch>& batches() const { return batches_; }
+    bool is_open() const { return file_.is_open(); }
+
+    virtual ~ArrowShard() override;
+
+    void Init(int64_t stream_id, const set<string>& hash_algos, int64_t num_samples,
+              int64_t size_limit, FileInfo* raw_data);
+
+    // The index may omit `samples`, in which case it stays unknown (-1) until Open().
+    void InitFromJSON(int64_t stream_id, const json& obj);
+
+    // Map the local file and parse its footer and record batch metadata.
+    //
+    // Fails if the file is malformed, compressed, uses unsupported column types, or disagrees
+    // with the sample count given by the index.
+    bool Open(const string& local, const string& split, string* err);
+
+    // Unmap the local file. Parsed metadata is kept.
+    void Close();
+
+    // Locate a sample by its offset within this shard.
+    void FindSample(int64_t sample_id, int64_t* batch_id, int64_t* row) const;
+
+    // Get a pointer into the mapping for one buffer of one column of one batch (zero-copy).
+    //
+    // Requires the shard to be open.
+    void GetBuffer(int64_t batch_id, int64_t column_id, int64_t buffer_id, const char** data,
+                   int64_t* num_bytes) const;
+
+  protected:
+    bool ParseFooter(const string& path, string* err);
+    bool ParseBatch(const string& path, int64_t offset, int64_t meta_num_bytes,
+                    int64_t body_num_bytes, ArrowBatch* batch, string* err) const;
+
+    FileInfo* raw_data_{nullptr};
+    vector<ArrowColumn> columns_;
+    vector<ArrowBatch> batches_;
+    MappedFile file_;
+};
+
+}  // namespace xtreaming
@@ -54,7 +54,7 @@ void Shard::Evict(const string& local, const string& split) const {
 }
 
 bool Shard::CheckLocalDir(const string& local, const string& split, bool keep_zip,
-                          set<string>& files) const {
+                          bool unzip_to_memory, set<string>& files) const {
     // For raw/zip to be considered present, each raw/zip file must be present.
     int64_t raw_files_present = 0;
     int64_t zip_files_present = 0;
@@ -94,6 +94,14 @@ bool Shard::CheckLocalDir(const string& local, const string& split, bool keep_zi
         has_zip = true;
     }
 
+    // Unzipping to memory? Then the zip is the only on-disk form.
+    if (unzip_to_memory && !zip_algo_.empty()) {
+        if (has_raw) {
+            EvictRaw(local, split);
+        }
+        return has_zip;
+    }
+
     // Do we keep_zip?
     if (keep_zip) {
         // If we can keep_zip, and we do, and have either raw or zip, we must have the other one
@@ -141,11 +149,15 @@ int64_t Shard::GetMaxSize() const {
     return GetRawSize() + GetZipSize();
 }
 
-int64_t Shard::GetPersistentSize(bool safe_keep_zip) const {
+int64_t Shard::GetPersistentSize(bool safe_keep_zip, bool unzip_to_memory) const {
     if (zip_algo_.empty()) {
         return GetRawSize();
     }
 
+    if (unzip_to_memory) {
+        return GetZipSize();
+    }
+
     if (!safe_keep_zip) {
         return GetRawSize();
     }
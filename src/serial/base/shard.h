@@ -51,19 +51,22 @@ class Shard {
     // * Takes an recursive listing of the files in local to avoid hammering the filesystem.
     // * If partially present, the files that are present are deleted.
     // * Conforms with the provided keep_zip.
+    // * If unzipping to memory, a zipped shard is present iff its zips are, and raw files are
+    //   dropped.
     // * This method is const because dynamic state like shard presence is stored elsewhere.
     bool CheckLocalDir(const string& local, const string& split, bool keep_zip,
-                       set<string>& files) const;
+                       bool unzip_to_memory, set<string>& files) const;
 
     // Cache usage.
     // * Raw: Uncompressed version only.
     // * Zip: Compressed version only.
     // * Max: Maximum data usage (happens while decompressing).
-    // * Persistent: Data usage after downloading and extraction is complete.
+    // * Persistent: Disk usage after downloading and extraction is complete (only the zip if
+    //   unzipping to memory).
     int64_t GetRawSize() const;
     int64_t GetZipSize() const;
     int64_t GetMaxSize() const;
-    int64_t GetPersistentSize(bool safe_keep_zip) const;
+    int64_t GetPersistentSize(bool safe_keep_zip, bool unzip_to_memory) const;
 
   protected:
     // Arguments.
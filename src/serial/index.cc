@@ -2,14 +2,69 @@
 
 #include <cstdio>
 
+#include "base/file.h"
+#include "base/hash/hash.h"
 #include "base/json.h"
 #include "base/string.h"
+#include "serial/arrow/shard.h"
 #include "serial/shard.h"
 
 namespace xtreaming {
+namespace {
 
-void LoadIndex(int64_t stream_id, const Stream* stream, vector<Shard*>* shards, Logger* logger,
-               string* err) {
+// Load and check the zstd dictionary described by an index's `zstd_dict` object.
+bool LoadZstdDict(const Stream* stream, const json& obj, ZstdDict** zstd_dict, string* err) {
+    FileInfo info;
+    info.path = obj["basename"];
+    info.num_bytes = obj["bytes"];
+    if (obj.contains("hashes")) {
+        for (auto it : obj["hashes"].items()) {
+            info.hashes[it.key()] = it.value();
+        }
+    }
+
+    string filename = stream->local() + "/" + stream->split() + "/" + info.path;
+    string data;
+    if (!ReadFile(filename, &data)) {
+        *err = StringPrintf("Unable to open file: `%s`.", filename.c_str());
+        return false;
+    }
+    if (data.size() != info.num_bytes) {
+        *err = StringPrintf("zstd dictionary `%s` has %ld bytes, but the index says %ld.",
+                            filename.c_str(), (int64_t)data.size(), info.num_bytes);
+        return false;
+    }
+
+    string algo;
+    if (stream->ChooseHashAlgo(&info, &algo)) {
+        string expected;
+        Hasher* hasher = NewHasher(algo);
+        hasher->Update(data.data(), data.size());
+        bool ok = HexToBytes(info.hashes[algo], &expected) && hasher->Digest() == expected;
+        delete hasher;
+        if (!ok) {
+            *err = StringPrintf("Hash mismatch on zstd dictionary `%s`.", filename.c_str());
+            return false;
+        }
+    } else if (!stream->non_hashed_ok()) {
+        *err = StringPrintf("File `%s` can't be hash validated with any of the stream's hash "
+                            "algorithms.", filename.c_str());
+        return false;
+    }
+
+    auto dict = new ZstdDict;
+    if (!dict->Init(data, err)) {
+        delete dict;
+        return false;
+    }
+    *zstd_dict = dict;
+    return true;
+}
+
+}  // namespace
+
+void LoadIndex(int64_t stream_id, const Stream* stream, vector<Shard*>* shards,
+               ZstdDict** zstd_dict, Logger* logger, string* err) {
     // Maybe log scope enter/exit.
     string stream_name;
     if (stream->name().empty()) {
@@ -55,6 +110,34 @@ void LoadIndex(int64_t stream_id, const Stream* stream, vector<Shard*>* shards,
         return;
     }
 
+    // Arrow shards may leave their sample counts to their footers, which must then be local.
+    {
+        auto scope2 = logger->Scope(base_scope_name + "/read_footers");
+        for (auto& shard : *shards) {
+            if (0 <= shard->num_samples()) {
+                continue;
+            }
+            auto arrow = dynamic_cast<ArrowShard*>(shard);
+            if (!arrow) {
+                *err = "Shard is missing `samples`.";
+                return;
+            }
+            if (!arrow->Open(stream->local(), stream->split(), err)) {
+                return;
+            }
+            arrow->Close();
+        }
+    }
+
+    // Load the stream's shared zstd dictionary, if it has one.
+    *zstd_dict = nullptr;
+    if (Contains(obj, "zstd_dict")) {
+        auto scope2 = logger->Scope(base_scope_name + "/load_zstd_dict");
+        if (!LoadZstdDict(stream, obj["zstd_dict"], zstd_dict, err)) {
+            return;
+        }
+    }
+
     // Clear `err` to be safe. Normally we don't clear err on success, relying on returning true
     // signaling it instead, but we can't do that here because we're a thread.
     err->clear();
@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 
+#include "base/zip/zstd.h"
 #include "serial/base/shard.h"
 #include "stream.h"
 
@@ -11,7 +12,9 @@ using std::vector;
 
 namespace xtreaming {
 
-void LoadIndex(int64_t stream_id, const Stream* stream, vector<Shard*>* shards, Logger* logger,
-               string* err);
+// Load a stream's shards from its index, along with the shared zstd dictionary it references, if
+// any (else `zstd_dict` is set to null).
+void LoadIndex(int64_t stream_id, const Stream* stream, vector<Shard*>* shards,
+               ZstdDict** zstd_dict, Logger* logger, string* err);
 
 }  // namespace xtreaming
@@ -1,7 +1,10 @@
 #include "shard.h"
 
+#include <cstring>
 #include <utility>
 
+#include "base/string.h"
+
 using std::make_pair;
 
 namespace xtreaming {
@@ -70,4 +73,39 @@ void MDSShard::InitFromJSON(int64_t stream_id, const json& obj) {
     Init(stream_id, hash_algos, num_samples, size_limit, zip_algo, raw_data, zip_data, columns);
 }
 
+int64_t MDSShard::GetHeaderSize() const {
+    return sizeof(uint32_t) * (1 + num_samples_ + 1);
+}
+
+bool MDSShard::ParseHeader(const char* data, int64_t size, vector<int64_t>* offsets,
+                           string* err) const {
+    if (size < GetHeaderSize()) {
+        *err = StringPrintf("MDS shard header of `%s` is truncated (%ld bytes, expected %ld).",
+                            raw_data_->path.c_str(), size, GetHeaderSize());
+        return false;
+    }
+
+    uint32_t num_samples;
+    memcpy(&num_samples, data, sizeof(num_samples));
+    if (num_samples != num_samples_) {
+        *err = StringPrintf("MDS shard `%s` has %u samples, but its index says %ld.",
+                            raw_data_->path.c_str(), num_samples, num_samples_);
+        return false;
+    }
+
+    offsets->resize(num_samples_ + 1);
+    const char* begin = data + sizeof(uint32_t);
+    for (int64_t i = 0; i <= num_samples_; ++i) {
+        uint32_t offset;
+        memcpy(&offset, begin + i * sizeof(offset), sizeof(offset));
+        (*offsets)[i] = offset;
+        if ((i && offset < (*offsets)[i - 1]) || raw_data_->num_bytes < offset) {
+            *err = StringPrintf("MDS shard `%s` has out of order or out of bounds sample offsets.",
+                                raw_data_->path.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
 }  // namespace xtreaming
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <set>
 #include <string>
 #include <vector>
@@ -33,6 +34,13 @@ class MDSShard : public Shard {
 
     void InitFromJSON(int64_t stream_id, const json& obj);
 
+    // Partial fetching.
+    // * An uncompressed shard file starts with its sample count and then the byte offset of each
+    //   sample (plus the end), all uint32, so any one sample can be located from the header alone.
+    bool can_fetch_partial() const { return !zip_data_; }
+    int64_t GetHeaderSize() const;
+    bool ParseHeader(const char* data, int64_t size, vector<int64_t>* offsets, string* err) const;
+
   protected:
     FileInfo* raw_data_{nullptr};
     FileInfo* zip_data_{nullptr};
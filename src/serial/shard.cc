@@ -1,5 +1,6 @@
 #include "shard.h"
 
+#include "serial/arrow/shard.h"
 #include "serial/mds/shard.h"
 
 #include <cassert>
@@ -12,6 +13,10 @@ Shard* GetShard(int64_t stream_id, const json& obj) {
         MDSShard* shard = new MDSShard;
         shard->InitFromJSON(stream_id, obj);
         return shard;
+    } else if (format == "arrow") {
+        ArrowShard* shard = new ArrowShard;
+        shard->InitFromJSON(stream_id, obj);
+        return shard;
     } else {
         assert(false);
     }
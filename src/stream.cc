@@ -5,6 +5,7 @@
 #include <random>
 #include <set>
 
+#include "base/hash/hash.h"
 #include "base/hash/xxhash.h"
 #include "base/string.h"
 
@@ -88,7 +89,11 @@ bool Stream::Init(const string& name, const json& obj, const json& all, string*
         return false;
     }
 
-    safe_keep_zip_ = keep_zip_ || (remote_ == local_);
+    if (!GetBool(obj, all, "unzip_to_memory", false, &unzip_to_memory_, err)) {
+        return false;
+    }
+
+    safe_keep_zip_ = keep_zip_ || (remote_ == local_) || unzip_to_memory_;
 
     // Init weights:
 
@@ -117,6 +122,8 @@ bool Stream::Init(const string& name, const json& obj, const json& all, string*
     sample_offset_ = -1L;
     num_samples_ = -1L;
 
+    zstd_dict_ = nullptr;
+
     return true;
 }
 
@@ -256,8 +263,25 @@ void Stream::CheckLocalDir(const vector<Shard*> shards, vector<bool>* is_present
 
     for (int64_t i = shard_offset_; i < shard_offset_ + num_shards_; ++i) {
         auto& shard = shards[i];
-        (*is_present)[i] = shard->CheckLocalDir(local_, split_, keep_zip_, files);
+        (*is_present)[i] = shard->CheckLocalDir(local_, split_, keep_zip_, unzip_to_memory_,
+                                                 files);
+    }
+}
+
+bool Stream::ChooseHashAlgo(const FileInfo* file, string* algo) const {
+    for (auto& name : hash_algos_) {
+        if (file->hashes.find(name) == file->hashes.end()) {
+            continue;
+        }
+        Hasher* hasher = NewHasher(name);
+        if (!hasher) {
+            continue;
+        }
+        delete hasher;
+        *algo = name;
+        return true;
     }
+    return false;
 }
 
 }  // namespace xtreaming
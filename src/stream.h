@@ -6,6 +6,7 @@
 
 #include "base/json.h"
 #include "base/logger.h"
+#include "base/zip/zstd.h"
 #include "serial/base/shard.h"
 
 using std::string;
@@ -28,6 +29,7 @@ class Stream {
     bool non_hashed_ok() const { return non_hashed_ok_; }
     bool keep_zip() const { return keep_zip_; }
     bool safe_keep_zip() const { return safe_keep_zip_; }
+    bool unzip_to_memory() const { return unzip_to_memory_; }
 
     double proportion() const { return proportion_; }
     double repeat() const { return repeat_; }
@@ -43,6 +45,9 @@ class Stream {
     void set_sample_offset(int64_t sample_offset) { sample_offset_ = sample_offset; }
     void set_num_samples(int64_t num_samples) { num_samples_ = num_samples; }
 
+    const ZSTD_DDict* zstd_dict() const { return zstd_dict_; }
+    void set_zstd_dict(const ZSTD_DDict* zstd_dict) { zstd_dict_ = zstd_dict; }
+
     // Initialize from its config and a backup config shared by all streams.
     bool Init(const string& name, const json& obj, const json& all, string* err);
 
@@ -57,6 +62,10 @@ class Stream {
     // Scan my local dir, normalizing files and gathering which shards are present.
     void CheckLocalDir(const vector<Shard*> shards, vector<bool>* is_present) const;
 
+    // Pick the first of my ranked hash algorithms that the file has a digest for and that we
+    // support. Returns whether there was one.
+    bool ChooseHashAlgo(const FileInfo* file, string* algo) const;
+
   private:
     // Sampling derivations.
     static bool DeriveSamplingRelatively(vector<Stream>* streams, uint32_t seed,
@@ -106,7 +115,11 @@ class Stream {
                      // false, drops iff remote is not local. If true, keeps.
 
     bool safe_keep_zip_;  // Whether to keep or drop compressed versions of shards upon download.
-                          // If false, drops. If true, keeps.
+                          // If false, drops. If true, keeps (always true if unzip_to_memory).
+
+    bool unzip_to_memory_;  // Whether to decompress zip shards into memory when read instead of
+                            // writing their raw files to disk. If true, only the zips are cached
+                            // on disk. Has no effect on uncompressed shards.
 
     // Weights.
     //
@@ -136,6 +149,13 @@ class Stream {
     int64_t num_shards_;     // Number of shards this stream contains.
     int64_t sample_offset_;  // Offset of our first sample over all streams.
     int64_t num_samples_;    // Number of samples this stream contains.
+
+    // Compression.
+    //
+    // This field is set during the process of loading all shards, not in init.
+
+    const ZSTD_DDict* zstd_dict_;  // Dictionary shared by all decompression of this stream's
+                                   // shards, if its index references one. Owned by the dataset.
 };
 
 }  // namespace xtreaming